@@ -0,0 +1,604 @@
+/*
+ * MockServer - a small stand-in for the ICQ login and BOS servers,
+ * enough to log a Client in and put it under load without a network
+ * connection.
+ *
+ * Copyright (C) 2002 Barnaby Gray <barnaby@beedesign.co.uk>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#include "MockServer.h"
+
+#include <sys/time.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "Capabilities.h"
+#include "ICQ.h"
+#include "exceptions.h"
+
+using namespace ICQ2000;
+using std::string;
+using std::map;
+using std::set;
+
+// FLAP channels
+static const unsigned char Channel_Login = 1;
+static const unsigned char Channel_SNAC = 2;
+static const unsigned char Channel_Close = 4;
+
+MockServer::Stats::Stats()
+  : logins(0), status_changes(0), messages_sent(0), messages_received(0),
+    acks_sent(0), packets_in(0), packets_out(0)
+{ }
+
+MockServer::MockServer(Select& sel)
+  : m_select(sel), m_next_cookie(1), m_base_uin(100000),
+    m_flap_rate(0), m_message_rate(0), m_flaps_due(0), m_messages_due(0),
+    m_last_poll(now()), m_message_seqnum(0)
+{ }
+
+MockServer::~MockServer()
+{
+  while (!m_sessions.empty()) close( (*m_sessions.begin()).first );
+
+  if (m_server.isStarted()) {
+    m_select.remove( m_server.getSocketHandle() );
+    m_server.Disconnect();
+  }
+}
+
+/*
+ * start listening, on any free port if none is given
+ */
+void MockServer::start(unsigned short port)
+{
+  m_server.setBindHost("127.0.0.1");
+  m_server.StartServer(port, port);
+  m_select.add( m_server.getSocketHandle(), Select::Read );
+}
+
+unsigned short MockServer::getPort() const { return m_server.getPort(); }
+
+void MockServer::setContacts(unsigned int n, unsigned int base)
+{
+  m_base_uin = base;
+  m_contacts.assign(n, Online);
+}
+
+unsigned int MockServer::getContactCount() const { return m_contacts.size(); }
+
+unsigned int MockServer::getBaseUIN() const { return m_base_uin; }
+
+bool MockServer::known(unsigned int uin) const
+{
+  return (uin >= m_base_uin && uin < m_base_uin + m_contacts.size());
+}
+
+/*
+ * contact status changes per second, across all contacts
+ */
+void MockServer::setFlapRate(double r) { m_flap_rate = r; }
+
+/*
+ * messages per second sent to each logged in session
+ */
+void MockServer::setMessageRate(double r) { m_message_rate = r; }
+
+const MockServer::Stats& MockServer::getStats() const { return m_stats; }
+
+double MockServer::now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+bool MockServer::handles(int fd) const
+{
+  return ( (m_server.isStarted() && fd == const_cast<TCPServer&>(m_server).getSocketHandle())
+	   || m_sessions.count(fd) > 0 );
+}
+
+void MockServer::socket_cb(int fd, Select::SocketInputCondition)
+{
+  if ( fd == m_server.getSocketHandle() ) {
+    accept();
+    return;
+  }
+
+  map<int, Session*>::iterator i = m_sessions.find(fd);
+  if (i != m_sessions.end()) recv( (*i).second );
+}
+
+void MockServer::accept()
+{
+  TCPSocket *sock = m_server.Accept();
+
+  Session *s = new Session;
+  s->sock = sock;
+  s->seqnum = (unsigned short)rand();
+  s->bos = false;
+  s->ready = false;
+  s->uin = 0;
+  m_sessions[ sock->getSocketHandle() ] = s;
+  m_select.add( sock->getSocketHandle(), Select::Read );
+
+  // connection acknowledge
+  Buffer body, b;
+  body << (unsigned int)0x00000001;
+  FLAPwrap(s, b, Channel_Login, body);
+  Send(s, b);
+}
+
+void MockServer::close(int fd)
+{
+  map<int, Session*>::iterator i = m_sessions.find(fd);
+  if (i == m_sessions.end()) return;
+
+  Session *s = (*i).second;
+  m_sessions.erase(i);
+  m_select.remove(fd);
+  delete s->sock;
+  delete s;
+}
+
+void MockServer::recv(Session *s)
+{
+  int fd = s->sock->getSocketHandle();
+
+  try {
+    while (s->sock->connected()) {
+      if (!s->sock->Recv(s->recv)) break;
+    }
+  } catch(SocketException e) {
+    close(fd);
+    return;
+  }
+
+  Buffer& b = s->recv;
+  while (!b.empty()) {
+    b.setPos(0);
+    unsigned char start, channel;
+    unsigned short seqnum, len;
+    b >> start;
+    if (start != 42) {
+      close(fd);
+      return;
+    }
+    if (b.remains() < 5) return;
+    b >> channel >> seqnum >> len;
+    if (b.remains() < len) return;
+
+    Buffer sb;
+    b.chopOffBuffer(sb, len+6);
+    sb.advance(6);
+    ++m_stats.packets_in;
+
+    try {
+      if (channel == Channel_Login) ParseCh1(s, sb);
+      else if (channel == Channel_SNAC) ParseCh2(s, sb);
+    } catch(ParseException e) {
+      // ignore anything we can't make sense of
+    }
+
+    if (m_sessions.count(fd) == 0) return;
+  }
+}
+
+void MockServer::Send(Session *s, Buffer& b)
+{
+  try {
+    s->sock->Send(b);
+  } catch(SocketException e) {
+    // picked up as closed on the next read
+  }
+}
+
+void MockServer::FLAPwrap(Session *s, Buffer& b, unsigned char channel, Buffer& body)
+{
+  b << (unsigned char)42
+    << channel
+    << s->seqnum++
+    << (unsigned short)body.size();
+  if (body.size() > 0) b.Pack( &*body.begin(), body.size() );
+  ++m_stats.packets_out;
+}
+
+void MockServer::SNACwrap(Session *s, Buffer& b, unsigned short family, unsigned short subtype,
+			  Buffer& body, unsigned int reqid)
+{
+  Buffer snac;
+  snac << family
+       << subtype
+       << (unsigned short)0x0000
+       << reqid;
+  if (body.size() > 0) snac.Pack( &*body.begin(), body.size() );
+  FLAPwrap(s, b, Channel_SNAC, snac);
+}
+
+/*
+ * channel 1 opens both connections - the authorizer sees the UIN
+ * and password, the BOS server sees the cookie it handed out
+ */
+void MockServer::ParseCh1(Session *s, Buffer& b)
+{
+  unsigned int version;
+  b >> version;
+
+  string screenname, cookie;
+  while (b.remains() >= 4) {
+    unsigned short type, len;
+    b >> type >> len;
+    string value;
+    b.Unpack(value, len);
+    if (type == 0x0001) screenname = value;
+    else if (type == 0x0006) cookie = value;
+  }
+
+  if (!cookie.empty()) {
+    map<string, unsigned int>::iterator i = m_cookies.find(cookie);
+    if (i == m_cookies.end()) {
+      close( s->sock->getSocketHandle() );
+      return;
+    }
+    s->bos = true;
+    s->uin = (*i).second;
+    m_cookies.erase(i);
+    SendServerReady(s);
+  } else if (!screenname.empty()) {
+    SendAuthReply(s, strtoul(screenname.c_str(), NULL, 10));
+  }
+}
+
+void MockServer::ParseCh2(Session *s, Buffer& b)
+{
+  unsigned short family, subtype, flags;
+  unsigned int reqid;
+  b >> family >> subtype >> flags >> reqid;
+
+  if (!s->bos) return;
+
+  switch( (family << 16) | subtype ) {
+  case 0x00010017: {
+    // capabilities - ack with the same list of families and versions
+    Buffer body, out;
+    while (b.beforeEnd()) {
+      unsigned short fam, ver;
+      b >> fam >> ver;
+      body << fam << ver;
+    }
+    SNACwrap(s, out, 0x0001, 0x0018, body, reqid);
+    Send(s, out);
+    break;
+  }
+  case 0x00010006:
+    SendRateInfo(s, reqid);
+    break;
+  case 0x00010002: {
+    // client ready - the login is complete
+    s->ready = true;
+    ++m_stats.logins;
+    set<unsigned int>::const_iterator curr = s->buddies.begin();
+    while (curr != s->buddies.end()) {
+      if (known(*curr) && m_contacts[*curr - m_base_uin] != Offline) SendBuddyStatus(s, *curr);
+      ++curr;
+    }
+    break;
+  }
+  case 0x00030004:
+  case 0x00030005:
+    while (b.beforeEnd()) {
+      string sn;
+      b.UnpackByteString(sn);
+      unsigned int uin = strtoul(sn.c_str(), NULL, 10);
+      if (!known(uin)) continue;
+      if (subtype == 0x0004) s->buddies.insert(uin);
+      else s->buddies.erase(uin);
+    }
+    break;
+  case 0x00040006:
+    ParseMessage(s, b);
+    break;
+  case 0x00130004:
+  case 0x00130005:
+    SendContactList(s, reqid);
+    break;
+  default:
+    // everything else is accepted silently
+    b.advance(b.remains());
+    break;
+  }
+}
+
+/*
+ * count incoming messages, and acknowledge advanced ones as though
+ * the contact's client had - the ack carries back the message's own
+ * ICQ subtype, marked as an ack
+ */
+void MockServer::ParseMessage(Session *s, Buffer& b)
+{
+  string cookie, sn;
+  unsigned short channel;
+  b.Unpack(cookie, 8);
+  b >> channel;
+  b.UnpackByteString(sn);
+  ++m_stats.messages_received;
+
+  if (channel != 0x0002) {
+    b.advance(b.remains());
+    return;
+  }
+
+  // locate the 0x2711 TLV inside TLV 0x0005
+  unsigned short type, len;
+  b >> type >> len;
+  if (type != 0x0005) {
+    b.advance(b.remains());
+    return;
+  }
+  unsigned int end = b.pos() + len;
+  b.advance(2 + 8 + 16); // status, cookie, capability
+
+  while (b.pos() + 4 <= end) {
+    b >> type >> len;
+    if (type != 0x2711) {
+      b.advance(len);
+      continue;
+    }
+
+    Buffer adv(b, b.pos(), len);
+    adv.setLittleEndian();
+
+    // the two sections before the subtype are echoed as they are
+    unsigned short l;
+    adv >> l;
+    adv.advance(l);
+    adv >> l;
+    adv.advance(l);
+    unsigned int header = adv.pos();
+
+    ICQSubType *ist = ICQSubType::ParseICQSubType(adv, true, false);
+    UINICQSubType *ust = dynamic_cast<UINICQSubType*>(ist);
+    if (ust == NULL) {
+      delete ist;
+      break;
+    }
+    ust->setACK(true);
+
+    Buffer body, out;
+    body.Pack( (const unsigned char*)cookie.data(), cookie.size() );
+    body << (unsigned short)0x0002;
+    body.PackByteString(sn);
+    body << (unsigned short)0x0003;
+    body.Pack( &*adv.begin(), header );
+    body.setLittleEndian();
+    ust->Output(body);
+    delete ist;
+
+    SNACwrap(s, out, 0x0004, 0x000b, body);
+    Send(s, out);
+    ++m_stats.acks_sent;
+    break;
+  }
+
+  b.advance(b.remains());
+}
+
+void MockServer::SendAuthReply(Session *s, unsigned int uin)
+{
+  char ck[32];
+  sprintf(ck, "mock%08x%08x", uin, m_next_cookie++);
+  string cookie(ck);
+  m_cookies[cookie] = uin;
+
+  char redirect[32];
+  sprintf(redirect, "127.0.0.1:%u", getPort());
+
+  Buffer body, b;
+  char sn[16];
+  sprintf(sn, "%u", uin);
+  body << (unsigned short)0x0001 << string(sn);
+  body << (unsigned short)0x0005 << string(redirect);
+  body << (unsigned short)0x0006 << cookie;
+  FLAPwrap(s, b, Channel_Close, body);
+  Send(s, b);
+}
+
+void MockServer::SendServerReady(Session *s)
+{
+  Buffer body, b;
+  body << (unsigned short)0x0001
+       << (unsigned short)0x0002
+       << (unsigned short)0x0003
+       << (unsigned short)0x0004
+       << (unsigned short)0x0009
+       << (unsigned short)0x0013
+       << (unsigned short)0x0015;
+  SNACwrap(s, b, 0x0001, 0x0003, body);
+  Send(s, b);
+}
+
+/*
+ * one rate class, with the classes and groups left empty - Client
+ * only skips over this
+ */
+void MockServer::SendRateInfo(Session *s, unsigned int reqid)
+{
+  Buffer body, b;
+  for (int i = 0; i < 179; ++i) body << (unsigned char)0;
+  body << (unsigned short)0;
+  for (int i = 0; i < 68; ++i) body << (unsigned char)0;
+  SNACwrap(s, b, 0x0001, 0x0007, body, reqid);
+  Send(s, b);
+}
+
+/*
+ * every contact, in a single group
+ */
+void MockServer::SendContactList(Session *s, unsigned int reqid)
+{
+  unsigned int n = m_contacts.size();
+  if (n > 0xfffe) n = 0xfffe;
+
+  Buffer body, b;
+  body << (unsigned char)0x00
+       << (unsigned short)(n + 1);
+
+  body << string("Mock")
+       << (unsigned short)0x0001  // group id
+       << (unsigned short)0x0000  // tag id
+       << (unsigned short)0x0001  // group
+       << (unsigned short)0x0000;
+
+  for (unsigned int i = 0; i < n; ++i) {
+    char sn[16];
+    sprintf(sn, "%u", m_base_uin + i);
+    string nick = string("Mock ") + sn;
+
+    body << string(sn)
+	 << (unsigned short)0x0001
+	 << (unsigned short)(i + 1)
+	 << (unsigned short)0x0000  // contact
+	 << (unsigned short)(4 + nick.size())
+	 << (unsigned short)0x0131 << nick;
+  }
+
+  body << (unsigned int)0;  // timestamp
+
+  SNACwrap(s, b, 0x0013, 0x0006, body, reqid);
+  Send(s, b);
+}
+
+void MockServer::OutputUserInfo(Buffer& b, unsigned int uin)
+{
+  char sn[16];
+  sprintf(sn, "%u", uin);
+  b.PackByteString(sn);
+  b << (unsigned short)0x0000;  // warning level
+
+  if (!known(uin) || m_contacts[uin - m_base_uin] == Offline) {
+    b << (unsigned short)0x0000;
+    return;
+  }
+
+  Capabilities caps;
+  caps.set_capability_flag(Capabilities::ICQ);
+  caps.set_capability_flag(Capabilities::ICQServerRelay);
+
+  b << (unsigned short)0x0003;
+  b << (unsigned short)0x0001 << (unsigned short)0x0002 << (unsigned short)0x0050;
+  b << (unsigned short)0x0006 << (unsigned short)0x0004
+    << (unsigned char)0x00 << (unsigned char)0x00
+    << (unsigned short)(m_contacts[uin - m_base_uin] == Away ? 0x0001 : 0x0000);
+  b << (unsigned short)0x000d << caps.get_length();
+  caps.Output(b);
+}
+
+void MockServer::SendBuddyStatus(Session *s, unsigned int uin)
+{
+  bool offline = (!known(uin) || m_contacts[uin - m_base_uin] == Offline);
+
+  Buffer body, b;
+  OutputUserInfo(body, uin);
+  SNACwrap(s, b, 0x0003, (offline ? 0x000c : 0x000b), body);
+  Send(s, b);
+}
+
+/*
+ * a plain message, its text stamped with the time it was sent
+ */
+void MockServer::SendMessage(Session *s, unsigned int uin)
+{
+  char text[64];
+  sprintf(text, "mock %lu sent %.6f", m_message_seqnum, now());
+
+  Buffer body, b;
+  body << (unsigned int)m_message_seqnum
+       << (unsigned int)0x6d6f636b;  // cookie
+  ++m_message_seqnum;
+  body << (unsigned short)0x0001;
+  OutputUserInfo(body, uin);
+
+  string t(text);
+  body << (unsigned short)0x0002
+       << (unsigned short)(5 + 4 + 4 + t.size())
+       << (unsigned short)0x0501 << (unsigned short)0x0001 << (unsigned char)0x01
+       << (unsigned short)0x0101 << (unsigned short)(4 + t.size())
+       << (unsigned short)0x0000 << (unsigned short)0x0000;
+  body.Pack(t);
+
+  SNACwrap(s, b, 0x0004, 0x0007, body);
+  Send(s, b);
+  ++m_stats.messages_sent;
+}
+
+/*
+ * move one contact on to its next state and tell every session that
+ * has it as a buddy
+ */
+void MockServer::flap()
+{
+  if (m_contacts.empty()) return;
+
+  unsigned int i = rand() % m_contacts.size();
+  ContactState& st = m_contacts[i];
+  st = (st == Online ? Away : (st == Away ? Offline : Online));
+  ++m_stats.status_changes;
+
+  map<int, Session*>::iterator curr = m_sessions.begin();
+  while (curr != m_sessions.end()) {
+    Session *s = (*curr).second;
+    ++curr;
+    if (s->ready && s->buddies.count(m_base_uin + i)) SendBuddyStatus(s, m_base_uin + i);
+  }
+}
+
+void MockServer::message()
+{
+  if (m_contacts.empty()) return;
+
+  map<int, Session*>::iterator curr = m_sessions.begin();
+  while (curr != m_sessions.end()) {
+    Session *s = (*curr).second;
+    ++curr;
+    if (s->ready) SendMessage(s, m_base_uin + rand() % m_contacts.size());
+  }
+}
+
+/*
+ * generate whatever load has come due since the last call
+ */
+void MockServer::Poll()
+{
+  double t = now();
+  double dt = t - m_last_poll;
+  m_last_poll = t;
+
+  m_flaps_due += m_flap_rate * dt;
+  m_messages_due += m_message_rate * dt;
+
+  while (m_flaps_due >= 1.0) {
+    flap();
+    m_flaps_due -= 1.0;
+  }
+
+  while (m_messages_due >= 1.0) {
+    message();
+    m_messages_due -= 1.0;
+  }
+}
@@ -0,0 +1,147 @@
+/*
+ * MockServer - a small stand-in for the ICQ login and BOS servers,
+ * enough to log a Client in and put it under load without a network
+ * connection.
+ *
+ * Copyright (C) 2002 Barnaby Gray <barnaby@beedesign.co.uk>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#ifndef EXAMPLE_MOCKSERVER_H
+#define EXAMPLE_MOCKSERVER_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "socket.h"
+#include "buffer.h"
+
+#include "Select.h"
+
+// ------------------------------------------------------------------
+// MockServer class
+// ------------------------------------------------------------------
+
+/*
+ * One listening port serves as both the authorizer and the BOS
+ * server: the authorizer redirects to the same port with a cookie,
+ * and a connection is told apart by whether it opens with a UIN or a
+ * cookie.
+ *
+ * The server holds a set of fake contacts, all online to begin with.
+ * Poll generates load on every logged in session: status changes for
+ * contacts (cycling online, away, offline) and incoming messages, at
+ * the configured rates. Messages carry the time they were sent, so
+ * the receiving end can work out the latency.
+ */
+class MockServer {
+ public:
+  struct Stats {
+    unsigned long logins;
+    unsigned long status_changes;
+    unsigned long messages_sent;
+    unsigned long messages_received;
+    unsigned long acks_sent;
+    unsigned long packets_in, packets_out;
+
+    Stats();
+  };
+
+ private:
+  enum ContactState {
+    Online,
+    Away,
+    Offline
+  };
+
+  struct Session {
+    ICQ2000::TCPSocket *sock;
+    ICQ2000::Buffer recv;
+    unsigned short seqnum;
+    bool bos, ready;
+    unsigned int uin;
+    std::set<unsigned int> buddies;
+  };
+
+  Select& m_select;
+  ICQ2000::TCPServer m_server;
+  std::map<int, Session*> m_sessions;
+  std::map<std::string, unsigned int> m_cookies;
+  unsigned int m_next_cookie;
+
+  unsigned int m_base_uin;
+  std::vector<ContactState> m_contacts;
+
+  double m_flap_rate, m_message_rate;
+  double m_flaps_due, m_messages_due;
+  double m_last_poll;
+  unsigned long m_message_seqnum;
+
+  Stats m_stats;
+
+  void accept();
+  void close(int fd);
+  void recv(Session *s);
+
+  void Send(Session *s, ICQ2000::Buffer& b);
+  void FLAPwrap(Session *s, ICQ2000::Buffer& b, unsigned char channel, ICQ2000::Buffer& body);
+  void SNACwrap(Session *s, ICQ2000::Buffer& b, unsigned short family, unsigned short subtype,
+		ICQ2000::Buffer& body, unsigned int reqid = 0);
+
+  void ParseCh1(Session *s, ICQ2000::Buffer& b);
+  void ParseCh2(Session *s, ICQ2000::Buffer& b);
+  void ParseMessage(Session *s, ICQ2000::Buffer& b);
+
+  void SendAuthReply(Session *s, unsigned int uin);
+  void SendServerReady(Session *s);
+  void SendRateInfo(Session *s, unsigned int reqid);
+  void SendContactList(Session *s, unsigned int reqid);
+  void SendBuddyStatus(Session *s, unsigned int uin);
+  void SendMessage(Session *s, unsigned int uin);
+  void OutputUserInfo(ICQ2000::Buffer& b, unsigned int uin);
+
+  bool known(unsigned int uin) const;
+  void flap();
+  void message();
+
+ public:
+  MockServer(Select& sel);
+  ~MockServer();
+
+  void start(unsigned short port = 0);
+  unsigned short getPort() const;
+
+  void setContacts(unsigned int n, unsigned int base = 100000);
+  unsigned int getContactCount() const;
+  unsigned int getBaseUIN() const;
+
+  void setFlapRate(double r);
+  void setMessageRate(double r);
+
+  bool handles(int fd) const;
+  void socket_cb(int fd, Select::SocketInputCondition cond);
+
+  void Poll();
+
+  const Stats& getStats() const;
+
+  static double now();
+};
+
+#endif // EXAMPLE_MOCKSERVER_H
@@ -0,0 +1,385 @@
+/*
+ * mockserver.cpp - runs a MockServer on the local machine, so the
+ * library can be logged in and put under load without the real ICQ
+ * servers. Optionally runs a Client in the same process against it,
+ * and reports the latencies it sees.
+ *
+ * Copyright (C) 2002 Barnaby Gray <barnaby@beedesign.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * Examples of usage:
+ *  ./ickle-mockserver -p 5190 -c 200 -f 50
+ *   serves 200 contacts on port 5190, 50 status changes a second
+ *
+ *  ./ickle-mockserver -b 12345 -c 1000 -f 200 -m 20 -a 20 -t 30
+ *   also logs in a Client as 12345, which receives 20 messages a
+ *   second and sends 20 advanced messages a second, for 30 seconds
+ *
+ * A script given with -s changes the load as the run goes on. Each
+ * line is "<seconds> <command> <value>", with the commands:
+ *   flap <rate>       contact status changes per second
+ *   messages <rate>   messages per second to each session
+ *   send <rate>       messages per second sent by the client (-b)
+ *   quit 0            stop
+ *
+ * A line of statistics is printed every second, as "key value"
+ * pairs.
+ */
+
+#include <libicq2000/Client.h>
+#include <libicq2000/events.h>
+
+#include "MockServer.h"
+#include "Select.h"
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <map>
+#include <vector>
+#include <fstream>
+#include <iostream>
+
+using namespace std;
+using namespace ICQ2000;
+
+// ------------------------------------------------------------------
+//  Latency
+// ------------------------------------------------------------------
+
+struct Latency {
+  unsigned long count;
+  double total, max;
+
+  Latency() : count(0), total(0), max(0) { }
+
+  void add(double t) {
+    ++count;
+    total += t;
+    if (t > max) max = t;
+  }
+
+  double mean_us() const { return (count > 0 ? total * 1e6 / count : 0); }
+};
+
+// ------------------------------------------------------------------
+//  Bench client - a Client logged in to the mock server
+// ------------------------------------------------------------------
+
+class BenchClient : public sigslot::has_slots<>
+{
+ private:
+  Select& m_select;
+  std::vector<ContactRef> m_contacts;
+  std::map<MessageEvent*, double> m_sent;
+  double m_send_rate, m_send_due, m_last_poll;
+
+  void socket_cb(SocketEvent *ev);
+  void connected_cb(ConnectedEvent *ev);
+  void disconnected_cb(DisconnectedEvent *ev);
+  void message_cb(MessageEvent *ev);
+  void messageack_cb(MessageEvent *ev);
+  void status_cb(StatusChangeEvent *ev);
+  void sbl_cb(ServerBasedContactEvent *ev);
+
+ public:
+  Client client;
+  bool logged_in;
+  unsigned long status_changes, messages, acks, failed;
+  unsigned int sbl_contacts;
+  Latency message_latency, ack_latency;
+
+  BenchClient(Select& sel, unsigned int uin, unsigned short port,
+	      unsigned int contacts, unsigned int base);
+
+  void setSendRate(double r) { m_send_rate = r; }
+  void Poll();
+};
+
+BenchClient::BenchClient(Select& sel, unsigned int uin, unsigned short port,
+			 unsigned int contacts, unsigned int base)
+  : m_select(sel), m_send_rate(0), m_send_due(0), m_last_poll(MockServer::now()),
+    client(uin, "mock"), logged_in(false),
+    status_changes(0), messages(0), acks(0), failed(0), sbl_contacts(0)
+{
+  client.socket.connect(this, &BenchClient::socket_cb);
+  client.connected.connect(this, &BenchClient::connected_cb);
+  client.disconnected.connect(this, &BenchClient::disconnected_cb);
+  client.messaged.connect(this, &BenchClient::message_cb);
+  client.messageack.connect(this, &BenchClient::messageack_cb);
+  client.contact_status_change_signal.connect(this, &BenchClient::status_cb);
+  client.server_based_contact_list.connect(this, &BenchClient::sbl_cb);
+
+  client.setLoginServerHost("127.0.0.1");
+  client.setLoginServerPort(port);
+  client.setAcceptInDC(false);
+
+  ContactTree::Group& gp = client.getContactTree().add_group("Mock");
+  for (unsigned int i = 0; i < contacts; ++i)
+    m_contacts.push_back( gp.add( ContactRef(new Contact(base + i)) ) );
+
+  client.fetchServerBasedContactList();
+  client.setStatus(STATUS_ONLINE);
+}
+
+void BenchClient::socket_cb(SocketEvent *ev)
+{
+  if (dynamic_cast<AddSocketHandleEvent*>(ev) != NULL) {
+    AddSocketHandleEvent *cev = dynamic_cast<AddSocketHandleEvent*>(ev);
+    m_select.add( cev->getSocketHandle(),
+		  (Select::SocketInputCondition)
+		  ((cev->isRead() ? Select::Read : 0) |
+		   (cev->isWrite() ? Select::Write : 0) |
+		   (cev->isException() ? Select::Exception : 0)) );
+  } else if (dynamic_cast<RemoveSocketHandleEvent*>(ev) != NULL) {
+    RemoveSocketHandleEvent *cev = dynamic_cast<RemoveSocketHandleEvent*>(ev);
+    m_select.remove( cev->getSocketHandle() );
+  }
+}
+
+void BenchClient::connected_cb(ConnectedEvent *)
+{
+  logged_in = true;
+}
+
+void BenchClient::disconnected_cb(DisconnectedEvent *)
+{
+  logged_in = false;
+  cerr << "bench client disconnected" << endl;
+}
+
+void BenchClient::message_cb(MessageEvent *ev)
+{
+  ++messages;
+
+  NormalMessageEvent *nev = dynamic_cast<NormalMessageEvent*>(ev);
+  if (nev == NULL) return;
+
+  string text = nev->getMessage();
+  string::size_type i = text.find(" sent ");
+  if (i != string::npos)
+    message_latency.add( MockServer::now() - strtod(text.c_str() + i + 6, NULL) );
+}
+
+void BenchClient::messageack_cb(MessageEvent *ev)
+{
+  std::map<MessageEvent*, double>::iterator i = m_sent.find(ev);
+  if (i == m_sent.end()) return;
+
+  if (ev->isDelivered()) {
+    ++acks;
+    ack_latency.add( MockServer::now() - (*i).second );
+  } else {
+    ++failed;
+  }
+  m_sent.erase(i);
+}
+
+void BenchClient::status_cb(StatusChangeEvent *)
+{
+  ++status_changes;
+}
+
+void BenchClient::sbl_cb(ServerBasedContactEvent *ev)
+{
+  if (ev->getType() == ServerBasedContactEvent::Fetch)
+    sbl_contacts = ev->getContactList().size();
+}
+
+void BenchClient::Poll()
+{
+  double t = MockServer::now();
+  m_send_due += m_send_rate * (t - m_last_poll);
+  m_last_poll = t;
+
+  while (m_send_due >= 1.0) {
+    m_send_due -= 1.0;
+    if (!logged_in || m_contacts.empty()) continue;
+
+    // online contacts accept advanced messages, so they get acked
+    ContactRef ct = m_contacts[ rand() % m_contacts.size() ];
+    if (ct->getStatus() == STATUS_OFFLINE) continue;
+
+    MessageEvent *ev = new NormalMessageEvent(ct, "bench");
+    m_sent[ev] = t;
+    client.SendEvent(ev);
+  }
+
+  client.Poll();
+}
+
+// ------------------------------------------------------------------
+//  Runner - dispatches socket events between server and client
+// ------------------------------------------------------------------
+
+class Runner : public sigslot::has_slots<>
+{
+ public:
+  Select input;
+  MockServer server;
+  BenchClient *bench;
+
+  Runner() : server(input), bench(NULL)
+  {
+    input.socket_signal.connect( this, &Runner::select_socket_cb );
+  }
+
+  ~Runner() { delete bench; }
+
+  void select_socket_cb(int fd, Select::SocketInputCondition cond)
+  {
+    if (server.handles(fd)) server.socket_cb(fd, cond);
+    else if (bench != NULL) bench->client.socket_cb(fd, (SocketEvent::Mode)cond);
+  }
+};
+
+struct ScriptLine {
+  double at;
+  string command;
+  double value;
+};
+
+static void usage(const char *progname) {
+  cerr << "Usage: " << progname << " [options]" << endl
+       << " -h              This screen" << endl
+       << " -p port         Port to listen on (default any)" << endl
+       << " -c contacts     Number of contacts (default 100)" << endl
+       << " -u uin          First contact UIN (default 100000)" << endl
+       << " -f rate         Contact status changes per second" << endl
+       << " -m rate         Messages per second to each session" << endl
+       << " -s script       Script of load changes" << endl
+       << " -t seconds      Stop after this long" << endl
+       << " -b uin          Run a Client in process, logged in as uin" << endl
+       << " -a rate         Messages per second sent by that Client" << endl;
+  exit(1);
+}
+
+int main(int argc, char *argv[]) {
+  unsigned short port = 0;
+  unsigned int contacts = 100, base = 100000, bench_uin = 0;
+  double flap_rate = 0, message_rate = 0, send_rate = 0, duration = 0;
+  vector<ScriptLine> script;
+
+  int c;
+  while ((c = getopt(argc, argv, "hp:c:u:f:m:s:t:b:a:")) != -1) {
+    switch(c) {
+    case 'p': port = atoi(optarg); break;
+    case 'c': contacts = strtoul(optarg, NULL, 10); break;
+    case 'u': base = strtoul(optarg, NULL, 10); break;
+    case 'f': flap_rate = atof(optarg); break;
+    case 'm': message_rate = atof(optarg); break;
+    case 't': duration = atof(optarg); break;
+    case 'b': bench_uin = strtoul(optarg, NULL, 10); break;
+    case 'a': send_rate = atof(optarg); break;
+    case 's': {
+      ifstream in(optarg);
+      if (!in) {
+	cerr << "Couldn't open script " << optarg << endl;
+	return 1;
+      }
+      string line;
+      while (getline(in, line)) {
+	if (line.empty() || line[0] == '#') continue;
+	ScriptLine sl;
+	char cmd[32];
+	if (sscanf(line.c_str(), "%lf %31s %lf", &sl.at, cmd, &sl.value) < 2) continue;
+	sl.command = cmd;
+	script.push_back(sl);
+      }
+      break;
+    }
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (optind != argc) usage(argv[0]);
+
+  Runner r;
+  r.server.setContacts(contacts, base);
+  r.server.setFlapRate(flap_rate);
+  r.server.setMessageRate(message_rate);
+  try {
+    r.server.start(port);
+  } catch(SocketException e) {
+    cerr << "Couldn't start server: " << e.what() << endl;
+    return 1;
+  }
+  cout << "port " << r.server.getPort() << endl;
+
+  if (bench_uin != 0) {
+    r.bench = new BenchClient(r.input, bench_uin, r.server.getPort(), contacts, base);
+    r.bench->setSendRate(send_rate);
+  }
+
+  double start = MockServer::now(), last_report = start;
+  vector<ScriptLine>::const_iterator next = script.begin();
+  MockServer::Stats last = r.server.getStats();
+
+  while (true) {
+    r.input.run(10);
+
+    double t = MockServer::now() - start;
+    if (duration > 0 && t >= duration) break;
+
+    bool quit = false;
+    while (next != script.end() && (*next).at <= t) {
+      const ScriptLine& sl = *next;
+      if (sl.command == "flap") r.server.setFlapRate(sl.value);
+      else if (sl.command == "messages") r.server.setMessageRate(sl.value);
+      else if (sl.command == "send" && r.bench != NULL) r.bench->setSendRate(sl.value);
+      else if (sl.command == "quit") quit = true;
+      ++next;
+    }
+    if (quit) break;
+
+    r.server.Poll();
+    if (r.bench != NULL) r.bench->Poll();
+
+    if (MockServer::now() - last_report >= 1.0) {
+      last_report = MockServer::now();
+      const MockServer::Stats& st = r.server.getStats();
+
+      printf("time %.1f logins %lu status_changes %lu messages_sent %lu"
+	     " messages_received %lu acks_sent %lu packets_in %lu packets_out %lu",
+	     t, st.logins,
+	     st.status_changes - last.status_changes,
+	     st.messages_sent - last.messages_sent,
+	     st.messages_received - last.messages_received,
+	     st.acks_sent - last.acks_sent,
+	     st.packets_in - last.packets_in,
+	     st.packets_out - last.packets_out);
+      last = st;
+
+      if (r.bench != NULL) {
+	BenchClient& b = *r.bench;
+	printf(" client_logged_in %d client_sbl_contacts %u client_status_changes %lu client_messages %lu"
+	       " client_acks %lu client_failed %lu message_latency_us %.0f"
+	       " message_latency_max_us %.0f ack_latency_us %.0f ack_latency_max_us %.0f",
+	       b.logged_in, b.sbl_contacts, b.status_changes, b.messages, b.acks, b.failed,
+	       b.message_latency.mean_us(), b.message_latency.max * 1e6,
+	       b.ack_latency.mean_us(), b.ack_latency.max * 1e6);
+	b.status_changes = b.messages = b.acks = b.failed = 0;
+	b.message_latency = Latency();
+	b.ack_latency = Latency();
+      }
+
+      printf("\n");
+      fflush(stdout);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,226 @@
+/*
+ * replay.cpp - feeds a packet capture recorded with
+ * Client::startCapture back through a Client, with no sockets
+ * involved, and reports how fast the library got through it.
+ *
+ * Copyright (C) 2001 Barnaby Gray <barnaby@beedesign.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * Examples of usage:
+ *  ./ickle-replay login.cap
+ *   replays the capture once, for uin 0
+ *
+ *  ./ickle-replay -u 12345678 -n 50 login.cap
+ *   replays it 50 times as uin 12345678 and averages
+ *
+ * Only the server stream is replayed. Direct connection packets in
+ * the capture are counted but skipped, as they depend on the keys
+ * of a live session.
+ *
+ * The output is one "key value" pair per line, so it can be
+ * compared between runs by a script.
+ */
+
+#include <libicq2000/Client.h>
+
+#include "Capture.h"
+#include "sstream_fix.h"
+
+#include <sys/time.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <new>
+#include <map>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+
+using namespace std;
+using namespace ICQ2000;
+
+// ------------------------------------------------------------------
+//  Allocation counting
+// ------------------------------------------------------------------
+
+static unsigned long allocations = 0;
+
+// the exception specifications operator new was declared with before C++11
+#if __cplusplus >= 201103L
+#define THROW_BAD_ALLOC
+#define THROW_NOTHING noexcept
+#else
+#define THROW_BAD_ALLOC throw(std::bad_alloc)
+#define THROW_NOTHING throw()
+#endif
+
+void* operator new(size_t sz) THROW_BAD_ALLOC {
+  ++allocations;
+  void *p = malloc(sz == 0 ? 1 : sz);
+  if (p == NULL) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void *p) THROW_NOTHING {
+  free(p);
+}
+
+void* operator new[](size_t sz) THROW_BAD_ALLOC {
+  return operator new(sz);
+}
+
+void operator delete[](void *p) THROW_NOTHING {
+  operator delete(p);
+}
+
+// ------------------------------------------------------------------
+//  Timing
+// ------------------------------------------------------------------
+
+static double now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+struct Latency {
+  unsigned long count;
+  double total, max;
+
+  Latency() : count(0), total(0), max(0) { }
+
+  void add(double t) {
+    ++count;
+    total += t;
+    if (t > max) max = t;
+  }
+};
+
+/*
+ * key for the latency table: the SNAC family and subtype for
+ * channel 2, otherwise just the channel
+ */
+static unsigned int packet_type(const string& d) {
+  if (d.size() >= 10 && d[1] == 2)
+    return ((unsigned char)d[6] << 24) | ((unsigned char)d[7] << 16)
+      | ((unsigned char)d[8] << 8) | (unsigned char)d[9];
+  return (d.size() >= 2 ? (unsigned char)d[1] : 0);
+}
+
+static void usage(const char *progname) {
+  cerr << "Usage: " << progname << " [options] capturefile" << endl
+       << " -h              This screen" << endl
+       << " -u uin          UIN to replay as (default 0)" << endl
+       << " -n count        Number of times to replay the capture (default 1)" << endl;
+  exit(1);
+}
+
+int main(int argc, char *argv[]) {
+  unsigned int uin = 0, runs = 1;
+
+  int c;
+  while ((c = getopt(argc, argv, "hu:n:")) != -1) {
+    switch(c) {
+    case 'u':
+      uin = strtoul(optarg, NULL, 10);
+      break;
+    case 'n':
+      runs = strtoul(optarg, NULL, 10);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (optind != argc-1 || runs == 0) usage(argv[0]);
+
+  // read the whole capture in first, so file access isn't timed
+  vector<CaptureReader::Record> records;
+  {
+    CaptureReader reader;
+    if (!reader.open(argv[optind])) {
+      cerr << "Couldn't open capture " << argv[optind] << endl;
+      return 1;
+    }
+
+    CaptureReader::Record r;
+    while (reader.next(r)) records.push_back(r);
+  }
+
+  unsigned long packets = 0, bytes = 0, skipped = 0;
+  map<unsigned int, Latency> latency;
+
+  unsigned long alloc_start = allocations;
+  double start = now();
+
+  for (unsigned int run = 0; run < runs; ++run) {
+    Client cl(uin, "");
+    cl.setAcceptInDC(false);
+    cl.beginReplay();
+
+    vector<CaptureReader::Record>::const_iterator curr = records.begin();
+    while (curr != records.end()) {
+      const string& d = (*curr).data;
+
+      if ((*curr).stream != CaptureSink::Server || d.empty()) {
+	++skipped;
+	++curr;
+	continue;
+      }
+
+      double t = now();
+      cl.replayServerData((const unsigned char*)d.data(), d.size());
+      latency[ packet_type(d) ].add(now() - t);
+
+      ++packets;
+      bytes += d.size();
+      ++curr;
+    }
+
+    cl.endReplay();
+  }
+
+  double elapsed = now() - start;
+  unsigned long allocs = allocations - alloc_start;
+
+  cout << setiosflags(ios::fixed) << setprecision(3);
+  cout << "runs " << runs << endl
+       << "packets " << packets << endl
+       << "bytes " << bytes << endl
+       << "skipped " << skipped << endl
+       << "seconds " << elapsed << endl
+       << "packets_per_second " << (elapsed > 0 ? packets / elapsed : 0) << endl
+       << "allocations " << allocs << endl
+       << "allocations_per_packet " << (packets > 0 ? (double)allocs / packets : 0) << endl;
+
+  map<unsigned int, Latency>::const_iterator lcurr = latency.begin();
+  while (lcurr != latency.end()) {
+    unsigned int type = (*lcurr).first;
+    const Latency& l = (*lcurr).second;
+
+    ostringstream key;
+    if (type > 0xff)
+      key << "snac_" << hex << setfill('0') << setw(4) << (type >> 16)
+	  << "_" << setw(4) << (type & 0xffff);
+    else
+      key << "channel_" << type;
+
+    cout << key.str() << " count " << l.count
+	 << " mean_us " << l.total * 1e6 / l.count
+	 << " max_us " << l.max * 1e6 << endl;
+    ++lcurr;
+  }
+
+  return 0;
+}
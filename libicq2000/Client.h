@@ -26,6 +26,7 @@
 #include <string>
 
 #include <map>
+#include <set>
 
 #include <libicq2000/sigslot.h>
 
@@ -36,6 +37,7 @@
 #include <libicq2000/Contact.h>
 #include <libicq2000/ContactTree.h>
 #include <libicq2000/ContactList.h>
+#include <libicq2000/RequestHandle.h>
 #include <libicq2000/userinfoconstants.h>
 
 namespace ICQ2000
@@ -54,9 +56,16 @@ namespace ICQ2000
   class OutSNAC;
   class DirectClient;
   class DCCache;
+  class DCPathCache;
+  class RouteStats;
+  class UserInfoFetcher;
+  class CaptureSink;
+  class MessageTracer;
+  class FLAPFramer;
   class MessageHandler;
   class RequestIDCache;
   class RequestIDCacheValue;
+  class SearchCacheValue;
   class ICBMCookieCache;
   class SMTPClient;
   class SocketClient;
@@ -66,6 +75,8 @@ namespace ICQ2000
   class Translator;
   class FileTransferClient;
   class FTCache;
+  class SBLEdit;
+  class SBLEditACKSNAC;
 
   /**
    *  The main library object.  This is the object the user interface
@@ -113,7 +124,29 @@ namespace ICQ2000
     ContactList m_visible_list;
     ContactList m_invisible_list;
 
-    bool m_fetch_sbl;
+    bool m_fetch_sbl, m_fetch_sbl_conditional;
+
+    // contact status changes held back for one PresenceBatchEvent
+    bool m_presence_batching;
+    bool m_offline_batching;
+    unsigned int m_presence_window;
+    time_t m_presence_batch_start;
+    PresenceBatchEvent m_presence_batch;
+    std::map<unsigned int, unsigned int> m_presence_batch_index;
+
+    // counters on our own traffic, and how often to report them
+    Metrics m_metrics;
+    unsigned int m_metrics_interval;
+    time_t m_metrics_last;
+
+    unsigned int m_sbl_timestamp;
+    unsigned short m_sbl_size;
+    unsigned short m_sbl_max_contacts, m_sbl_max_groups;
+
+    // what is on the server-based list, as far as we know
+    std::set<unsigned short> m_sbl_groups;
+    ContactList m_sbl_removed;
+    std::map<unsigned short, std::string> m_sbl_removed_groups;
 
     MessageHandler * m_message_handler;
 
@@ -130,6 +163,11 @@ namespace ICQ2000
     SMTPClient * m_smtp;
 
     DCCache * m_dccache;
+    DCPathCache * m_dcpathcache;
+    RouteStats * m_routestats;
+    UserInfoFetcher * m_userinfo_fetcher;
+    CaptureSink * m_capture;
+    MessageTracer * m_tracer;
     FTCache * m_ftcache;
 
     time_t m_last_server_ping;
@@ -138,6 +176,11 @@ namespace ICQ2000
     ICBMCookieCache * m_cookiecache;
 
     Buffer * m_recv;
+    FLAPFramer * m_framer;
+
+    // feeding a capture back in, with the sockets out of the loop
+    bool m_replaying;
+    unsigned int m_server_stream;
    
     void Init();
     unsigned short NextSeqNum();
@@ -152,6 +195,7 @@ namespace ICQ2000
     void PingServer();
 
     DirectClient* ConnectDirect(const ContactRef& c);
+    DirectClient* StartDirect(const ContactRef& c, unsigned int ip, unsigned short port);
     void DisconnectDirectConns();
     void DisconnectDirectConn(int fd);
 
@@ -221,8 +265,23 @@ namespace ICQ2000
     // -------------------------------------------------------
 
     ContactRef getUserInfoCacheContact(unsigned int reqid);
+    void HandleSearchResult(SrvResponseSNAC *snac, SearchCacheValue *sv);
+    RequestHandleRef queueDetailContactInfo(ContactRef c, bool force);
+    void SendQueuedUserInfo();
 
     void mergeSBL(ContactTree& tree);
+    void SignalServerBasedContactList(ContactTree& tree, bool unchanged);
+
+    void SetContactStatus(ContactRef c, Status st, bool inv);
+    void FlushPresenceBatch(bool force);
+
+    void planSBLUploadGroup(SBLEdit& edit, const ContactTree::Group& gp);
+    void planSBLUploadContact(SBLEdit& edit, const ContactTree::Group& gp, const ContactRef& c);
+    void planSBLRemoveGroup(SBLEdit& edit, const ContactTree::Group& gp);
+    RequestHandleRef SendSBLEdit(SBLEdit& edit, ServerBasedContactEvent::SBLType type);
+    void HandleSBLEditACK(SBLEditACKSNAC *snac);
+
+    RequestHandleRef TrackRequest(unsigned int reqid, RequestIDCacheValue *v, RequestHandleRef h);
 
     void ICBMCookieCache_expired_cb(MessageEvent *ev);
     void dccache_expired_cb(DirectClient *dc);
@@ -231,6 +290,7 @@ namespace ICQ2000
     void dc_connected_cb(SocketClient *dc);
     void dc_log_cb(LogEvent *ev);
     void dc_socket_cb(SocketEvent *ev);
+    void handler_messageack_cb(MessageEvent *ev);
     void dc_messageack_cb(MessageEvent *ev);
     void ftc_messageack_cb(MessageEvent *ev);
 
@@ -384,6 +444,8 @@ namespace ICQ2000
      *  on a search result will be with
      *  SearchResultEvent::isFinished() set to true. After this the
      *  event is finished and deleted from memory by the library.
+     *  A streaming search is signalled a page of new results at a
+     *  time, see SearchResultEvent::setStreaming.
      */
     sigslot::signal1<SearchResultEvent*> search_result;
 
@@ -396,6 +458,35 @@ namespace ICQ2000
      *  Signal when a FileTransferEvent object is updated.
      */
     sigslot::signal1<FileTransferEvent*> filetransfer_update_signal;
+
+    /**
+     *  Signal when the server-based contact list has been fetched,
+     *  either downloaded in full or confirmed unchanged by the server.
+     * @see ServerBasedContactEvent, fetchServerBasedContactList
+     */
+    sigslot::signal1<ServerBasedContactEvent*> server_based_contact_list;
+
+    /**
+     *  Signal with a batch of contact status changes, in place of
+     *  contact_status_change_signal, when presence batching is on.
+     * @see PresenceBatchEvent, setPresenceBatching
+     */
+    sigslot::signal1<PresenceBatchEvent*> presence_batch;
+
+    /**
+     *  Signal with all the messages stored for us while we were
+     *  offline, in place of messaged, when offline message batching
+     *  is on.
+     * @see OfflineMessageBatchEvent, setOfflineMessageBatching
+     */
+    sigslot::signal1<OfflineMessageBatchEvent*> offline_messages;
+
+    /**
+     *  Signal with a snapshot of the metrics, every so often when
+     *  they are being reported.
+     * @see MetricsEvent, setMetricsInterval
+     */
+    sigslot::signal1<MetricsEvent*> metrics;
     
     // -------------
 
@@ -422,15 +513,41 @@ namespace ICQ2000
 
     bool getWebAware() const;
 
+    void setPresenceBatching(bool b, unsigned int window = 0);
+    bool getPresenceBatching() const;
+
+    void setOfflineMessageBatching(bool b);
+    bool getOfflineMessageBatching() const;
+
+    Metrics getMetrics();
+    void resetMetrics();
+    void setMetricsInterval(unsigned int s);
+    unsigned int getMetricsInterval() const;
+
+    void setMessageTracing(unsigned int sample);
+    unsigned int getMessageTracing() const;
+    bool writeMessageTrace(const std::string& filename) const;
+    void clearMessageTrace();
+
+    bool startCapture(const std::string& filename);
+    void stopCapture();
+    bool isCapturing() const;
+
+    void beginReplay();
+    void replayServerData(const unsigned char *data, unsigned int len);
+    void endReplay();
+
     void uploadSelfDetails();
     
-    void uploadServerBasedContact(const ContactRef& c);
-    void uploadServerBasedGroup(const ContactTree::Group& gp);
-    void uploadServerBasedContactList();
+    RequestHandleRef uploadServerBasedContact(const ContactRef& c);
+    RequestHandleRef uploadServerBasedGroup(const ContactTree::Group& gp);
+    RequestHandleRef uploadServerBasedContactList();
+
+    RequestHandleRef removeServerBasedContact(const ContactRef& c);
+    RequestHandleRef removeServerBasedGroup(const ContactTree::Group& gp);
+    RequestHandleRef removeServerBasedContactList();
 
-    void removeServerBasedContact(const ContactRef& c);
-    void removeServerBasedGroup(const ContactTree::Group& gp);
-    void removeServerBasedContactList();
+    void cancelRequest(RequestHandleRef h);
 
     // -- Contact List --
     void addVisible(ContactRef c);
@@ -442,12 +559,44 @@ namespace ICQ2000
     ContactTree& getContactTree();
 
     void fetchSimpleContactInfo(ContactRef c);
-    void fetchDetailContactInfo(ContactRef c);
+    RequestHandleRef fetchDetailContactInfo(ContactRef c);
+    RequestHandleRef fetchDetailContactInfo(ContactRef c, bool force);
+
+    /**
+     *  Request the detailed contact information for a range of
+     *  contacts. Requests are deduplicated and paced as for
+     *  fetchDetailContactInfo(ContactRef).
+     *
+     * @param begin iterator to the first ContactRef
+     * @param end iterator past the last ContactRef
+     */
+    template <typename Iterator>
+    void fetchDetailContactInfo(Iterator begin, Iterator end)
+    {
+      while (begin != end) {
+	queueDetailContactInfo(*begin, false);
+	++begin;
+      }
+      SendQueuedUserInfo();
+    }
+
+    void setUserInfoCacheTTL(unsigned int ttl);
+    unsigned int getUserInfoCacheTTL() const;
+    void setUserInfoFetchRate(unsigned int per_second, unsigned int max_outstanding);
+    void invalidateUserInfo(unsigned int uin);
+    void getUserInfoFetchStats(unsigned int& requested, unsigned int& collapsed,
+			       unsigned int& cached, unsigned int& sent) const;
     void fetchServerBasedContactList();
-    void fetchServerBasedContactList(int); // the conditional form - TODO!
+    void fetchServerBasedContactList(unsigned int timestamp, unsigned short count);
     void fetchSelfSimpleContactInfo();
     void fetchSelfDetailContactInfo();
 
+    // -- Contact list snapshot --
+    bool saveContactTreeSnapshot(const std::string& filename);
+    bool loadContactTreeSnapshot(const std::string& filename);
+    unsigned int getServerBasedListTimestamp() const;
+    unsigned short getServerBasedListSize() const;
+
     // -- Whitepage searches --
     SearchResultEvent* searchForContacts(const std::string& nickname, const std::string& firstname,
 					 const std::string& lastname);
@@ -501,6 +650,12 @@ namespace ICQ2000
     void setUseOutDC(bool d);
     bool getUseOutDC() const;
 
+    void setMaxDirectConnections(unsigned int n);
+    unsigned int getMaxDirectConnections() const;
+    unsigned int getDirectConnectionCount() const;
+    void getDirectConnectionStats(unsigned int& lookups, unsigned int& reuses,
+				  unsigned int& evictions) const;
+
     void setPortRangeLowerBound(unsigned short lower);
     void setPortRangeUpperBound(unsigned short upper);
     unsigned short getPortRangeLowerBound() const;
@@ -24,6 +24,7 @@
 #define CONTACT_H
 
 #include <list>
+#include <vector>
 #include <string>
 
 #include <libicq2000/sigslot.h>
@@ -37,6 +38,7 @@ namespace ICQ2000
 {
   /* predeclare classes */
   class Capabilities;
+  class PresenceTable;
   class MessageEvent;
   class StatusChangeEvent;
   class UserInfoChangeEvent;
@@ -143,7 +145,13 @@ namespace ICQ2000
     };
 
   private:
+    // the detailed fields, kept apart until a contact has some
+    struct DetailInfo;
+
     void Init();
+    DetailInfo& details();
+    const DetailInfo& details() const;
+
     bool m_icqcontact;
     bool m_virtualcontact;
 
@@ -161,7 +169,7 @@ namespace ICQ2000
     bool m_server_based;
     unsigned int m_ext_ip, m_lan_ip;
     unsigned short m_ext_port, m_lan_port, m_group_id, m_tag_id;
-    Capabilities * m_capabilities;
+    Capabilities * m_capabilities;  // NULL when there are none
     unsigned int m_signon_time, m_last_online_time, m_last_status_change_time;
     unsigned int m_last_message_time, m_last_away_msg_check_time;
 
@@ -170,16 +178,74 @@ namespace ICQ2000
     // other fields
     unsigned short m_seqnum;
 
-    // detailed fields
+    // detailed fields - the main ones (alias, name) every contact has,
+    // the rest only those that have had their details fetched
     MainHomeInfo m_main_home_info;
-    HomepageInfo m_homepage_info;
-    EmailInfo m_email_info;
-    WorkInfo m_work_info;
-    PersonalInterestInfo m_personal_interest_info;
-    BackgroundInfo m_background_info;
-    std::string m_about;
+    DetailInfo * m_details;
+
+    // pending changes while inside an update transaction
+    unsigned int m_dirty;
+    unsigned int m_update_depth;
+
+    // rows in the presence tables of the trees the contact is in -
+    // the first here, as a contact is usually in just the one
+    PresenceTable *m_presence;
+    unsigned int m_presence_row;
+    std::vector< std::pair<PresenceTable*, unsigned int> > *m_presence_more;
+    friend class PresenceTable;
+
+    void presence_changed();
 
   public:
+    /**
+     *  Bitmask of the contact fields reported by a UserInfoChangeEvent.
+     */
+    enum Field {
+      Field_UIN          = 1 << 0,
+      Field_Alias        = 1 << 1,
+      Field_FirstName    = 1 << 2,
+      Field_LastName     = 1 << 3,
+      Field_Email        = 1 << 4,
+      Field_MobileNo     = 1 << 5,
+      Field_MainHome     = 1 << 6,
+      Field_Homepage     = 1 << 7,
+      Field_EmailInfo    = 1 << 8,
+      Field_Work         = 1 << 9,
+      Field_Interests    = 1 << 10,
+      Field_Background   = 1 << 11,
+      Field_About        = 1 << 12,
+      Field_Direct       = 1 << 13,
+      Field_Auth         = 1 << 14,
+      Field_ServerBased  = 1 << 15,
+      Field_Network      = 1 << 16,  // IPs, ports, TCP version, DC cookie
+      Field_Capabilities = 1 << 17,
+      Field_Times        = 1 << 18,  // signon/last online/message times
+      Field_Birthday     = 1 << 19,
+
+      // fields that change as the contact comes and goes, not user details
+      Field_Transient    = Field_Direct | Field_Auth | Field_ServerBased | Field_Network
+                           | Field_Capabilities | Field_Times | Field_Birthday,
+      Field_All          = (1 << 20) - 1
+    };
+
+    /**
+     *  Scoped update transaction. Changes made to the contact while
+     *  it is alive are coalesced into a single UserInfoChangeEvent
+     *  carrying the mask of changed fields, emitted on destruction.
+     *  Transactions nest; only the outermost one emits.
+     */
+    class UpdateTransaction {
+     private:
+      ref_ptr<Contact> m_contact;
+
+      UpdateTransaction(const UpdateTransaction&);
+      UpdateTransaction& operator=(const UpdateTransaction&);
+
+     public:
+      UpdateTransaction(const ref_ptr<Contact>& c);
+      ~UpdateTransaction();
+    };
+
     Contact();
 
     Contact(unsigned int uin);
@@ -236,6 +302,7 @@ namespace ICQ2000
     void setBirthday(bool b);
     
     void setStatus(Status st, bool i);
+    void setStatus(Status st, bool i, bool emit_signal);
     void setStatus(Status st);
     void setInvisible(bool i);
     void setExtIP(unsigned int ip);
@@ -272,6 +339,16 @@ namespace ICQ2000
     PersonalInterestInfo& getPersonalInterestInfo();
     const std::string& getAboutInfo() const;
 
+    const MainHomeInfo& getMainHomeInfo() const;
+    const HomepageInfo& getHomepageInfo() const;
+    const EmailInfo& getEmailInfo() const;
+    const WorkInfo& getWorkInfo() const;
+    const BackgroundInfo& getBackgroundInfo() const;
+    const PersonalInterestInfo& getPersonalInterestInfo() const;
+
+    bool hasDetailInfo() const;
+    void clearDetailInfo();
+
     bool isICQContact() const;
     bool isVirtualContact() const;
 
@@ -285,6 +362,11 @@ namespace ICQ2000
     void userinfo_change_emit();
     void userinfo_change_emit(bool is_transient_detail);
 
+    void field_changed(unsigned int fields);
+    void begin_update();
+    void end_update();
+    bool in_update() const;
+
     static std::string UINtoString(unsigned int uin);
     static unsigned int StringtoUIN(const std::string& s);
     
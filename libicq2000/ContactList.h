@@ -92,6 +92,7 @@ namespace ICQ2000 {
     ContactRef lookup_email(const std::string& em);
     ContactRef add(ContactRef ct);
     void remove(unsigned int uin);
+    void clear();
 
     unsigned int size() const;
     bool empty() const;
@@ -28,11 +28,13 @@
 #include <map>
 
 #include <libicq2000/Contact.h>
+#include <libicq2000/PresenceTable.h>
 #include <libicq2000/sigslot.h>
 
 namespace ICQ2000 {
 
   class ContactListEvent;
+  class ContactTree;
 
   // ---------------------------------------------------------------------------
   //  Group object
@@ -48,6 +50,10 @@ namespace ICQ2000 {
     
     std::string m_label;
 
+    // the tree's presence table, once the group is in one
+    PresenceTable *m_presence;
+    friend class ContactTree;
+
    public:
     // iterators
     class iterator {
@@ -132,11 +138,18 @@ namespace ICQ2000 {
     // Group list
     std::list<Group> m_groups;
 
+    // after the groups, so it goes first and the contacts are still there
+    PresenceTable m_presence;
+
+    unsigned int m_update_depth;
+
     unsigned short get_unique_group_id() const;
+    void track_presence();
 
    public:
     ContactTree();
     ContactTree(const ContactTree& ct);
+    ContactTree& operator=(const ContactTree& ct);
 
     Group& add_group(const std::string& l);
     Group& add_group(const std::string& l, unsigned short group_id);
@@ -148,6 +161,9 @@ namespace ICQ2000 {
     
     void relocate_contact(ContactRef ct, Group& from, Group& to);
 
+    void begin_update();
+    void end_update();
+
     ContactRef operator[](unsigned int uin);
     ContactRef lookup_uin(unsigned int uin);
     ContactRef lookup_mobile(const std::string& m);
@@ -162,6 +178,8 @@ namespace ICQ2000 {
     bool mobile_exists(const std::string& m);
     bool email_exists(const std::string& em);
 
+    const PresenceTable& presence() const;
+
     iterator begin();
     iterator end();
     const_iterator begin() const;
@@ -0,0 +1,111 @@
+/*
+ * Metrics
+ * Counters kept by the Client on its own traffic
+ *
+ * Copyright (C) 2001 Barnaby Gray <barnaby@beedesign.co.uk>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <time.h>
+
+namespace ICQ2000
+{
+
+  /**
+   *  Histogram of latencies in milliseconds, over fixed buckets so
+   *  adding a sample is only a couple of compares.
+   */
+  class LatencyHistogram
+  {
+   public:
+    static const unsigned int Buckets = 10;
+
+    /// upper bound of each bucket in ms, the last has none
+    static const unsigned int Bounds[Buckets-1];
+
+    unsigned int bucket[Buckets];
+    unsigned int count;
+    unsigned int max;
+    unsigned long total;
+
+    LatencyHistogram();
+
+    void add(unsigned int ms);
+    void clear();
+
+    unsigned int mean() const;
+    unsigned int percentile(unsigned int p) const;
+  };
+
+  /**
+   *  A snapshot of the Client's counters, from Client::getMetrics or
+   *  the metrics signal.  Counters run from the time given by since,
+   *  the gauges (queues, caches) are as they were when the snapshot
+   *  was taken.
+   */
+  class Metrics
+  {
+   public:
+    /// FLAP channels 1-5, anything else counts against 0
+    static const unsigned int Channels = 6;
+    /// SNAC families up to 0x1f, anything beyond counts against 0
+    static const unsigned int Families = 0x20;
+
+    time_t since;
+
+    // -- server traffic, by FLAP channel --
+    unsigned int packets_in[Channels], packets_out[Channels];
+    unsigned long bytes_in[Channels], bytes_out[Channels];
+
+    // -- SNACs received, by family --
+    unsigned int snacs_in[Families];
+
+    /// SNACs from the server that failed to parse
+    unsigned int parse_errors;
+    /// FLAPs from the server out of sequence
+    unsigned int seq_errors;
+    /// times bytes were skipped looking for the start of a FLAP
+    unsigned int resyncs;
+
+    // -- direct connections --
+    unsigned int dc_connects, dc_failures;
+
+    // -- send to ACK, for messages sent through the server and direct --
+    LatencyHistogram ack_latency_server, ack_latency_direct;
+
+    // -- gauges --
+    unsigned int userinfo_queue;   ///< user info requests waiting to go out
+    unsigned int dc_queue;         ///< messages waiting on a direct connection
+    unsigned int reqid_cache;      ///< requests waiting on a reply
+    unsigned int cookie_cache;     ///< messages through the server waiting on an ACK
+    unsigned int dc_cache;         ///< open direct connections
+    unsigned int ft_cache;         ///< open file transfers
+
+    Metrics();
+
+    void clear();
+
+    static unsigned int channel(unsigned char c) { return (c < Channels ? c : 0); }
+    static unsigned int family(unsigned short f) { return (f < Families ? f : 0); }
+  };
+
+}
+
+#endif
@@ -0,0 +1,121 @@
+/*
+ * PresenceTable
+ * status of every contact in a ContactTree, kept column by column
+ *
+ * Copyright (C) 2001 Barnaby Gray <barnaby@beedesign.co.uk>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#ifndef PRESENCETABLE_H
+#define PRESENCETABLE_H
+
+#include <vector>
+#include <map>
+
+#include <libicq2000/constants.h>
+
+namespace ICQ2000
+{
+  class Contact;
+
+  /**
+   *  The presence of the contacts in a ContactTree, one row per
+   *  contact held as an array per field, so questions about the
+   *  whole list ("who's online", "how many are away in each group")
+   *  are a scan over a few contiguous arrays rather than a walk of the
+   *  groups and contacts.
+   *
+   *  The ContactTree keeps the rows and groups in step as contacts
+   *  are added, removed and moved, and each contact updates its own
+   *  row when its status changes. Counts of each status by group are
+   *  kept as the rows change. A contact in more than one tree has a
+   *  row in each tree's table.
+   *
+   *  Rows are in no particular order, and move when a contact is
+   *  removed.
+   */
+  class PresenceTable
+  {
+   public:
+    /// number of contacts with each Status, indexed by Status
+    struct StatusCounts
+    {
+      unsigned int count[STATUS_OFFLINE + 1];
+
+      StatusCounts();
+
+      unsigned int online() const;
+      unsigned int total() const;
+    };
+
+    typedef std::map<unsigned short, StatusCounts> GroupCounts;
+
+   private:
+    std::vector<unsigned int> m_uin;
+    std::vector<unsigned char> m_status;
+    std::vector<unsigned char> m_invisible;
+    std::vector<unsigned int> m_last_status_change_time;
+    std::vector<unsigned short> m_group_id;
+    std::vector<Contact*> m_contact;
+
+    // status counts per group, kept as the rows change
+    GroupCounts m_counts;
+
+    void count(unsigned short group_id, unsigned char status, int d);
+
+    const unsigned int *row_of(const Contact *c) const;
+    unsigned int *row_of(Contact *c);
+    void attach(Contact *c, unsigned int row);
+    void detach(Contact *c);
+
+    PresenceTable(const PresenceTable&);
+    PresenceTable& operator=(const PresenceTable&);
+
+   public:
+    PresenceTable();
+    ~PresenceTable();
+
+    // -- kept up to date by ContactTree and Contact --
+    void add(Contact *c, unsigned short group_id);
+    void remove(Contact *c);
+    void update(const Contact *c);
+    void clear();
+
+    // -- bulk queries --
+    unsigned int size() const;
+    bool empty() const;
+
+    unsigned int online_count() const;
+    void online(std::vector<unsigned int>& uins) const;
+    void with_status(Status st, std::vector<unsigned int>& uins) const;
+    void changed_since(unsigned int t, std::vector<unsigned int>& uins) const;
+
+    StatusCounts status_counts() const;
+    StatusCounts status_counts(unsigned short group_id) const;
+    const GroupCounts& group_status_counts() const;
+
+    // -- the columns, for scans of your own --
+    const std::vector<unsigned int>& uins() const { return m_uin; }
+    const std::vector<unsigned char>& statuses() const { return m_status; }
+    const std::vector<unsigned char>& invisibles() const { return m_invisible; }
+    const std::vector<unsigned int>& last_status_change_times() const { return m_last_status_change_time; }
+    const std::vector<unsigned short>& group_ids() const { return m_group_id; }
+  };
+
+}
+
+#endif
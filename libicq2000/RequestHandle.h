@@ -0,0 +1,108 @@
+/*
+ * RequestHandle
+ * Completion handle for a request made to the server
+ *
+ * Copyright (C) 2001 Barnaby Gray <barnaby@beedesign.co.uk>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#ifndef REQUESTHANDLE_H
+#define REQUESTHANDLE_H
+
+#include <libicq2000/sigslot.h>
+
+#include <libicq2000/Contact.h>
+#include <libicq2000/ref_ptr.h>
+
+namespace ICQ2000
+{
+
+  /**
+   *  A handle on a request sent to the server, that completes when
+   *  the last reply for it arrives or the request times out. It can
+   *  be polled, like a future, or waited on through a callback.
+   *
+   *  The results themselves are still delivered through the usual
+   *  signals (contact user info change, search_result, ...), before
+   *  the handle completes, so a callback sees them in place.
+   */
+  class RequestHandle
+  {
+   public:
+    // reference count
+    unsigned int count;
+
+    enum Type {
+      UserInfo,
+      Search,
+      ServerBasedContact
+    };
+
+    enum State {
+      Pending,
+      Completed,
+      Expired,
+      Cancelled
+    };
+
+   private:
+    Type m_type;
+    State m_state;
+    unsigned int m_reqid;
+    ContactRef m_contact;
+
+    RequestHandle(const RequestHandle&);
+    RequestHandle& operator=(const RequestHandle&);
+
+   public:
+    RequestHandle(Type t);
+    RequestHandle(Type t, ContactRef c);
+
+    Type getType() const;
+    State getState() const;
+    bool isDone() const;
+    unsigned int getRequestID() const;
+    ContactRef getContact() const;
+
+    /**
+     *  Call a method when the request completes, straight away if it
+     *  already has.
+     *
+     * @param obj object to call
+     * @param fn method to call with the handle
+     */
+    template <class T>
+    void onComplete(T *obj, void (T::*fn)(RequestHandle*))
+    {
+      if (isDone()) (obj->*fn)(this);
+      else completed.connect(obj, fn);
+    }
+
+    /**
+     *  Signalled once when the request completes, expires or is cancelled.
+     */
+    sigslot::signal1<RequestHandle*> completed;
+
+    // used by the library
+    void setRequestID(unsigned int reqid);
+    void finish(State st);
+  };
+
+  typedef ref_ptr<RequestHandle> RequestHandleRef;
+}
+
+#endif
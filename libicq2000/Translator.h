@@ -23,6 +23,8 @@
 #define TRANSLATOR_H
 
 #include <string>
+#include <vector>
+#include <map>
 
 #include <libicq2000/Contact.h>
 
@@ -86,6 +88,20 @@ namespace ICQ2000
     virtual void server_to_client_inplace(std::string& str,
 					  Encoding en,
 					  const ICQ2000::ContactRef& c);
+
+    /**
+     *  Translate a batch of strings, all relevant to the one contact,
+     *  from the server-side encoding in place. The default translates
+     *  them one at a time, translators with a setup cost per call can
+     *  do better.
+     *
+     * @param strs the strings to translate
+     * @param en   the expected encoding from the server-side
+     * @param c    the contact relevant to the strings
+     */
+    virtual void server_to_client_batch(std::vector<std::string>& strs,
+					Encoding en,
+					const ICQ2000::ContactRef& c);
   };
 
   /**
@@ -121,6 +137,78 @@ namespace ICQ2000
     virtual std::string server_to_client(const std::string& str,
 					 Encoding en,
 					 const ICQ2000::ContactRef& c);
+
+    virtual void client_to_server_inplace(std::string& str,
+					  Encoding en,
+					  const ICQ2000::ContactRef& c);
+    
+    virtual void server_to_client_inplace(std::string& str,
+					  Encoding en,
+					  const ICQ2000::ContactRef& c);
+  };
+
+  /**
+   *  Translator that converts between the client's character set and
+   *  those used on the server with iconv, as well as doing the LF ->
+   *  CRLF translation. Strings in the contact's locale are taken to be
+   *  in the character set given for that contact, or the default
+   *  locale character set if none has been given.
+   *
+   *  iconv descriptors are opened on first use and kept for the life
+   *  of the translator, and the output buffer is reused between
+   *  calls. If the library was built without iconv, or a character set
+   *  isn't known to it, strings are passed through unconverted.
+   */
+  class IconvTranslator : public CRLFTranslator
+  {
+   private:
+    struct Converter;
+    typedef std::map<std::string, Converter*> ConverterMap;
+
+    std::string m_client_charset, m_locale_charset;
+    std::map<unsigned int, std::string> m_contact_charsets;
+
+    ConverterMap m_to_server, m_to_client;
+    std::vector<char> m_buffer;
+
+    const std::string& server_charset(Encoding en, const ICQ2000::ContactRef& c) const;
+    Converter* converter(ConverterMap& m, const std::string& to, const std::string& from);
+    void convert(std::string& str, Converter *cv);
+    void clear_converters();
+
+   public:
+    IconvTranslator(const std::string& client_charset = "UTF-8",
+		    const std::string& locale_charset = "ISO-8859-1");
+    ~IconvTranslator();
+
+    void setClientCharset(const std::string& charset);
+    std::string getClientCharset() const;
+
+    void setLocaleCharset(const std::string& charset);
+    std::string getLocaleCharset() const;
+
+    void setContactCharset(unsigned int uin, const std::string& charset);
+    void removeContactCharset(unsigned int uin);
+
+    virtual std::string client_to_server(const std::string& str,
+					 Encoding en,
+					 const ICQ2000::ContactRef& c);
+    
+    virtual std::string server_to_client(const std::string& str,
+					 Encoding en,
+					 const ICQ2000::ContactRef& c);
+
+    virtual void client_to_server_inplace(std::string& str,
+					  Encoding en,
+					  const ICQ2000::ContactRef& c);
+    
+    virtual void server_to_client_inplace(std::string& str,
+					  Encoding en,
+					  const ICQ2000::ContactRef& c);
+
+    virtual void server_to_client_batch(std::vector<std::string>& strs,
+					Encoding en,
+					const ICQ2000::ContactRef& c);
   };
 }
 
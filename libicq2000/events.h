@@ -28,12 +28,17 @@
 #define EVENTS_H
 
 #include <time.h>
+#include <stddef.h>
 #include <string>
+#include <map>
+#include <vector>
 
 #include <libicq2000/constants.h>
 
 #include <libicq2000/ContactList.h>
 #include <libicq2000/ContactTree.h>
+#include <libicq2000/RequestHandle.h>
+#include <libicq2000/Metrics.h>
 
 namespace ICQ2000 {
 
@@ -386,10 +391,37 @@ namespace ICQ2000 {
   class UserInfoChangeEvent : public ContactEvent {
    private:
     bool m_is_transient_detail;
+    unsigned int m_fields;
    public:
     UserInfoChangeEvent(ContactRef c, bool is_transient_detail);
+    UserInfoChangeEvent(ContactRef c, bool is_transient_detail, unsigned int fields);
     EventType getType() const;
     bool isTransientDetail() const;
+    unsigned int getFields() const;
+    bool changed(unsigned int fields) const;
+  };
+
+  /**
+   *  Forwards UserInfoChangeEvents from a source signal only when
+   *  they touch one of the fields of interest, so listeners interested
+   *  in, say, just the alias are not woken for every IP/port update.
+   */
+  class UserInfoChangeFilter : public sigslot::has_slots<> {
+   private:
+    unsigned int m_mask;
+
+    void userinfo_change_cb(UserInfoChangeEvent *ev);
+
+   public:
+    UserInfoChangeFilter(sigslot::signal1<UserInfoChangeEvent*>& source, unsigned int mask);
+
+    unsigned int getMask() const;
+    void setMask(unsigned int mask);
+
+    /**
+     *  Emitted for each event from the source whose fields intersect the mask.
+     */
+    sigslot::signal1<UserInfoChangeEvent*> filtered;
   };
 
   /**
@@ -408,6 +440,36 @@ namespace ICQ2000 {
     Status getOldStatus() const;
   };
 
+  /**
+   *  The event signalled with a batch of status changes, when Client
+   *  is batching presence updates.
+   *
+   * @see Client::setPresenceBatching
+   */
+  class PresenceBatchEvent : public Event {
+   public:
+    struct Entry {
+      unsigned int uin;
+      Status old_status;
+      Status status;
+    };
+
+   private:
+    std::vector<Entry> m_entries;
+
+   public:
+    PresenceBatchEvent();
+
+    void add(unsigned int uin, Status old_status, Status status);
+    void setStatus(unsigned int n, Status status);
+    void clear();
+
+    unsigned int size() const;
+    bool empty() const;
+    const Entry& operator[](unsigned int n) const;
+    const std::vector<Entry>& getEntries() const;
+  };
+
   // ============================================================================
   //  MessageEvents
   // ============================================================================
@@ -460,10 +522,23 @@ namespace ICQ2000 {
 
     DeliveryFailureReason m_failure_reason;
 
+    /// unique to this event, where its address may not be
+    unsigned int m_serial;
+
    public:
     MessageEvent(ContactRef c);
+    MessageEvent(const MessageEvent& ev);
     virtual ~MessageEvent();
 
+    /*
+     * MessageEvents are created for every message sent or received,
+     * so their storage is recycled through a pool rather than going
+     * to malloc each time. Ownership is unchanged - whoever would
+     * have deleted the event still does.
+     */
+    static void* operator new(size_t n);
+    static void operator delete(void *p, size_t n);
+
     /**
      *  get the type of the MessageEvent
      *
@@ -471,6 +546,7 @@ namespace ICQ2000 {
      */
     virtual MessageType getType() const = 0;
     ContactRef getContact();
+    unsigned int getSerial() const;
     
     bool isFinished()  const;
     bool isDelivered() const;
@@ -818,6 +894,53 @@ namespace ICQ2000 {
     ICQMessageEvent* copy() const;
   };
 
+  /**
+   *  The event signalled with all the messages left for us while we
+   *  were offline, oldest first, when Client is batching offline
+   *  messages. The messages belong to the batch and are deleted with
+   *  it.
+   *
+   * @see Client::setOfflineMessageBatching
+   */
+  class OfflineMessageBatchEvent : public Event {
+   private:
+    std::vector<MessageEvent*> m_messages;
+
+    OfflineMessageBatchEvent(const OfflineMessageBatchEvent&);
+    OfflineMessageBatchEvent& operator=(const OfflineMessageBatchEvent&);
+
+   public:
+    OfflineMessageBatchEvent();
+    ~OfflineMessageBatchEvent();
+
+    void add(MessageEvent *ev);
+
+    unsigned int size() const;
+    bool empty() const;
+    MessageEvent* operator[](unsigned int n) const;
+    const std::vector<MessageEvent*>& getMessages() const;
+  };
+
+  // ============================================================================
+  //  Metrics Event
+  // ============================================================================
+
+  /**
+   *  The event signalled every so often with a snapshot of the
+   *  Client's metrics, when they are being reported.
+   *
+   * @see Client::setMetricsInterval
+   */
+  class MetricsEvent : public Event {
+   private:
+    Metrics m_metrics;
+
+   public:
+    MetricsEvent(const Metrics& m);
+
+    const Metrics& getMetrics() const;
+  };
+
   // ============================================================================
   //  Search Events
   // ============================================================================
@@ -841,10 +964,16 @@ namespace ICQ2000 {
     ContactList m_clist;
     ContactRef m_last_contact;
     unsigned int m_more_results;
+    RequestHandleRef m_handle;
+    bool m_streaming;
+    unsigned int m_page_size, m_limit, m_count;
     
    public:
     SearchResultEvent(SearchType t);
 
+    static void* operator new(size_t n);
+    static void operator delete(void *p, size_t n);
+
     SearchType getSearchType() const;
     ContactList& getContactList();
     ContactRef getLastContactAdded() const;
@@ -856,12 +985,25 @@ namespace ICQ2000 {
     bool isExpired() const;
     void setExpired(bool b);
     void setNumberMoreResults(unsigned int m);
+
+    RequestHandleRef getRequestHandle() const;
+    void setRequestHandle(const RequestHandleRef& h);
+
+    bool isStreaming() const;
+    void setStreaming(bool b);
+    unsigned int getPageSize() const;
+    void setPageSize(unsigned int n);
+    unsigned int getResultLimit() const;
+    void setResultLimit(unsigned int n);
+    unsigned int getResultCount() const;
+    bool isLimitReached() const;
+
+    void addResult(ContactRef c);
   };
 
   /**
    *  The event signalled when entries from the server-based contact list is received.
    */
-  /*
   class ServerBasedContactEvent : public Event {
    public:
     enum SBLType {
@@ -873,24 +1015,32 @@ namespace ICQ2000 {
     enum UploadResult {
      Success,
      Failed,
-     AuthRequired
+     AuthRequired,
+     AlreadyExists,
+     Unknown        // no answer (timed out or cancelled), the server may still have made it
     };
 
    private:
     ContactList m_clist;
     SBLType m_type;
-    std::vector<UploadResult> m_results;
+    bool m_unchanged;
+    std::map<unsigned int, UploadResult> m_results;
+    std::map<unsigned short, UploadResult> m_group_results;
 
    public:
     ServerBasedContactEvent(SBLType t, const ContactList& l);
 
-    void setUploadResults(const std::vector<UploadResult> &v);
-    std::map<unsigned int, UploadResult> getUploadResults() const;
-
     ContactList& getContactList();
-    SBLType getType() const { return m_type; }
+    SBLType getType() const;
+
+    bool isUnchanged() const;
+    void setUnchanged(bool b);
+
+    void setUploadResult(unsigned int uin, UploadResult r);
+    const std::map<unsigned int, UploadResult>& getUploadResults() const;
+    void setGroupResult(unsigned short group_id, UploadResult r);
+    const std::map<unsigned short, UploadResult>& getGroupResults() const;
   };
-  */
 
   // ============================================================================
   //  NewUINEvent
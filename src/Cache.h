@@ -23,6 +23,7 @@
 #define CACHE_H
 
 #include <list>
+#include <map>
 #include <time.h>
 
 namespace ICQ2000 {
@@ -61,28 +62,29 @@ namespace ICQ2000 {
     unsigned int m_timeout;
     
     /*
-     * list for storing them in order to timeout
-     * a hash could be used as well, but efficiency isn't really an
-     * issue - there shouldn't be more than 10 items in here at any one point
+     * list for storing them in order to timeout, with an index by key
+     * so lookups don't walk the list - the request id cache can hold a
+     * lot of outstanding requests when they are pipelined
      */
     std::list< CacheItem<Key,Value> > m_list;
+    std::map< Key, literator > m_index;
 
     citerator lookup(const Key& k) const {
-      citerator curr = m_list.begin();
-      while (curr != m_list.end()) {
-	if ((*curr).getKey() == k) return curr;
-	++curr;
-      }
-      return m_list.end();
+      typename std::map< Key, literator >::const_iterator i = m_index.find(k);
+      if (i == m_index.end()) return m_list.end();
+      return (*i).second;
     }
     
     literator lookup(const Key& k) {
-      literator curr = m_list.begin();
-      while (curr != m_list.end()) {
-	if ((*curr).getKey() == k) return curr;
-	++curr;
-      }
-      return m_list.end();
+      typename std::map< Key, literator >::iterator i = m_index.find(k);
+      if (i == m_index.end()) return m_list.end();
+      return (*i).second;
+    }
+
+    void erase(const literator& l) {
+      typename std::map< Key, literator >::iterator i = m_index.find( (*l).getKey() );
+      if (i != m_index.end() && (*i).second == l) m_index.erase(i);
+      m_list.erase(l);
     }
     
    public:
@@ -109,7 +111,7 @@ namespace ICQ2000 {
     }
 
     virtual void removeItem(const literator& l) {
-      m_list.erase(l);
+      erase(l);
     }
 
     virtual void expireItem(const literator& l) {
@@ -117,6 +119,11 @@ namespace ICQ2000 {
       removeItem(l);
     }
     
+    void expire(const Key &k) {
+      literator i = lookup(k);
+      if (i != m_list.end()) expireItem(i);
+    }
+
     void expireAll() {
       while (!m_list.empty()) {
 	expireItem(m_list.begin());
@@ -134,24 +141,39 @@ namespace ICQ2000 {
       return (*insert(t)).getValue();
     }
 
+    /*
+     * An item already under the key is replaced, through removeItem so
+     * caches owning their values free it. Items expiring at the
+     * same time stay in the order they went in, and as most items go
+     * in with the default timeout the walk back from the end is short.
+     */
     literator insert(const CacheItem<Key,Value>& t) {
       time_t exp_time = t.getExpiryTime();
 
-      literator l = m_list.end();
+      literator l = lookup( t.getKey() );
+      if (l != m_list.end()) removeItem(l);
+
+      l = m_list.end();
       while (l != m_list.begin()) {
 	--l;
-	if ( (*l).getExpiryTime() < exp_time ) {
+	if ( (*l).getExpiryTime() <= exp_time ) {
 	  ++l;
 	  break;
 	}
       }
-      return m_list.insert(l, t);
+      l = m_list.insert(l, t);
+      m_index[ t.getKey() ] = l;
+      return l;
     }
 
     bool empty() const {
       return m_list.empty();
     }
 
+    unsigned int size() const {
+      return m_list.size();
+    }
+
     const Key& front() const {
       return m_list.front().getKey();
     }
@@ -160,7 +182,7 @@ namespace ICQ2000 {
       literator i = lookup(k);
       if (i != m_list.end()) {
 	CacheItem<Key,Value> t(*i);
-	m_list.erase(i);
+	erase(i);
 	insert(t);
       }
     }
@@ -173,7 +195,7 @@ namespace ICQ2000 {
       if (i != m_list.end()) {
 	CacheItem<Key,Value> t(*i);
 	t.setTimeout(s);
-	m_list.erase(i);
+	erase(i);
 	insert(t);
       }
     }
@@ -21,8 +21,6 @@
 
 #include "Capabilities.h"
 
-using std::set;
-
 namespace ICQ2000 {
 
   /*
@@ -126,6 +124,7 @@ namespace ICQ2000 {
   };
 
   Capabilities::Capabilities()
+    : m_flags(0)
   { }
   
   void Capabilities::default_icq2000_capabilities()
@@ -146,22 +145,22 @@ namespace ICQ2000 {
 
   void Capabilities::clear()
   {
-    m_flags.clear();
+    m_flags = 0;
   }
   
   void Capabilities::set_capability_flag(Flag f)
   {
-    m_flags.insert(f);
+    m_flags |= bit(f);
   }
   
   void Capabilities::clear_capability_flag(Flag f)
   {
-    m_flags.erase(f);
+    m_flags &= ~bit(f);
   }
 
   bool Capabilities::has_capability_flag(Flag f) const
   {
-    return (m_flags.count(f) > 0);
+    return ((m_flags & bit(f)) != 0);
   }
 
   void Capabilities::Parse(Buffer& b, unsigned short len)
@@ -186,19 +185,21 @@ namespace ICQ2000 {
 
   void Capabilities::Output(Buffer& b) const
   {
-    for (set<Flag>::const_iterator curr = m_flags.begin();
-	 curr != m_flags.end(); ++curr)
+    for (unsigned int f = 0; f < 32; ++f) {
+      if (!has_capability_flag( (Flag)f )) continue;
       for (unsigned int i = 0; i < sizeof(caps) / sizeof(Block); ++i)
-	if ( caps[i].flag == *curr ) {
+	if ( caps[i].flag == (Flag)f ) {
 	  b.Pack( caps[i].data, sizeof_cap );
 	  break;
 	}
-    
+    }
   }
   
   unsigned short Capabilities::get_length() const
   {
-    return sizeof_cap * m_flags.size();
+    unsigned short n = 0;
+    for (unsigned int f = m_flags; f != 0; f &= f - 1) ++n;
+    return sizeof_cap * n;
   }
 
   /*
@@ -210,5 +211,10 @@ namespace ICQ2000 {
     return (has_capability_flag(ICQ) && has_capability_flag(ICQServerRelay));
   }
 
+  bool Capabilities::operator==(const Capabilities& c) const
+  {
+    return m_flags == c.m_flags;
+  }
+
 }
 
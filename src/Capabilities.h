@@ -25,8 +25,6 @@
 
 #include "buffer.h"
 
-#include <set>
-
 namespace ICQ2000 {
 
   class Capabilities {
@@ -67,7 +65,10 @@ namespace ICQ2000 {
     };
     static const Block caps[];
 
-    std::set<Flag> m_flags;
+    // bit per Flag
+    unsigned int m_flags;
+
+    static unsigned int bit(Flag f) { return (1U << f); }
 
    public:
     Capabilities();
@@ -86,6 +87,8 @@ namespace ICQ2000 {
     unsigned short get_length() const;
 
     bool get_accept_adv_msgs() const;
+
+    bool operator==(const Capabilities& c) const;
   };
 
 }
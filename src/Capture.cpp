@@ -0,0 +1,160 @@
+/*
+ * Capture
+ *
+ * Copyright (C) 2001 Barnaby Gray <barnaby@beedesign.co.uk>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#include "Capture.h"
+
+#include <sys/time.h>
+
+#include "buffer.h"
+
+namespace ICQ2000 {
+
+  static const char capture_magic[] = "ICQCAP";
+
+  CaptureSink::CaptureSink()
+    : m_file(NULL), m_records(0)
+  { }
+
+  CaptureSink::~CaptureSink()
+  {
+    close();
+  }
+
+  bool CaptureSink::open(const std::string& filename)
+  {
+    close();
+
+    m_file = fopen(filename.c_str(), "wb");
+    if (m_file == NULL) return false;
+
+    fwrite(capture_magic, 1, 6, m_file);
+    fputc(Version & 0xff, m_file);
+    fputc(Version >> 8, m_file);
+    m_records = 0;
+    return true;
+  }
+
+  void CaptureSink::close()
+  {
+    if (m_file != NULL) {
+      fclose(m_file);
+      m_file = NULL;
+    }
+  }
+
+  bool CaptureSink::isOpen() const
+  {
+    return (m_file != NULL);
+  }
+
+  void CaptureSink::write32(unsigned int n)
+  {
+    unsigned char d[4];
+    d[0] = n & 0xff;
+    d[1] = (n >> 8) & 0xff;
+    d[2] = (n >> 16) & 0xff;
+    d[3] = (n >> 24) & 0xff;
+    fwrite(d, 1, 4, m_file);
+  }
+
+  void CaptureSink::record(Stream s, unsigned int id, Buffer& b)
+  {
+    if (m_file == NULL) return;
+
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+
+    fputc(s, m_file);
+    write32(id);
+    write32(tv.tv_sec);
+    write32(tv.tv_usec);
+    write32(b.size());
+    if (b.size() > 0) fwrite(&*b.begin(), 1, b.size(), m_file);
+    ++m_records;
+  }
+
+  unsigned int CaptureSink::getRecordCount() const
+  {
+    return m_records;
+  }
+
+  CaptureReader::CaptureReader()
+    : m_file(NULL)
+  { }
+
+  CaptureReader::~CaptureReader()
+  {
+    close();
+  }
+
+  bool CaptureReader::open(const std::string& filename)
+  {
+    close();
+
+    m_file = fopen(filename.c_str(), "rb");
+    if (m_file == NULL) return false;
+
+    unsigned char h[8];
+    if (fread(h, 1, 8, m_file) != 8
+	|| std::string((char*)h, 6) != capture_magic
+	|| (h[6] | (h[7] << 8)) != CaptureSink::Version) {
+      close();
+      return false;
+    }
+
+    return true;
+  }
+
+  void CaptureReader::close()
+  {
+    if (m_file != NULL) {
+      fclose(m_file);
+      m_file = NULL;
+    }
+  }
+
+  bool CaptureReader::read32(unsigned int& n)
+  {
+    unsigned char d[4];
+    if (fread(d, 1, 4, m_file) != 4) return false;
+    n = d[0] | (d[1] << 8) | (d[2] << 16) | ((unsigned int)d[3] << 24);
+    return true;
+  }
+
+  bool CaptureReader::next(Record& r)
+  {
+    if (m_file == NULL) return false;
+
+    int s = fgetc(m_file);
+    if (s == EOF) return false;
+
+    unsigned int len;
+    if (!read32(r.id) || !read32(r.sec) || !read32(r.usec) || !read32(len))
+      return false;
+
+    r.stream = (CaptureSink::Stream)s;
+    r.data.resize(len);
+    if (len > 0 && fread(&r.data[0], 1, len, m_file) != len) return false;
+
+    return true;
+  }
+
+}
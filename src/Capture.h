@@ -0,0 +1,105 @@
+/*
+ * Capture
+ *
+ * Copyright (C) 2001 Barnaby Gray <barnaby@beedesign.co.uk>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <string>
+#include <stdio.h>
+
+namespace ICQ2000 {
+
+  class Buffer;
+
+  /*
+   * Raw packet capture of the server and direct connection streams,
+   * for replaying later without the network. Each packet is
+   * recorded as it is handed to the parser - a whole FLAP for the
+   * server connection, a whole (still encrypted) packet for direct
+   * connections.
+   *
+   * File format, all integers little endian:
+   *   header:  "ICQCAP" (6 bytes), version (u16)
+   *   record:  stream (u8), stream id (u32), seconds (u32),
+   *            microseconds (u32), length (u32), data
+   *
+   * The stream id is the connection number for the server stream
+   * (authorizer and BOS count separately) and the remote UIN for
+   * direct connections.
+   */
+  class CaptureSink {
+   public:
+    enum Stream {
+      Server = 0,
+      Direct = 1
+    };
+
+    static const unsigned short Version = 1;
+
+   private:
+    FILE *m_file;
+    unsigned int m_records;
+
+    void write32(unsigned int n);
+
+   public:
+    CaptureSink();
+    ~CaptureSink();
+
+    bool open(const std::string& filename);
+    void close();
+    bool isOpen() const;
+
+    void record(Stream s, unsigned int id, Buffer& b);
+
+    unsigned int getRecordCount() const;
+  };
+
+  /*
+   * Reads back a file written by CaptureSink, one record at a time.
+   */
+  class CaptureReader {
+   public:
+    struct Record {
+      CaptureSink::Stream stream;
+      unsigned int id;
+      unsigned int sec, usec;
+      std::string data;
+    };
+
+   private:
+    FILE *m_file;
+
+    bool read32(unsigned int& n);
+
+   public:
+    CaptureReader();
+    ~CaptureReader();
+
+    bool open(const std::string& filename);
+    void close();
+
+    bool next(Record& r);
+  };
+
+}
+
+#endif
@@ -35,10 +35,18 @@
 #include "ICBMCookieCache.h"
 #include "SMTPClient.h"
 #include "Translator.h"
+#include "ContactSnapshot.h"
+#include "SBLEdit.h"
+#include "RouteStats.h"
+#include "UserInfoFetcher.h"
+#include "Capture.h"
+#include "MessageTrace.h"
+#include "FLAPFramer.h"
 
 #include "sstream_fix.h"
 
 #include <vector>
+#include <algorithm>
 #include <iostream>
 
 using std::string;
@@ -58,6 +66,16 @@ namespace ICQ2000
       "Offline"
     };
 
+  /*
+   * A handle for a request that had nothing to send.
+   */
+  static RequestHandleRef finished_request(RequestHandle::Type t, RequestHandle::State st)
+  {
+    RequestHandleRef h( new RequestHandle(t) );
+    h->finish(st);
+    return h;
+  }
+
   /**
    *  Constructor for creating the Client object.  Use this when
    *  uin/password are unavailable at time of creation, they can
@@ -68,9 +86,14 @@ namespace ICQ2000
       m_message_handler( new MessageHandler(m_self, &m_contact_tree, m_translator) ),
       m_serverSocket( new TCPSocket() ), m_listenServer( new TCPServer() ),
       m_smtp( new SMTPClient( m_self, "localhost", 25 ) ),
-      m_dccache( new DCCache() ), m_reqidcache( new RequestIDCache() ),
+      m_dccache( new DCCache() ), m_dcpathcache( new DCPathCache() ),
+      m_routestats( new RouteStats() ),
+      m_userinfo_fetcher( new UserInfoFetcher() ),
+      m_capture( new CaptureSink() ), m_tracer( new MessageTracer() ),
+      m_ftcache( new FTCache() ),
+      m_reqidcache( new RequestIDCache() ),
       m_cookiecache( new ICBMCookieCache() ),
-      m_recv( new Buffer() ), m_ftcache( new FTCache() )
+      m_recv( new Buffer() ), m_framer( new FLAPFramer() )
   {
     Init();
   }
@@ -88,9 +111,14 @@ namespace ICQ2000
       m_message_handler( new MessageHandler( m_self, &m_contact_tree, m_translator ) ),
       m_serverSocket( new TCPSocket() ), m_listenServer( new TCPServer() ),
       m_smtp( new SMTPClient( m_self, "localhost", 25 ) ),
-      m_dccache( new DCCache() ), m_reqidcache( new RequestIDCache() ),
+      m_dccache( new DCCache() ), m_dcpathcache( new DCPathCache() ),
+      m_routestats( new RouteStats() ),
+      m_userinfo_fetcher( new UserInfoFetcher() ),
+      m_capture( new CaptureSink() ), m_tracer( new MessageTracer() ),
+      m_ftcache( new FTCache() ),
+      m_reqidcache( new RequestIDCache() ),
       m_cookiecache( new ICBMCookieCache() ),
-      m_recv( new Buffer() ), m_ftcache( new FTCache() )
+      m_recv( new Buffer() ), m_framer( new FLAPFramer() )
   {
     Init();
   }
@@ -111,10 +139,16 @@ namespace ICQ2000
     delete m_listenServer;
     delete m_smtp;
     delete m_dccache;
+    delete m_dcpathcache;
+    delete m_routestats;
+    delete m_userinfo_fetcher;
+    delete m_capture;
+    delete m_tracer;
     delete m_ftcache;
     delete m_reqidcache;
     delete m_cookiecache;
     delete m_recv;
+    delete m_framer;
     delete m_translator;
   }
 
@@ -128,6 +162,11 @@ namespace ICQ2000
     m_out_dc = true;
     
     m_state = NOT_CONNECTED;
+    m_replaying = false;
+    m_server_stream = 0;
+
+    m_metrics_interval = 0;
+    m_metrics_last = time(NULL);
     
     m_cookie_data = NULL;
     m_cookie_length = 0;
@@ -146,6 +185,15 @@ namespace ICQ2000
     m_use_typing_notif = false;
 
     m_fetch_sbl = false;
+    m_fetch_sbl_conditional = false;
+    m_presence_batching = false;
+    m_offline_batching = false;
+    m_presence_window = 0;
+    m_presence_batch_start = 0;
+    m_sbl_max_contacts = 0;
+    m_sbl_max_groups = 0;
+    m_sbl_timestamp = 0;
+    m_sbl_size = 0;
 
     m_cookiecache->setDefaultTimeout(30);
     // 30 seconds is hopefully enough for even the slowest connections
@@ -156,6 +204,9 @@ namespace ICQ2000
     // this will be increased once they are established
     m_dccache->expired.connect( this,&Client::dccache_expired_cb) ;
 
+    m_dcpathcache->setDefaultTimeout(600);
+    // try all the addresses again after 10 minutes
+
     m_ftcache->setDefaultTimeout(30);
     // set timeout on direct connections to 30 seconds
     // this will be increased once they are established
@@ -184,7 +235,8 @@ namespace ICQ2000
     
     /* message handler callbacks */
     m_message_handler->messaged.connect( messaged );
-    m_message_handler->messageack.connect( messageack );
+    m_message_handler->offline_messages.connect( offline_messages );
+    m_message_handler->messageack.connect( this, &Client::handler_messageack_cb );
     m_message_handler->want_auto_resp.connect( want_auto_resp );
     m_message_handler->logger.connect( logger );
     m_message_handler->filetransfer_incoming_signal.connect( filetransfer_incoming_signal );
@@ -240,6 +292,9 @@ namespace ICQ2000
     m_client_seq_num = (unsigned short)(0x7fff*(rand()/(RAND_MAX+1.0)));
     m_requestid = (unsigned int)(0x7fffffff*(rand()/(RAND_MAX+1.0)));
 
+    ++m_server_stream;
+    m_recv->clear();
+    m_framer->reset();
     m_state = state;
   }
 
@@ -250,6 +305,16 @@ namespace ICQ2000
   }
 
   void Client::ConnectBOS() {
+    ++m_server_stream;
+    m_recv->clear();
+    m_framer->reset();
+
+    if (m_replaying) {
+      // the rest of the capture is the BOS connection
+      m_state = BOS_AWAITING_CONN_ACK;
+      return;
+    }
+
     try {
       m_serverSocket->setRemoteHost(m_bosHostname.c_str());
       m_serverSocket->setRemotePort(m_bosPort);
@@ -294,6 +359,11 @@ namespace ICQ2000
   {
     if (m_dccache->exists(fd))
     {
+      DirectClient *dc = (*m_dccache)[fd];
+      if (!dc->isConnected()) ++m_metrics.dc_failures;
+      if (!dc->isIncoming() && !dc->isConnected() && dc->getRacePartner() == NULL)
+	m_dcpathcache->set( dc->getUIN(), DCPath_Unreachable );
+
       m_dccache->remove(fd);
     }
     else if (m_ftcache->exists(fd))
@@ -326,6 +396,9 @@ namespace ICQ2000
     m_state = BOS_LOGGED_IN;
     ConnectedEvent ev;
     connected.emit(&ev);
+
+    // anything asked for before we were logged in
+    SendQueuedUserInfo();
   }
 
   void Client::SignalDisconnect(DisconnectedEvent::Reason r) {
@@ -347,13 +420,17 @@ namespace ICQ2000
 	Status old_st = (*gcurr)->getStatus();
 
 	if ( old_st != STATUS_OFFLINE )
-	  (*gcurr)->setStatus(STATUS_OFFLINE, false);
+	  SetContactStatus(*gcurr, STATUS_OFFLINE, false);
 
 	++gcurr;
       }
 
       ++curr;
     }
+
+    FlushPresenceBatch(true);
+    m_userinfo_fetcher->clear();
+    m_message_handler->dropOfflineMessages();
   }
 
   void Client::SignalAddSocket(int fd, SocketEvent::Mode m)
@@ -424,6 +501,7 @@ namespace ICQ2000
       ICBMCookie c = snac->getICBMCookie();
       if ( m_cookiecache->exists( c ) ) {
 	MessageEvent *ev = (*m_cookiecache)[c];
+	m_tracer->mark(ev, MessageTracer::Ack);
 	ev->setDirect(false);
 	m_message_handler->handleIncomingACK( ev, st );
 	m_cookiecache->remove(c);
@@ -482,17 +560,33 @@ namespace ICQ2000
     }
     else
     {
+      if (ev->isFinished()) m_tracer->finish(ev);
+      else m_tracer->mark(ev, MessageTracer::DirectFailed);
       messageack.emit(ev);
     
       if (!ev->isFinished())
       {
-	ev->getContact()->setDirect(false);
+	if (ev->getType() != MessageEvent::Email)
+	  m_routestats->failed(ev, RouteStats::Direct);
 	// attempt to deliver via server instead
 	SendViaServer(ev);
       }
     }
   }
 
+  void Client::handler_messageack_cb(MessageEvent *ev)
+  {
+    // acks for messages sent direct or advanced
+    RouteStats::Route r;
+    unsigned int rtt;
+    if (m_routestats->acked(ev, r, rtt)) {
+      if (r == RouteStats::Direct) m_metrics.ack_latency_direct.add(rtt);
+      else m_metrics.ack_latency_server.add(rtt);
+    }
+    m_tracer->finish(ev);
+    messageack.emit(ev);
+  }
+
   void Client::ftc_messageack_cb(MessageEvent *ev)
   {
     if (ev->getType() == MessageEvent::FileTransfer)
@@ -504,6 +598,15 @@ namespace ICQ2000
 	
   void Client::SignalSrvResponse(SrvResponseSNAC *snac)
   {
+    if ( m_reqidcache->exists( snac->RequestID() )
+	 && (*m_reqidcache)[ snac->RequestID() ]->getType() == RequestIDCacheValue::Cancelled )
+    {
+      // a request given up on, drop the rest of its replies
+      if (snac->isLastInSearch() || snac->getType() == SrvResponseSNAC::RBackgroundInfo)
+	m_reqidcache->remove( snac->RequestID() );
+      return;
+    }
+
     if (snac->getType() == SrvResponseSNAC::OfflineMessagesComplete)
     {
       /* We are now meant to ACK this to say
@@ -511,13 +614,17 @@ namespace ICQ2000
        * and the server can dispose of storing
        * them
        */
+      m_message_handler->flushOfflineMessages();
       SendOfflineMessagesACK();
 
     }
     else if (snac->getType() == SrvResponseSNAC::OfflineMessage)
     {
-      // wow.. this is so much simpler now :-)
-      m_message_handler->handleIncoming(snac->getICQSubType(), snac->getTime());
+      if (m_offline_batching && snac->getICQSubType() != NULL)
+	m_message_handler->queueOfflineMessage(snac->releaseICQSubType(), snac->getTime());
+      else
+	// wow.. this is so much simpler now :-)
+	m_message_handler->handleIncoming(snac->getICQSubType(), snac->getTime());
       
     }
     else if (snac->getType() == SrvResponseSNAC::SMS_Error)
@@ -542,6 +649,7 @@ namespace ICQ2000
 	    ev->setFinished(true);
 	    ev->setDelivered(true);
 	    ev->setDirect(false);
+	    m_tracer->finish(ev);
 	    messageack.emit(ev);
 	    m_reqidcache->remove( reqid );
 	  }
@@ -566,6 +674,7 @@ namespace ICQ2000
 	      ev->setDelivered(false);
 	      ev->setDirect(false);
 	      ev->setDeliveryFailureReason(MessageEvent::Failed);
+	      m_tracer->finish(ev);
 	      messageack.emit(ev);
 	      m_reqidcache->remove( reqid );
 	    }
@@ -591,40 +700,7 @@ namespace ICQ2000
 
 	if ( v->getType() == RequestIDCacheValue::Search )
 	{
-	  SearchCacheValue *sv = static_cast<SearchCacheValue*>(v);
-
-	  SearchResultEvent *ev = sv->getEvent();
-	  if (snac->isEmptyContact())
-	  {
-	    ev->setLastContactAdded( NULL );
-	  }
-	  else
-	  {
-	    ContactRef c = new Contact( snac->getUIN() );
-	    c->setAlias(snac->getAlias());
-	    c->setFirstName(snac->getFirstName());
-	    c->setLastName(snac->getLastName());
-	    c->setEmail(snac->getEmail());
-	    c->setStatus(snac->getStatus(), false);
-	    c->setAuthReq(snac->getAuthReq());
-	    ContactList& cl = ev->getContactList();
-	    ev->setLastContactAdded( cl.add(c) );
-
-	    if (snac->isLastInSearch())
-	      ev->setNumberMoreResults( snac->getNumberMoreResults() );
-	      
-	  }
-
-	  if (snac->isLastInSearch()) ev->setFinished(true);
-
-	  search_result.emit(ev);
-
-	  if (ev->isFinished())
-	  {
-	    delete ev;
-	    m_reqidcache->remove( snac->RequestID() );
-	  }
-	  
+	  HandleSearchResult( snac, static_cast<SearchCacheValue*>(v) );
 	}
 	else
 	{
@@ -655,40 +731,7 @@ namespace ICQ2000
 
 	if ( v->getType() == RequestIDCacheValue::Search )
 	{
-	  SearchCacheValue *sv = static_cast<SearchCacheValue*>(v);
-
-	  SearchResultEvent *ev = sv->getEvent();
-	  if (snac->isEmptyContact())
-	  {
-	    ev->setLastContactAdded( NULL );
-	  }
-	  else
-	  {
-	    ContactRef c = new Contact( snac->getUIN() );
-	    c->setAlias(snac->getAlias());
-	    c->setFirstName(snac->getFirstName());
-	    c->setLastName(snac->getLastName());
-	    c->setEmail(snac->getEmail());
-	    c->setStatus(snac->getStatus(), false);
-	    c->setAuthReq(snac->getAuthReq());
-	    ContactList& cl = ev->getContactList();
-	    ev->setLastContactAdded( cl.add(c) );
-
-	    if (snac->isLastInSearch())
-	      ev->setNumberMoreResults( snac->getNumberMoreResults() );
-	      
-	  }
-
-	  if (snac->isLastInSearch()) ev->setFinished(true);
-
-	  search_result.emit(ev);
-
-	  if (ev->isFinished())
-	  {
-	    delete ev;
-	    m_reqidcache->remove( snac->RequestID() );
-	  }
-	  
+	  HandleSearchResult( snac, static_cast<SearchCacheValue*>(v) );
 	}
 	else
 	{
@@ -781,6 +824,11 @@ namespace ICQ2000
 	  m_translator->server_to_client_inplace( iter->second, ENCODING_CONTACT_LOCALE, c );
 
 	c->setBackgroundInfo( snac->getBackgroundInfo() );
+
+	// the background info is the last of the replies to a detailed request
+	m_reqidcache->remove( snac->RequestID() );
+	m_userinfo_fetcher->completed( c->getUIN(), true );
+	SendQueuedUserInfo();
       }
       catch(ParseException e)
       {
@@ -819,7 +867,6 @@ namespace ICQ2000
 	  m_translator->server_to_client_inplace( *iter, ENCODING_CONTACT_LOCALE, c );
 
 	c->setEmailInfo( snac->getEmailInfo() );
-	c->userinfo_change_emit();
       }
       catch(ParseException e)
       {
@@ -870,21 +917,169 @@ namespace ICQ2000
     }
   }
   
-  void Client::mergeSBL(ContactTree& tree)
+  // a contact and the group it is in, for joining the two trees on uin
+  struct SBLMergeEntry
+  {
+    unsigned int uin;
+    ContactRef contact;
+    ContactTree::Group *group;
+
+    bool operator<(const SBLMergeEntry& e) const { return uin < e.uin; }
+    bool operator==(const SBLMergeEntry& e) const { return uin == e.uin; }
+  };
+
+  static void collectSBLMergeEntries(ContactTree& tree, std::vector<SBLMergeEntry>& v)
   {
+    v.reserve( tree.size() );
+
     ContactTree::iterator curr = tree.begin();
-    while (curr != tree.end())
-    {
+    while (curr != tree.end()) {
       ContactTree::Group::iterator gcurr = (*curr).begin();
-
-      std::cout << "Group: " << (*curr).get_label() << endl;
-      while (gcurr != (*curr).end())
-      {
-	std::cout << "  Contact: " << (*gcurr)->getAlias() << endl;
+      while (gcurr != (*curr).end()) {
+	SBLMergeEntry e;
+	e.uin = (*gcurr)->getUIN();
+	e.contact = (*gcurr);
+	e.group = &(*curr);
+	v.push_back(e);
 	++gcurr;
       }
       ++curr;
     }
+
+    std::sort( v.begin(), v.end() );
+  }
+
+  /*
+   * Merge the server-based list into the contact list, treating the
+   * server-side info we already hold on each contact as the common
+   * ancestor:
+   *
+   * - groups are matched up by id, and take the server's label
+   * - contacts only on the server are added, unless they have been
+   *   deleted here since (they are in m_sbl_removed), likewise groups
+   * - contacts on both take the server's group, unless they have been
+   *   moved here since the last merge
+   * - contacts only here are kept, but are no longer server-based
+   *
+   * The changes are made in a single update of the contact tree, so
+   * one CompleteUpdateEvent is signalled rather than an event for
+   * each contact.
+   */
+  void Client::mergeSBL(ContactTree& tree)
+  {
+    std::vector<SBLMergeEntry> local, server;
+    collectSBLMergeEntries(m_contact_tree, local);
+    collectSBLMergeEntries(tree, server);
+
+    // the server can list a contact in more than one group, go with the first
+    server.erase( std::unique( server.begin(), server.end() ), server.end() );
+
+    std::map<unsigned short, ContactTree::Group*> groups;
+    ContactTree::iterator curr = m_contact_tree.begin();
+    while (curr != m_contact_tree.end()) {
+      groups[ (*curr).get_id() ] = &(*curr);
+      ++curr;
+    }
+
+    m_contact_tree.begin_update();
+
+    // -- groups --
+    curr = tree.begin();
+    while (curr != tree.end()) {
+      std::map<unsigned short, ContactTree::Group*>::iterator gi = groups.find( (*curr).get_id() );
+      if (gi != groups.end()) {
+	(*gi).second->set_label( (*curr).get_label() );
+      } else if (m_sbl_removed_groups.count( (*curr).get_id() ) == 0) {
+	groups[ (*curr).get_id() ] = &( m_contact_tree.add_group( (*curr).get_label(), (*curr).get_id() ) );
+      }
+      ++curr;
+    }
+
+    // -- contacts --
+    ContactList added;
+    unsigned int moved = 0, dropped = 0;
+    std::vector<SBLMergeEntry>::iterator lcurr = local.begin(), scurr = server.begin();
+
+    while (lcurr != local.end() || scurr != server.end()) {
+
+      if (scurr == server.end() || (lcurr != local.end() && (*lcurr).uin < (*scurr).uin)) {
+	// only here
+	if ((*lcurr).contact->getServerBased()) {
+	  (*lcurr).contact->setServerBased(false);
+	  ++dropped;
+	}
+	++lcurr;
+
+      } else if (lcurr == local.end() || (*scurr).uin < (*lcurr).uin) {
+	// only on the server
+	std::map<unsigned short, ContactTree::Group*>::iterator gi = groups.find( (*scurr).group->get_id() );
+	if (!m_sbl_removed.exists( (*scurr).uin ) && gi != groups.end()) {
+	  (*gi).second->add( (*scurr).contact );
+	  added.add( (*scurr).contact );
+	}
+	++scurr;
+
+      } else {
+	// on both
+	ContactRef c = (*lcurr).contact;
+	ContactRef sc = (*scurr).contact;
+	unsigned short server_gid = (*scurr).group->get_id();
+	unsigned short local_gid = (*lcurr).group->get_id();
+
+	bool moved_here = c->getServerBased() && c->getServerSideGroupID() != local_gid;
+
+	c->setServerSideInfo( server_gid, sc->getServerSideID() );
+	c->setServerBased(true);
+	c->setAuthAwait( sc->getAuthAwait() );
+
+	std::map<unsigned short, ContactTree::Group*>::iterator gi = groups.find(server_gid);
+	if (local_gid != server_gid && !moved_here && gi != groups.end()) {
+	  m_contact_tree.relocate_contact( c, *((*lcurr).group), *((*gi).second) );
+	  ++moved;
+	}
+
+	++lcurr;
+	++scurr;
+      }
+    }
+
+    // local deletions the server no longer has are done with
+    ContactList removed;
+    ContactList::iterator rcurr = m_sbl_removed.begin();
+    while (rcurr != m_sbl_removed.end()) {
+      SBLMergeEntry e;
+      e.uin = (*rcurr)->getUIN();
+      if (std::binary_search( server.begin(), server.end(), e )) removed.add(*rcurr);
+      ++rcurr;
+    }
+    m_sbl_removed = removed;
+
+    std::map<unsigned short, string>::iterator rgcurr = m_sbl_removed_groups.begin();
+    while (rgcurr != m_sbl_removed_groups.end()) {
+      if (m_sbl_groups.count( (*rgcurr).first ) == 0) m_sbl_removed_groups.erase(rgcurr++);
+      else ++rgcurr;
+    }
+
+    m_contact_tree.end_update();
+
+    ostringstream ostr;
+    ostr << "Merged server-based list: " << added.size() << " added, "
+	 << moved << " moved, " << dropped << " no longer server-based";
+    SignalLog(LogEvent::INFO, ostr.str());
+
+    if (!added.empty() && m_state == BOS_LOGGED_IN) {
+      AddBuddySNAC snac;
+      ContactList::iterator acurr = added.begin();
+      while (acurr != added.end()) {
+	if ((*acurr)->isICQContact()) {
+	  snac.addBuddy(*acurr);
+	  queueDetailContactInfo(*acurr, false);
+	}
+	++acurr;
+      }
+      FLAPwrapSNACandSend(snac);
+      SendQueuedUserInfo();
+    }
   }
 
   ContactRef Client::getUserInfoCacheContact(unsigned int reqid)
@@ -911,6 +1106,56 @@ namespace ICQ2000
 
   }
 
+  /*
+   * A whitepage search result. Results are either accumulated on the
+   * event, or for a streaming search handed over a page at a time,
+   * and once the result limit is reached the search is finished and
+   * the rest of its replies dropped.
+   */
+  void Client::HandleSearchResult(SrvResponseSNAC *snac, SearchCacheValue *sv)
+  {
+    SearchResultEvent *ev = sv->getEvent();
+    unsigned int reqid = snac->RequestID();
+
+    if (snac->isEmptyContact())
+    {
+      ev->setLastContactAdded( NULL );
+    }
+    else
+    {
+      ContactRef c = new Contact( snac->getUIN() );
+      c->setAlias(snac->getAlias());
+      c->setFirstName(snac->getFirstName());
+      c->setLastName(snac->getLastName());
+      c->setEmail(snac->getEmail());
+      c->setStatus(snac->getStatus(), false);
+      c->setAuthReq(snac->getAuthReq());
+      ev->addResult(c);
+
+      if (snac->isLastInSearch())
+	ev->setNumberMoreResults( snac->getNumberMoreResults() );
+    }
+
+    if (snac->isLastInSearch() || ev->isLimitReached()) ev->setFinished(true);
+
+    if (!ev->isStreaming()
+	|| ev->isFinished()
+	|| ev->getContactList().size() >= ev->getPageSize())
+    {
+      search_result.emit(ev);
+      if (ev->isStreaming()) ev->getContactList().clear();
+    }
+
+    if (ev->isFinished())
+    {
+      delete ev;
+      m_reqidcache->remove( reqid );
+
+      if (!snac->isLastInSearch())
+	m_reqidcache->insert( reqid, new CancelledCacheValue() );
+    }
+  }
+
   void Client::SignalUINResponse(UINResponseSNAC *snac)
   {
     unsigned int uin = snac->getUIN();
@@ -952,10 +1197,10 @@ namespace ICQ2000
   
     SignalLog(LogEvent::WARN, "Message timeout without receiving ACK, sending offline");
     
+    /* count it against advanced messages to this contact, after a
+       few of these they go normal until it is worth trying again */
+    m_routestats->failed(ev, RouteStats::Advanced);
     SendViaServerNormal(ev);
-    /* downgrade Contact's capabilities, so we don't
-       attempt to send it as advanced again           */
-    ev->getContact()->set_capabilities(Capabilities());
   }
 
   void Client::reqidcache_expired_cb(RequestIDCacheValue* v)
@@ -972,12 +1217,39 @@ namespace ICQ2000
       delete ev;
 	  
     }
+    else if ( v->getType() == RequestIDCacheValue::ServerBasedContact )
+    {
+      /* no answer for the rest of the edit (timed out or cancelled) - the
+	 server may still have made it, so don't say it failed */
+      ServerBasedContactCacheValue *sv = static_cast<ServerBasedContactCacheValue*>(v);
+      ServerBasedContactEvent *ev = sv->getEvent();
+
+      while (!sv->isFinished()) {
+	ServerBasedContactCacheValue::Item& item = sv->nextItem();
+	if (item.contact.get() != NULL)
+	  ev->setUploadResult( item.contact->getUIN(), ServerBasedContactEvent::Unknown );
+	else if (item.type != ServerBasedContactCacheValue::Group_Update)
+	  ev->setGroupResult( item.group_id, ServerBasedContactEvent::Unknown );
+      }
+
+      server_based_contact_list.emit(ev);
+    }
+    else if ( v->getType() == RequestIDCacheValue::UserInfo )
+    {
+      UserInfoCacheValue *uv = static_cast<UserInfoCacheValue*>(v);
+      m_userinfo_fetcher->completed( uv->getContact()->getUIN(), false );
+    }
   }
   
 
   void Client::dccache_expired_cb(DirectClient *dc)
   {
     SignalLog(LogEvent::WARN, "Direct connection timeout reached");
+    if (!dc->isConnected()) ++m_metrics.dc_failures;
+
+    // the last attempt at connecting to them got nowhere
+    if (!dc->isIncoming() && !dc->isConnected() && dc->getRacePartner() == NULL)
+      m_dcpathcache->set( dc->getUIN(), DCPath_Unreachable );
   }
 
   void Client::ftcache_expired_cb(FileTransferClient *ftc)
@@ -987,9 +1259,27 @@ namespace ICQ2000
 
   void Client::dc_connected_cb(SocketClient *dc)
   {
+    ++m_metrics.dc_connects;
+
     m_dccache->setTimeout(dc->getfd(), 600);
     // once we are properly connected a direct
     // connection will only timeout after 10 mins
+
+    // incoming connections know who they are from now
+    m_dccache->touch(dc->getfd());
+
+    DirectClient *ddc = dynamic_cast<DirectClient*>(dc);
+    if (ddc == NULL || ddc->isIncoming()) return;
+
+    ContactRef c = ddc->getContact();
+    m_dcpathcache->set( c->getUIN(), (ddc->getIP() == c->getLanIP() ? DCPath_LAN : DCPath_External) );
+
+    DirectClient *loser = ddc->getRacePartner();
+    if (loser != NULL) {
+      // won the race, the other attempt isn't needed
+      ddc->takeQueue(loser);
+      m_dccache->remove( loser->getfd() );
+    }
   }
 
   void Client::dc_log_cb(LogEvent *ev)
@@ -1011,22 +1301,28 @@ namespace ICQ2000
       ContactRef c = m_contact_tree[userinfo.getUIN()];
       Status old_st = c->getStatus();
 
-      // Birthday Flag set?
-      if (userinfo.getBirthday()) c->setBirthday(true);
-		 
-      c->setDirect(true); // reset flags when a user goes online
-      c->setStatus( Contact::MapICQStatusToStatus(userinfo.getStatus()),
-		    Contact::MapICQStatusToInvisible(userinfo.getStatus()) );
-
-      if ( userinfo.getExtIP() != 0 ) c->setExtIP( userinfo.getExtIP() );
-      if ( userinfo.getLanIP() != 0 ) c->setLanIP( userinfo.getLanIP() );
-      if ( userinfo.getLanPort() != 0 ) c->setLanPort( userinfo.getLanPort() );
-      if ( userinfo.getTCPVersion() != 0 ) c->setTCPVersion( userinfo.getTCPVersion() );
-      if ( userinfo.getDCCookie() != 0 ) c->setDCCookie( userinfo.getDCCookie() );
-
-      c->set_signon_time( userinfo.getSignonDate() );
-      if (userinfo.contains_capabilities())
-	c->set_capabilities( userinfo.get_capabilities() );
+      {
+	// coalesce the detail updates below into one UserInfoChangeEvent
+	Contact::UpdateTransaction tr(c);
+
+	// Birthday Flag set?
+	if (userinfo.getBirthday()) c->setBirthday(true);
+
+	c->setDirect(true); // reset flags when a user goes online
+	if (old_st == STATUS_OFFLINE) m_routestats->reset( c->getUIN() );
+	SetContactStatus( c, Contact::MapICQStatusToStatus(userinfo.getStatus()),
+			Contact::MapICQStatusToInvisible(userinfo.getStatus()) );
+
+	if ( userinfo.getExtIP() != 0 ) c->setExtIP( userinfo.getExtIP() );
+	if ( userinfo.getLanIP() != 0 ) c->setLanIP( userinfo.getLanIP() );
+	if ( userinfo.getLanPort() != 0 ) c->setLanPort( userinfo.getLanPort() );
+	if ( userinfo.getTCPVersion() != 0 ) c->setTCPVersion( userinfo.getTCPVersion() );
+	if ( userinfo.getDCCookie() != 0 ) c->setDCCookie( userinfo.getDCCookie() );
+
+	c->set_signon_time( userinfo.getSignonDate() );
+	if (userinfo.contains_capabilities())
+	  c->set_capabilities( userinfo.get_capabilities() );
+      }
       
       ostringstream ostr;
       ostr << "Received Buddy Online for "
@@ -1042,11 +1338,54 @@ namespace ICQ2000
     }
   }
 
+  /*
+   * Change a contact's status, either signalling it straight away or
+   * holding it back in the presence batch.
+   */
+  void Client::SetContactStatus(ContactRef c, Status st, bool inv)
+  {
+    if (!m_presence_batching) {
+      c->setStatus(st, inv);
+      return;
+    }
+
+    Status old_st = c->getStatus();
+    if (old_st == st && c->isInvisible() == inv) return;
+    c->setStatus(st, inv, false);
+
+    if (m_presence_batch.empty()) m_presence_batch_start = time(NULL);
+
+    // a contact changing again in the same batch keeps the one entry
+    std::map<unsigned int, unsigned int>::iterator i = m_presence_batch_index.find( c->getUIN() );
+    if (i != m_presence_batch_index.end()) {
+      m_presence_batch.setStatus( (*i).second, st );
+    } else {
+      m_presence_batch_index[ c->getUIN() ] = m_presence_batch.size();
+      m_presence_batch.add( c->getUIN(), old_st, st );
+    }
+  }
+
+  /*
+   * Signal the presence batch, if there is one and its window has
+   * passed (or force).
+   */
+  void Client::FlushPresenceBatch(bool force)
+  {
+    if (m_presence_batch.empty()) return;
+    if (!force && time(NULL) < m_presence_batch_start + (time_t)m_presence_window) return;
+
+    m_presence_batch.setTime( time(NULL) );
+    presence_batch.emit( &m_presence_batch );
+
+    m_presence_batch.clear();
+    m_presence_batch_index.clear();
+  }
+
   void Client::SignalUserOffline(BuddyOfflineSNAC *snac) {
     const UserInfoBlock& userinfo = snac->getUserInfo();
     if (m_contact_tree.exists(userinfo.getUIN())) {
       ContactRef c = m_contact_tree[userinfo.getUIN()];
-      c->setStatus(STATUS_OFFLINE, false);
+      SetContactStatus(c, STATUS_OFFLINE, false);
 
       ostringstream ostr;
       ostr << "Received Buddy Offline for "
@@ -1225,9 +1564,14 @@ namespace ICQ2000
     Buffer b;
 
     FLAPwrapSNAC( b, SBLRequestRightsSNAC() );
-    FLAPwrapSNAC( b, SBLRequestListSNAC() );
+    if (m_fetch_sbl_conditional && m_sbl_timestamp != 0) {
+      FLAPwrapSNAC( b, SBLCheckListSNAC(m_sbl_timestamp, m_sbl_size) );
+      SignalLog(LogEvent::INFO, "Sending Conditional Request Server-based list");
+    } else {
+      FLAPwrapSNAC( b, SBLRequestListSNAC() );
+      SignalLog(LogEvent::INFO, "Sending Request Server-based list");
+    }
 
-    SignalLog(LogEvent::INFO, "Sending Request Server-based list");
     Send(b);
   }
 
@@ -1253,6 +1597,18 @@ namespace ICQ2000
   }
 
   void Client::Send(Buffer& b) {
+    if (m_replaying) return;
+
+    // count each FLAP in it, by the channel in its header
+    unsigned int p = 0;
+    while (p + 6 <= b.size()) {
+      unsigned int len = (b[p+4] << 8) | b[p+5];
+      unsigned int ch = Metrics::channel( b[p+1] );
+      ++m_metrics.packets_out[ch];
+      m_metrics.bytes_out[ch] += len + 6;
+      p += len + 6;
+    }
+
     try {
       ostringstream ostr;
       ostr << "Sending packet to Server" << endl << b;
@@ -1284,43 +1640,43 @@ namespace ICQ2000
   }
 
   void Client::Parse() {
-    
-    // -- FLAP header --
 
-    unsigned char start_byte, channel;
-    unsigned short seq_num, data_len;
+    // process FLAP(s) in packet, carrying on from any left partial
 
-    // process FLAP(s) in packet
+    FLAPFramer::Result r;
+    while ((r = m_framer->next(*m_recv)) != FLAPFramer::Incomplete) {
 
-    if (m_recv->empty()) return;
+      if (r == FLAPFramer::Skipped) {
+	ostringstream ostr;
+	ostr << "Invalid Start Byte on FLAP, skipped " << m_framer->getSkipped() << " bytes";
+	SignalLog(LogEvent::WARN, ostr.str());
+	++m_metrics.resyncs;
+	continue;
+      }
 
-    while (!m_recv->empty()) {
-      m_recv->setPos(0);
+      unsigned char channel = m_framer->getChannel();
+      unsigned short seq_num = m_framer->getSeqNum();
+      unsigned short data_len = m_framer->getLength();
 
-      *m_recv >> start_byte;
-      if (start_byte != 42) {
-	m_recv->clear();
-	SignalLog(LogEvent::WARN, "Invalid Start Byte on FLAP");
-	return;
+      if (!m_framer->inSequence()) {
+	ostringstream ostr;
+	ostr << "FLAP out of sequence, got 0x" << std::hex << seq_num
+	     << " expected 0x" << m_framer->getExpectedSeqNum();
+	SignalLog(LogEvent::WARN, ostr.str());
+	++m_metrics.seq_errors;
       }
 
-      /* if we don't have at least six bytes we don't have enough
-       * info to determine if we have the whole of the FLAP
+      /* the frame holds just this FLAP, header and all, positioned
+       * at the start of the body for the parse code
        */
-      if (m_recv->remains() < 5) return;
-      
-      *m_recv >> channel;
-      *m_recv >> seq_num; // check sequence number - todo
-      
-      *m_recv >> data_len;
-      if (m_recv->remains() < data_len) return; // waiting for more of the FLAP
+      Buffer& sb = m_framer->frame();
 
-      /* Copy into another Buffer which is passed
-       * onto the separate parse code that way
-       * multiple FLAPs in one packet are split up
-       */
-      Buffer sb;
-      m_recv->chopOffBuffer( sb, data_len+6 );
+      if (m_capture->isOpen()) m_capture->record(CaptureSink::Server, m_server_stream, sb);
+
+      ++m_metrics.packets_in[ Metrics::channel(channel) ];
+      m_metrics.bytes_in[ Metrics::channel(channel) ] += data_len + 6;
+      if (channel == 2 && data_len >= 2)
+	++m_metrics.snacs_in[ Metrics::family( (sb[6] << 8) | sb[7] ) ];
 
       {
 	ostringstream ostr;
@@ -1328,8 +1684,6 @@ namespace ICQ2000
 	SignalLog(LogEvent::PACKET, ostr.str());
       }
 
-      sb.advance(6);
-
       // -- FLAP body --
       
       ostringstream ostr;
@@ -1366,6 +1720,8 @@ namespace ICQ2000
       
     }
 
+    // all taken into the framer
+    m_recv->clear();
   }
 
   void Client::ParseCh1(Buffer& b, unsigned short seq_num) {
@@ -1416,6 +1772,7 @@ namespace ICQ2000
       ostringstream ostr;
       ostr << "Problem parsing SNAC: " << e.what();
       SignalLog(LogEvent::WARN, ostr.str());
+      ++m_metrics.parse_errors;
       return;
     }
 
@@ -1514,89 +1871,60 @@ namespace ICQ2000
       switch(snac->Subtype())
       {
       case SNAC_SBL_Rights_Reply:
+      {
 	SignalLog(LogEvent::INFO, "Server-based contact list rights granted\n");
+	SBLRightsReplySNAC *srs = static_cast<SBLRightsReplySNAC*>(snac);
+	m_sbl_max_contacts = srs->getMaxContacts();
+	m_sbl_max_groups = srs->getMaxGroups();
 	break;
+      }
 
       case SNAC_SBL_List_From_Server: 
       {
 	SignalLog(LogEvent::INFO, "Received server-based list from server\n");
         SBLListSNAC *sbs = static_cast<SBLListSNAC*>(snac);
+	m_sbl_timestamp = sbs->get_timestamp();
+	m_sbl_size = sbs->get_size();
+
+	// the server's list is now the reference for later edits
+	m_sbl_groups.clear();
+	ContactTree::iterator gcurr = sbs->getContactTree().begin();
+	while (gcurr != sbs->getContactTree().end()) {
+	  m_sbl_groups.insert( (*gcurr).get_id() );
+	  ++gcurr;
+	}
+
 	mergeSBL( sbs->getContactTree() );
 	SendSBLReceivedACK();
+	SignalServerBasedContactList(sbs->getContactTree(), false);
 	break;
       }
-      
-      case SNAC_SBL_Edit_ACK:
-      {
-	vector<SBLEditACKSNAC::Result> r = static_cast<SBLEditACKSNAC*>(snac)->getResults();
-	vector<SBLEditACKSNAC::Result>::iterator ir;
-	
-	for(ir = r.begin(); ir != r.end(); ++ir)
-	switch( *ir ) {
-	case SBLEditACKSNAC::Success:
-	  SignalLog(LogEvent::INFO, "Server-based contact list modification succeeded\n");
-	  //	  updresults.push_back(ServerBasedContactEvent::Success);
-	  break;
-	case SBLEditACKSNAC::Failed:
-	  SignalLog(LogEvent::INFO, "Server-based contact list modification failed\n");
-	  //	  updresults.push_back(ServerBasedContactEvent::Failed);
-	  break;
-	case SBLEditACKSNAC::AuthRequired:
-	  SignalLog(LogEvent::INFO, "Succeeded, though authentification is required to perform the server-based modification\n");
-	  //	  updresults.push_back(ServerBasedContactEvent::AuthRequired);
-	  break;
-	case SBLEditACKSNAC::AlreadyExists:
-	  SignalLog(LogEvent::INFO, "Already exists on the server-based contact list\n");
-	  break;
-	}
-
-	/*
-	** haven't yet decided the best way to recode this for groups and contacts **
-
-	vector<ServerBasedContactEvent::UploadResult> updresults;
-	vector<ServerBasedContactEvent::UploadResult>::iterator iur;
-
-	if(!updresults.empty()) {
-	  if( m_reqidcache->exists( snac->RequestID() ) ) {
-	    RequestIDCacheValue *v = (*m_reqidcache)[ snac->RequestID() ];
-	    
-	    if ( v->getType() == RequestIDCacheValue::ServerBasedContact ) {
-	      ServerBasedContactCacheValue *sv = static_cast<ServerBasedContactCacheValue*>(v);
-	      ServerBasedContactEvent *ev = sv->getEvent();
-
-	      ContactList &cl = ev->getContactList();
-	      ContactList::iterator ic = cl.begin();
-
-	      iur = updresults.begin();
-
-	      while(iur != updresults.end() && ic != cl.end()) {
-		if(*iur == ServerBasedContactEvent::Success
-		|| *iur == ServerBasedContactEvent::AuthRequired) {
-		    (*ic)->setServerBased(ev->getType() == ServerBasedContactEvent::Upload);
-
-		    ContactRef ct = getContact((*ic)->getUIN());
-		    if(ct.get()) {
-		      ct->setServerBased(ev->getType() == ServerBasedContactEvent::Upload);
-		    }
-		}
-
-		++iur;
-		++ic;
-	      }
 
-	      ev->setUploadResults(updresults);
-	      server_based_contact_list.emit(ev);
-
-	      delete ev;
-	      m_reqidcache->remove( snac->RequestID() );
-	    } else {
-	      SignalLog(LogEvent::WARN, "Request ID cached value is not for a server-based contacts upload request");
+      case SNAC_SBL_List_Unchanged:
+      {
+	SignalLog(LogEvent::INFO, "Server-based list unchanged since last fetch\n");
+
+	// groups holding server-based contacts are on the server
+	ContactTree::iterator gcurr = m_contact_tree.begin();
+	while (gcurr != m_contact_tree.end()) {
+	  ContactTree::Group::iterator ccurr = (*gcurr).begin();
+	  while (ccurr != (*gcurr).end()) {
+	    if ((*ccurr)->getServerBased()) {
+	      m_sbl_groups.insert( (*gcurr).get_id() );
+	      break;
 	    }
-	  } else {
-	    SignalLog(LogEvent::WARN, "SBL Edit acknowledge from server for a non-existent upload");
+	    ++ccurr;
 	  }
-	*/
+	  ++gcurr;
 	}
+
+	SendSBLReceivedACK();
+	SignalServerBasedContactList(m_contact_tree, true);
+	break;
+      }
+      
+      case SNAC_SBL_Edit_ACK:
+	HandleSBLEditACK( static_cast<SBLEditACKSNAC*>(snac) );
 	break;
 
       } // switch(SBL Subtype)
@@ -1736,8 +2064,11 @@ namespace ICQ2000
    */
   void Client::Poll()
   {
+    FlushPresenceBatch(false);
+
+    // nothing to keep alive until logged in to the BOS server
     time_t now = time(NULL);
-    if (now > m_last_server_ping + 60)
+    if (m_state == BOS_LOGGED_IN && now > m_last_server_ping + 60)
     {
       PingServer();
       m_last_server_ping = now;
@@ -1747,9 +2078,20 @@ namespace ICQ2000
     m_reqidcache->clearoutPoll();
     m_cookiecache->clearoutPoll();
     m_dccache->clearoutPoll();
+    m_dcpathcache->clearoutPoll();
+    m_routestats->clearoutPoll();
+    m_tracer->clearoutPoll();
+    m_userinfo_fetcher->clearoutPoll();
+    SendQueuedUserInfo();
     m_dccache->clearoutMessagesPoll();
     m_ftcache->clearoutMessagesPoll();
     m_smtp->clearoutMessagesPoll();
+
+    if (m_metrics_interval != 0 && now >= m_metrics_last + (time_t)m_metrics_interval) {
+      m_metrics_last = now;
+      MetricsEvent ev( getMetrics() );
+      metrics.emit(&ev);
+    }
   }
 
   /**
@@ -1806,6 +2148,7 @@ namespace ICQ2000
 	
       } else if (m_serverSocket->getState() == TCPSocket::CONNECTED && (m & SocketEvent::READ)) { 
 	RecvFromServer();
+	FlushPresenceBatch(false);
       } else {
 	SignalLog(LogEvent::ERROR, "Server socket in inconsistent state!");
 	Disconnect(DisconnectedEvent::FAILED_LOWLEVEL);
@@ -1819,7 +2162,9 @@ namespace ICQ2000
       TCPSocket *sock = m_listenServer->Accept();
       DirectClient *dc = new DirectClient(m_self, sock, m_message_handler, &m_contact_tree,
 					  m_ext_ip, m_listenServer->getPort() );
-      (*m_dccache)[ sock->getSocketHandle() ] = dc;
+      dc->setCaptureSink(m_capture);
+      dc->setTracer(m_tracer);
+      m_dccache->add(dc);
       dc->logger.connect( this, &Client::dc_log_cb );
       dc->messageack.connect( this, &Client::dc_messageack_cb );
       dc->connected.connect( this, &Client::dc_connected_cb );
@@ -1852,6 +2197,7 @@ namespace ICQ2000
       if (m_dccache->exists(fd))
       {
 	dc = (*m_dccache)[fd];
+	m_dccache->touch(fd);
       }
       else if(m_smtp->getfd() == fd)
       {
@@ -1979,6 +2325,8 @@ namespace ICQ2000
    *  match messages it has sent up to their acks.
    */
   void Client::SendEvent(MessageEvent *ev) {
+    m_tracer->begin(ev);
+
     switch (ev->getType()) {
 
       case MessageEvent::Normal:
@@ -2002,8 +2350,19 @@ namespace ICQ2000
   bool Client::SendDirect(MessageEvent *ev) {
     ContactRef c = ev->getContact();
     if (!c->getDirect()) return false;
+    if (!m_routestats->usable( c->getUIN(), RouteStats::Direct )) return false;
+
+    // go through the server when that has been the quicker way
+    if (m_state == BOS_LOGGED_IN && c->get_accept_adv_msgs()
+	&& m_routestats->usable( c->getUIN(), RouteStats::Advanced )
+	&& m_routestats->expected( c->getUIN(), RouteStats::Advanced )
+	   < m_routestats->expected( c->getUIN(), RouteStats::Direct ))
+      return false;
+
     DirectClient *dc = ConnectDirect(c);
     if (dc == NULL) return false;
+    m_tracer->mark(ev, MessageTracer::RouteDirect);
+    m_routestats->sent(ev, RouteStats::Direct);
     dc->SendEvent(ev);
     return true;
   }
@@ -2011,41 +2370,96 @@ namespace ICQ2000
   DirectClient* Client::ConnectDirect(const ContactRef& c)
   {
     DirectClient *dc = m_dccache->getByContact(c);
-    if (dc == NULL) {
-      if (!m_out_dc) return NULL;
-      /*
-       * If their external IP != internal IP then it's
-       * only worth trying if their external IP == my external IP
-       * (when we are behind the same masq box)
-       */
-      if ( c->getExtIP() != c->getLanIP() && m_ext_ip != c->getExtIP() ) return NULL;
-      if ( c->getLanIP() == 0 ) return NULL;
-      SignalLog(LogEvent::INFO, "Establishing direct connection");
-      dc = new DirectClient(m_self, c, m_message_handler,
-			    m_ext_ip, (m_in_dc ? m_listenServer->getPort() : 0) );
-      dc->logger.connect( this, &Client::dc_log_cb) ;
-      dc->messageack.connect( this, &Client::dc_messageack_cb) ;
-      dc->connected.connect( this, &Client::dc_connected_cb ) ;
-      dc->socket.connect( this, &Client::dc_socket_cb) ;
-
-      try {
-	dc->Connect();
-      } catch(DisconnectedException e) {
-	SignalLog(LogEvent::WARN, e.what());
-	delete dc;
-	return NULL;
-      } catch(SocketException e) {
-	SignalLog(LogEvent::WARN, e.what());
-	delete dc;
-	return NULL;
-      } catch(...) {
-	SignalLog(LogEvent::WARN, "Uncaught exception");
-	return NULL;
+    if (dc != NULL) {
+      // still finding out if their address works, use the server meanwhile
+      if (dc->isProbe() && !dc->isConnected()) return NULL;
+      return dc;
+    }
+    if (!m_out_dc) return NULL;
+
+    /*
+     * Their LAN address is only worth trying if it is their external
+     * address too, or we are behind the same masq box. Their external
+     * address is worth trying otherwise, in case they have the port
+     * forwarded. When both are, both are raced and the first to
+     * finish the handshake is kept.
+     *
+     * When only the external address is worth trying, and it hasn't
+     * been seen to work, it is probed while messages go through the
+     * server - most of the time nothing is forwarded, and waiting for
+     * the connect to time out would hold the message up.
+     */
+    unsigned int lan_ip = c->getLanIP(), ext_ip = c->getExtIP();
+    unsigned short ext_port = (c->getExtPort() != 0 ? c->getExtPort() : c->getLanPort());
+    bool try_lan = ( lan_ip != 0 && (lan_ip == ext_ip || m_ext_ip == ext_ip) );
+    bool try_ext = ( ext_ip != 0 && ext_ip != lan_ip && ext_ip != m_ext_ip && ext_port != 0 );
+
+    bool ext_works = false;
+    if (m_dcpathcache->exists( c->getUIN() )) {
+      DCPath p = (*m_dcpathcache)[ c->getUIN() ];
+      if (p == DCPath_Unreachable) return NULL;
+      if (p == DCPath_LAN && try_lan) try_ext = false;
+      if (p == DCPath_External && try_ext) {
+	try_lan = false;
+	ext_works = true;
       }
+    }
+
+    if (!try_lan && !try_ext) return NULL;
+
+    if (!try_lan && !ext_works) {
+      SignalLog(LogEvent::INFO, "Probing external address for direct connection");
+      DirectClient *probe = StartDirect(c, ext_ip, ext_port);
+      if (probe == NULL) m_dcpathcache->set( c->getUIN(), DCPath_Unreachable );
+      else probe->setProbe(true);
+      return NULL;
+    }
+
+    SignalLog(LogEvent::INFO, "Establishing direct connection");
+    DirectClient *lan_dc = (try_lan ? StartDirect(c, lan_ip, c->getLanPort()) : NULL);
+    DirectClient *ext_dc = (try_ext ? StartDirect(c, ext_ip, ext_port) : NULL);
+
+    if (lan_dc != NULL && ext_dc != NULL) {
+      lan_dc->setRacePartner(ext_dc);
+    } else if (lan_dc == NULL && ext_dc == NULL) {
+      m_dcpathcache->set( c->getUIN(), DCPath_Unreachable );
+      return NULL;
+    }
+
+    return (lan_dc != NULL ? lan_dc : ext_dc);
+  }
+
+  DirectClient* Client::StartDirect(const ContactRef& c, unsigned int ip, unsigned short port)
+  {
+    DirectClient *dc = new DirectClient(m_self, c, m_message_handler,
+					m_ext_ip, (m_in_dc ? m_listenServer->getPort() : 0) );
+    dc->setCaptureSink(m_capture);
+    dc->setTracer(m_tracer);
+    dc->logger.connect( this, &Client::dc_log_cb) ;
+    dc->messageack.connect( this, &Client::dc_messageack_cb) ;
+    dc->connected.connect( this, &Client::dc_connected_cb ) ;
+    dc->socket.connect( this, &Client::dc_socket_cb) ;
 
-      (*m_dccache)[ dc->getfd() ] = dc;
+    try {
+      dc->Connect(ip, port);
+    } catch(DisconnectedException e) {
+      SignalLog(LogEvent::WARN, e.what());
+      ++m_metrics.dc_failures;
+      delete dc;
+      return NULL;
+    } catch(SocketException e) {
+      SignalLog(LogEvent::WARN, e.what());
+      ++m_metrics.dc_failures;
+      delete dc;
+      return NULL;
+    } catch(...) {
+      SignalLog(LogEvent::WARN, "Uncaught exception");
+      ++m_metrics.dc_failures;
+      delete dc;
+      return NULL;
     }
 
+    m_dccache->add(dc);
     return dc;
   }
 
@@ -2064,7 +2478,7 @@ namespace ICQ2000
        * knowing if it's received
        */
       
-      if (c->get_accept_adv_msgs())
+      if (c->get_accept_adv_msgs() && m_routestats->usable( c->getUIN(), RouteStats::Advanced ))
 	SendViaServerAdvanced(ev);
       else {
 	SendViaServerNormal(ev);
@@ -2087,6 +2501,7 @@ namespace ICQ2000
 	ev->setDelivered(false);
 	ev->setDirect(false);
 	ev->setDeliveryFailureReason(MessageEvent::Failed_ClientNotCapable);
+	m_tracer->finish(ev);
 	messageack.emit(ev);
 	delete ev;
       }
@@ -2137,6 +2552,7 @@ namespace ICQ2000
       ev->setDelivered(false);
       ev->setDirect(false);
       ev->setDeliveryFailureReason(MessageEvent::Failed_NotConnected);
+      m_tracer->finish(ev);
       messageack.emit(ev);
       delete ev;
       return;
@@ -2153,10 +2569,13 @@ namespace ICQ2000
     msnac.setICBMCookie( ck );
 
     m_cookiecache->insert( ck, ev );
+    m_routestats->sent(ev, RouteStats::Advanced);
+    m_tracer->mark(ev, MessageTracer::RouteServer);
 
     msnac.set_capabilities( c->get_capabilities() );
     
     FLAPwrapSNACandSend( msnac );
+    if (m_tracer->traced(ev)) m_tracer->written(ev, ck.toString());
     
     delete ist;
   }
@@ -2168,6 +2587,7 @@ namespace ICQ2000
       ev->setDelivered(false);
       ev->setDirect(false);
       ev->setDeliveryFailureReason(MessageEvent::Failed_NotConnected);
+      m_tracer->finish(ev);
       messageack.emit(ev);
       return;
     }
@@ -2179,7 +2599,9 @@ namespace ICQ2000
     MsgSendSNAC msnac(ist);
     msnac.setAdvanced(false);
 
+    m_tracer->mark(ev, MessageTracer::RouteServer);
     FLAPwrapSNACandSend( msnac );
+    m_tracer->written(ev, "");
     
     ev->setFinished(true);
     ev->setDelivered(true);
@@ -2191,6 +2613,7 @@ namespace ICQ2000
       ev->getContact()->setAuthAwait(true);
     }
 
+    m_tracer->finish(ev);
     messageack.emit(ev);
     delete ist;
   }
@@ -2246,74 +2669,580 @@ namespace ICQ2000
     Send(b);
   }
     
+  /**
+   *  Fetch the whole server-based contact list from the server. It is
+   *  fetched on logging in, or straight away if already logged in.
+   */
   void Client::fetchServerBasedContactList()
   {
     m_fetch_sbl = true;
+    m_fetch_sbl_conditional = false;
     if (m_state == BOS_LOGGED_IN) SendRequestSBL();
   }
   
-  void Client::fetchServerBasedContactList(int)
-  {
-    // TODO!
-  }
-
-  void Client::uploadServerBasedContact(const ContactRef& c)
+  /**
+   *  Fetch the server-based contact list only if it has changed since
+   *  a copy the client already has. The server compares the
+   *  modification time and item count given, and either sends the
+   *  full list or just says it is unchanged - in which case the local
+   *  contact list is taken as current. A ServerBasedContactEvent is
+   *  signalled on server_based_contact_list either way.
+   *
+   *  Typically used with loadContactTreeSnapshot, passing
+   *  getServerBasedListTimestamp() and getServerBasedListSize().
+   *
+   * @param timestamp modification time of the cached list
+   * @param count number of items on the cached list
+   */
+  void Client::fetchServerBasedContactList(unsigned int timestamp, unsigned short count)
   {
-    Buffer b;
-    FLAPwrapSNAC( b, SBLBeginEditSNAC() );
-    
-    // TODO ContactTree!
-    //    SBLAddEntrySNAC ssnac(l);
-    //    ssnac.setRequestID( reqid );
-    Send(b);
+    m_sbl_timestamp = timestamp;
+    m_sbl_size = count;
+    m_fetch_sbl = true;
+    m_fetch_sbl_conditional = true;
+    if (m_state == BOS_LOGGED_IN) SendRequestSBL();
   }
 
-  void Client::uploadServerBasedGroup(const ContactTree::Group& gp)
-  {
-  }
-  
-  void Client::uploadServerBasedContactList()
+  void Client::SignalServerBasedContactList(ContactTree& tree, bool unchanged)
   {
-    Buffer b;
+    ContactList l;
 
-    FLAPwrapSNAC( b, SBLBeginEditSNAC() );
+    ContactTree::iterator curr = tree.begin();
+    while (curr != tree.end()) {
+      ContactTree::Group::iterator gcurr = (*curr).begin();
+      while (gcurr != (*curr).end()) {
+	if ((*gcurr)->getServerBased()) {
+	  // hand out our own copy of the contact where we have one
+	  ContactRef c = m_contact_tree.lookup_uin( (*gcurr)->getUIN() );
+	  l.add( c.get() != NULL ? c : (*gcurr) );
+	}
+	++gcurr;
+      }
+      ++curr;
+    }
 
-    /*
-    ** needs recoding for groups **
-    ServerBasedContactEvent *ev = new ServerBasedContactEvent(ServerBasedContactEvent::Upload, m_contact_tree );
-    unsigned int reqid = NextRequestID();
-    m_reqidcache->insert( reqid, new ServerBasedContactCacheValue( ev ) );
-    */
+    ServerBasedContactEvent ev(ServerBasedContactEvent::Fetch, l);
+    ev.setUnchanged(unchanged);
+    server_based_contact_list.emit(&ev);
+  }
 
-    // TODO ContactTree!
-    //SBLAddEntrySNAC ssnac( m_contact_tree );
-    //    ssnac.setRequestID( reqid );
-    //    FLAPwrapSNAC( b, ssnac );
+  /**
+   *  Write the contact list to a snapshot file, for loading with
+   *  loadContactTreeSnapshot on the next startup. Groups, server-side
+   *  ids and the detailed user info fetched so far are all kept, along
+   *  with the timestamp and size of the server-based list last seen.
+   *
+   * @param filename file to write to
+   * @return whether the snapshot was written
+   */
+  bool Client::saveContactTreeSnapshot(const string& filename)
+  {
+    return ContactSnapshot::save( filename, m_contact_tree, m_sbl_timestamp, m_sbl_size );
+  }
 
-    FLAPwrapSNAC( b, SBLCommitEditSNAC() );
+  /**
+   *  Load a contact list snapshot written by saveContactTreeSnapshot
+   *  into the contact list. Contacts already on the list are left
+   *  alone. Best done before going online.
+   *
+   * @param filename file to read from
+   * @return whether the snapshot was loaded
+   */
+  bool Client::loadContactTreeSnapshot(const string& filename)
+  {
+    return ContactSnapshot::load( filename, m_contact_tree, m_sbl_timestamp, m_sbl_size );
+  }
 
-    Send(b);
+  /**
+   *  get the last modification time of the server-based list, as
+   *  last received from the server or loaded from a snapshot
+   */
+  unsigned int Client::getServerBasedListTimestamp() const
+  {
+    return m_sbl_timestamp;
   }
 
-  void Client::removeServerBasedContactList()
+  /**
+   *  get the number of items on the server-based list, as last
+   *  received from the server or loaded from a snapshot
+   */
+  unsigned short Client::getServerBasedListSize() const
   {
-    Buffer b;
+    return m_sbl_size;
+  }
 
-    FLAPwrapSNAC( b, SBLBeginEditSNAC() );
+  /**
+   *  Upload a contact to the server-based list. If it is already
+   *  there but in a different group it is moved. Its group is added
+   *  first if the server doesn't have it.
+   *
+   * @param c the contact, which must be on the contact list
+   * @return handle completing when the server has acknowledged the edit
+   */
+  RequestHandleRef Client::uploadServerBasedContact(const ContactRef& c)
+  {
+    if (!m_contact_tree.exists( c->getUIN() )) return finished_request(RequestHandle::ServerBasedContact, RequestHandle::Completed);
 
-    /*
-    ** needs recoding for groups **
-    ServerBasedContactEvent *ev = new ServerBasedContactEvent(ServerBasedContactEvent::Remove, l);
+    SBLEdit edit;
+    ContactTree::Group& gp = m_contact_tree.lookup_group_containing_contact(c);
+    planSBLUploadGroup(edit, gp);
+    planSBLUploadContact(edit, gp, c);
+    return SendSBLEdit(edit, ServerBasedContactEvent::Upload);
+  }
+
+  /**
+   *  Upload a group and all the contacts in it to the server-based
+   *  list.
+   *
+   * @param gp the group
+   * @return handle completing when the server has acknowledged the edit
+   */
+  RequestHandleRef Client::uploadServerBasedGroup(const ContactTree::Group& gp)
+  {
+    if (!m_contact_tree.exists_group( gp.get_id() )) return finished_request(RequestHandle::ServerBasedContact, RequestHandle::Completed);
+
+    SBLEdit edit;
+    ContactTree::Group& lgp = m_contact_tree.lookup_group( gp.get_id() );
+    planSBLUploadGroup(edit, lgp);
+
+    ContactTree::Group::iterator curr = lgp.begin();
+    while (curr != lgp.end()) {
+      planSBLUploadContact(edit, lgp, *curr);
+      ++curr;
+    }
+
+    return SendSBLEdit(edit, ServerBasedContactEvent::Upload);
+  }
+  
+  /**
+   *  Bring the server-based list in line with the contact list. New
+   *  groups and contacts are added, contacts that have changed group
+   *  are moved, and contacts and groups removed from the contact list
+   *  since the last fetch or sync are removed from the server. This
+   *  is all done in a single edit transaction.
+   *
+   * @return handle completing when the server has acknowledged the edit
+   */
+  RequestHandleRef Client::uploadServerBasedContactList()
+  {
+    SBLEdit edit;
+
+    ContactTree::iterator curr = m_contact_tree.begin();
+    while (curr != m_contact_tree.end()) {
+      planSBLUploadGroup(edit, *curr);
+
+      ContactTree::Group::iterator gcurr = (*curr).begin();
+      while (gcurr != (*curr).end()) {
+	planSBLUploadContact(edit, *curr, *gcurr);
+	++gcurr;
+      }
+      ++curr;
+    }
+
+    // deletions since last time
+    ContactList::iterator rcurr = m_sbl_removed.begin();
+    while (rcurr != m_sbl_removed.end()) {
+      if (!m_contact_tree.exists( (*rcurr)->getUIN() )) edit.removeContact(*rcurr);
+      ++rcurr;
+    }
+
+    std::map<unsigned short, string>::iterator rgcurr = m_sbl_removed_groups.begin();
+    while (rgcurr != m_sbl_removed_groups.end()) {
+      if (!m_contact_tree.exists_group( (*rgcurr).first ))
+	edit.removeGroup( (*rgcurr).second, (*rgcurr).first );
+      ++rgcurr;
+    }
+
+    return SendSBLEdit(edit, ServerBasedContactEvent::Upload);
+  }
+
+  /**
+   *  Remove a contact from the server-based list. It stays on the
+   *  local contact list.
+   *
+   * @param c the contact
+   * @return handle completing when the server has acknowledged the edit
+   */
+  RequestHandleRef Client::removeServerBasedContact(const ContactRef& c)
+  {
+    if (!c->getServerBased()) return finished_request(RequestHandle::ServerBasedContact, RequestHandle::Completed);
+
+    SBLEdit edit;
+    edit.removeContact(c);
+    return SendSBLEdit(edit, ServerBasedContactEvent::Remove);
+  }
+
+  /**
+   *  Remove a group, and the contacts in it, from the server-based
+   *  list. They stay on the local contact list.
+   *
+   * @param gp the group
+   * @return handle completing when the server has acknowledged the edit
+   */
+  RequestHandleRef Client::removeServerBasedGroup(const ContactTree::Group& gp)
+  {
+    SBLEdit edit;
+    planSBLRemoveGroup(edit, gp);
+    return SendSBLEdit(edit, ServerBasedContactEvent::Remove);
+  }
+
+  /**
+   *  Remove everything from the server-based list. The local contact
+   *  list is left alone.
+   *
+   * @return handle completing when the server has acknowledged the edit
+   */
+  RequestHandleRef Client::removeServerBasedContactList()
+  {
+    SBLEdit edit;
+
+    ContactTree::iterator curr = m_contact_tree.begin();
+    while (curr != m_contact_tree.end()) {
+      planSBLRemoveGroup(edit, *curr);
+      ++curr;
+    }
+
+    ContactList::iterator rcurr = m_sbl_removed.begin();
+    while (rcurr != m_sbl_removed.end()) {
+      edit.removeContact(*rcurr);
+      ++rcurr;
+    }
+
+    std::map<unsigned short, string>::iterator rgcurr = m_sbl_removed_groups.begin();
+    while (rgcurr != m_sbl_removed_groups.end()) {
+      edit.removeGroup( (*rgcurr).second, (*rgcurr).first );
+      ++rgcurr;
+    }
+
+    return SendSBLEdit(edit, ServerBasedContactEvent::Remove);
+  }
+
+  void Client::planSBLUploadGroup(SBLEdit& edit, const ContactTree::Group& gp)
+  {
+    if (gp.get_id() != 0 && m_sbl_groups.count( gp.get_id() ) == 0)
+      edit.addGroup( gp.get_label(), gp.get_id() );
+  }
+
+  void Client::planSBLUploadContact(SBLEdit& edit, const ContactTree::Group& gp, const ContactRef& c)
+  {
+    if (!c->isICQContact() || gp.get_id() == 0) return;
+
+    if (!c->getServerBased()) {
+      edit.addContact( c, gp.get_id() );
+    } else if (c->getServerSideGroupID() != gp.get_id()) {
+      // the server has no move, so take it out of the old group
+      edit.removeContact(c);
+      edit.addContact( c, gp.get_id() );
+    }
+  }
+
+  void Client::planSBLRemoveGroup(SBLEdit& edit, const ContactTree::Group& gp)
+  {
+    ContactTree::Group::const_iterator curr = gp.begin();
+    while (curr != gp.end()) {
+      if ((*curr)->getServerBased()) edit.removeContact(*curr);
+      ++curr;
+    }
+
+    if (m_sbl_groups.count( gp.get_id() ) != 0)
+      edit.removeGroup( gp.get_label(), gp.get_id() );
+  }
+
+  /*
+   * Pack an SBLEdit into a single transaction: groups added first, so
+   * the contacts going into them have somewhere to go, then contact
+   * removals, contact additions, group removals, and lastly updates of
+   * the member lists of every group touched (and of the master group
+   * if groups came or went). Additions, removals and member list
+   * updates are packed as many to a SNAC as fit. Every SNAC carries the same request id, the
+   * EditACKs are matched back against the entries in
+   * HandleSBLEditACK.
+   */
+  RequestHandleRef Client::SendSBLEdit(SBLEdit& edit, ServerBasedContactEvent::SBLType type)
+  {
+    if (edit.empty()) return finished_request(RequestHandle::ServerBasedContact, RequestHandle::Completed);
+    if (m_state != BOS_LOGGED_IN) return finished_request(RequestHandle::ServerBasedContact, RequestHandle::Cancelled);
+
+    // tag ids in use, and what will be on the server afterwards
+    std::set<unsigned short> tags;
+    unsigned int n_contacts = 0;
+
+    ContactTree::iterator curr = m_contact_tree.begin();
+    while (curr != m_contact_tree.end()) {
+      ContactTree::Group::iterator gcurr = (*curr).begin();
+      while (gcurr != (*curr).end()) {
+	if ((*gcurr)->getServerBased()) {
+	  tags.insert( (*gcurr)->getServerSideID() );
+	  ++n_contacts;
+	}
+	++gcurr;
+      }
+      ++curr;
+    }
+
+    ContactList involved;
+    std::list<SBLEdit::ContactEntry>::iterator acurr = edit.add_contacts.begin();
+    while (acurr != edit.add_contacts.end()) involved.add( (*acurr++).first );
+    std::list<ContactRef>::iterator rcurr = edit.remove_contacts.begin();
+    while (rcurr != edit.remove_contacts.end()) involved.add( *rcurr++ );
+
+    ServerBasedContactEvent *ev = new ServerBasedContactEvent(type, involved);
+    ServerBasedContactCacheValue *v = new ServerBasedContactCacheValue(ev);
     unsigned int reqid = NextRequestID();
-    m_reqidcache->insert( reqid, new ServerBasedContactCacheValue( ev ) );
 
-    SBLRemoveEntrySNAC ssnac(l);
-    ssnac.setRequestID( reqid );
-    FLAPwrapSNAC( b, ssnac );
-    */
+    // respect the limits from the rights reply
+    int n_after = n_contacts - edit.remove_contacts.size();
+    if (m_sbl_max_contacts != 0 && n_after + (int)edit.add_contacts.size() > m_sbl_max_contacts) {
+      SignalLog(LogEvent::WARN, "Server-based list would be over its size limit, not all contacts uploaded");
+      while (!edit.add_contacts.empty()
+	     && n_after + (int)edit.add_contacts.size() > m_sbl_max_contacts) {
+	unsigned int uin = edit.add_contacts.back().first->getUIN();
+	ev->setUploadResult( uin, ServerBasedContactEvent::Failed );
+	// not going in any member list either
+	involved.remove(uin);
+	edit.add_contacts.pop_back();
+      }
+    }
+
+    if (m_sbl_max_groups != 0 && m_sbl_groups.size() + edit.add_groups.size() > m_sbl_max_groups) {
+      SignalLog(LogEvent::WARN, "Server-based list would be over its group limit, not all groups uploaded");
+      while (!edit.add_groups.empty() && m_sbl_groups.size() + edit.add_groups.size() > m_sbl_max_groups) {
+	ev->setGroupResult( edit.add_groups.back().second, ServerBasedContactEvent::Failed );
+	edit.add_groups.pop_back();
+      }
+    }
+
+    Buffer b;
+    FLAPwrapSNAC( b, SBLBeginEditSNAC() );
+
+    std::set<unsigned short> groups_after = m_sbl_groups;
+
+    // -- new groups --
+    if (!edit.add_groups.empty()) {
+      SBLAddEntrySNAC snac;
+      std::list<SBLGroupEntry>::iterator gcurr = edit.add_groups.begin();
+      while (gcurr != edit.add_groups.end()) {
+	snac.addGroup( (*gcurr).first, (*gcurr).second );
+	v->addItem( ServerBasedContactCacheValue::Group_Add, ContactRef(), (*gcurr).second );
+	groups_after.insert( (*gcurr).second );
+	++gcurr;
+      }
+      snac.setRequestID(reqid);
+      FLAPwrapSNAC( b, snac );
+    }
+
+    // -- contact removals, with the group ids the server has now --
+    rcurr = edit.remove_contacts.begin();
+    while (rcurr != edit.remove_contacts.end()) {
+      SBLRemoveEntrySNAC snac;
+      unsigned int bytes = 0;
+      while (rcurr != edit.remove_contacts.end() && bytes < SBLEdit::MaxSNACBytes) {
+	snac.addBuddy(*rcurr);
+	v->addItem( ServerBasedContactCacheValue::Contact_Remove, *rcurr, (*rcurr)->getServerSideGroupID() );
+	bytes += 16 + (*rcurr)->getStringUIN().size() + (*rcurr)->getAlias().size();
+	++rcurr;
+      }
+      snac.setRequestID(reqid);
+      FLAPwrapSNAC( b, snac );
+    }
+
+    // -- contact additions --
+    unsigned short next_tag = 1;
+    acurr = edit.add_contacts.begin();
+    while (acurr != edit.add_contacts.end()) {
+      SBLAddEntrySNAC snac;
+      unsigned int bytes = 0;
+      while (acurr != edit.add_contacts.end() && bytes < SBLEdit::MaxSNACBytes) {
+	ContactRef c = (*acurr).first;
+	unsigned short tag = c->getServerSideID();
+	if (!c->getServerBased() || tag == 0) {
+	  while (tags.count(next_tag) != 0) ++next_tag;
+	  tag = next_tag;
+	  tags.insert(tag);
+	}
+	c->setServerSideInfo( (*acurr).second, tag );
+
+	snac.addBuddy(c);
+	v->addItem( ServerBasedContactCacheValue::Contact_Add, c, (*acurr).second );
+	bytes += 16 + c->getStringUIN().size() + c->getAlias().size();
+	++acurr;
+      }
+      snac.setRequestID(reqid);
+      FLAPwrapSNAC( b, snac );
+    }
+
+    // -- removed groups --
+    if (!edit.remove_groups.empty()) {
+      SBLRemoveEntrySNAC snac;
+      std::list<SBLGroupEntry>::iterator gcurr = edit.remove_groups.begin();
+      while (gcurr != edit.remove_groups.end()) {
+	snac.addGroup( (*gcurr).first, (*gcurr).second );
+	v->addItem( ServerBasedContactCacheValue::Group_Remove, ContactRef(), (*gcurr).second );
+	groups_after.erase( (*gcurr).second );
+	edit.touched_groups.erase( (*gcurr).second );
+	++gcurr;
+      }
+      snac.setRequestID(reqid);
+      FLAPwrapSNAC( b, snac );
+    }
+
+    // -- member lists of changed groups --
+    std::set<unsigned int> removed_uins, added_uins;
+    rcurr = edit.remove_contacts.begin();
+    while (rcurr != edit.remove_contacts.end()) removed_uins.insert( (*rcurr++)->getUIN() );
+    acurr = edit.add_contacts.begin();
+    while (acurr != edit.add_contacts.end()) added_uins.insert( (*acurr++).first->getUIN() );
+
+    SBLUpdateEntrySNAC usnac;
+    unsigned int bytes = 0;
+    std::set<unsigned short>::iterator tcurr = edit.touched_groups.begin();
+    while (tcurr != edit.touched_groups.end()) {
+      if (m_contact_tree.exists_group(*tcurr) && groups_after.count(*tcurr) != 0) {
+	ContactTree::Group& gp = m_contact_tree.lookup_group(*tcurr);
+	std::vector<unsigned short> ids;
+	ContactTree::Group::iterator gcurr = gp.begin();
+	while (gcurr != gp.end()) {
+	  ContactRef c = (*gcurr);
+	  if (c->getServerSideGroupID() == gp.get_id() && (c->getServerBased() || involved.exists(c->getUIN()))
+	      && (removed_uins.count(c->getUIN()) == 0 || added_uins.count(c->getUIN()) != 0))
+	    ids.push_back( c->getServerSideID() );
+	  ++gcurr;
+	}
+	if (bytes >= SBLEdit::MaxSNACBytes) {
+	  usnac.setRequestID(reqid);
+	  FLAPwrapSNAC( b, usnac );
+	  usnac = SBLUpdateEntrySNAC();
+	  bytes = 0;
+	}
+	usnac.addGroup( gp.get_label(), gp.get_id(), ids );
+	bytes += 14 + gp.get_label().size() + 2 * ids.size();
+	v->addItem( ServerBasedContactCacheValue::Group_Update, ContactRef(), gp.get_id() );
+      }
+      ++tcurr;
+    }
+
+    if (!edit.add_groups.empty() || !edit.remove_groups.empty()) {
+      // the master group (id 0) lists all the groups
+      std::vector<unsigned short> ids( groups_after.begin(), groups_after.end() );
+      if (bytes >= SBLEdit::MaxSNACBytes) {
+	usnac.setRequestID(reqid);
+	FLAPwrapSNAC( b, usnac );
+	usnac = SBLUpdateEntrySNAC();
+      }
+      usnac.addGroup( "", 0, ids );
+      v->addItem( ServerBasedContactCacheValue::Group_Update, ContactRef(), 0 );
+    }
+
+    if (usnac.size() > 0) {
+      usnac.setRequestID(reqid);
+      FLAPwrapSNAC( b, usnac );
+    }
+
     FLAPwrapSNAC( b, SBLCommitEditSNAC() );
 
+    if (v->size() == 0) {
+      // everything was refused before sending
+      delete v;
+      return finished_request(RequestHandle::ServerBasedContact, RequestHandle::Cancelled);
+    }
+
+    RequestHandleRef h = TrackRequest( reqid, v, new RequestHandle(RequestHandle::ServerBasedContact) );
+
+    /* our copy of the server's modification time is out of date now,
+     * so the next conditional fetch should download the list again */
+    m_sbl_timestamp = 0;
+
+    ostringstream ostr;
+    ostr << "Sending server-based list edit of " << v->size() << " entries";
+    SignalLog(LogEvent::INFO, ostr.str());
     Send(b);
+
+    return h;
+  }
+
+  void Client::HandleSBLEditACK(SBLEditACKSNAC *snac)
+  {
+    vector<SBLEditACKSNAC::Result> r = snac->getResults();
+
+    if ( m_reqidcache->exists( snac->RequestID() )
+	 && (*m_reqidcache)[ snac->RequestID() ]->getType() == RequestIDCacheValue::Cancelled ) {
+      /* an edit given up on - there is an ACK for each SNAC of it, the
+	 placeholder goes with the last */
+      CancelledCacheValue *cv = static_cast<CancelledCacheValue*>( (*m_reqidcache)[ snac->RequestID() ] );
+      if (cv->acked( r.size() )) m_reqidcache->remove( snac->RequestID() );
+      return;
+    }
+
+    if ( !m_reqidcache->exists( snac->RequestID() )
+	 || (*m_reqidcache)[ snac->RequestID() ]->getType() != RequestIDCacheValue::ServerBasedContact ) {
+      SignalLog(LogEvent::WARN, "SBL Edit acknowledge from server for a non-existent edit");
+      return;
+    }
+
+    ServerBasedContactCacheValue *v
+      = static_cast<ServerBasedContactCacheValue*>( (*m_reqidcache)[ snac->RequestID() ] );
+    ServerBasedContactEvent *ev = v->getEvent();
+
+    vector<SBLEditACKSNAC::Result>::iterator ir = r.begin();
+    while (ir != r.end() && !v->isFinished()) {
+      ServerBasedContactCacheValue::Item& item = v->nextItem();
+
+      ServerBasedContactEvent::UploadResult ur;
+      switch(*ir) {
+      case SBLEditACKSNAC::Success:
+	ur = ServerBasedContactEvent::Success;
+	break;
+      case SBLEditACKSNAC::AuthRequired:
+	ur = ServerBasedContactEvent::AuthRequired;
+	break;
+      case SBLEditACKSNAC::AlreadyExists:
+	ur = ServerBasedContactEvent::AlreadyExists;
+	break;
+      default:
+	ur = ServerBasedContactEvent::Failed;
+      }
+      bool ok = (ur != ServerBasedContactEvent::Failed);
+
+      switch(item.type) {
+      case ServerBasedContactCacheValue::Contact_Add:
+	item.contact->setServerBased(ok);
+	if (ur == ServerBasedContactEvent::AuthRequired) item.contact->setAuthAwait(true);
+	ev->setUploadResult( item.contact->getUIN(), ur );
+	break;
+      case ServerBasedContactCacheValue::Contact_Remove:
+	if (ok) {
+	  item.contact->setServerBased(false);
+	  m_sbl_removed.remove( item.contact->getUIN() );
+	}
+	ev->setUploadResult( item.contact->getUIN(), ur );
+	break;
+      case ServerBasedContactCacheValue::Group_Add:
+	if (ok) m_sbl_groups.insert( item.group_id );
+	ev->setGroupResult( item.group_id, ur );
+	break;
+      case ServerBasedContactCacheValue::Group_Remove:
+	if (ok) {
+	  m_sbl_groups.erase( item.group_id );
+	  m_sbl_removed_groups.erase( item.group_id );
+	}
+	ev->setGroupResult( item.group_id, ur );
+	break;
+      case ServerBasedContactCacheValue::Group_Update:
+	if (!ok) SignalLog(LogEvent::WARN, "Server-based list group update failed");
+	break;
+      }
+
+      ++ir;
+    }
+
+    if (v->isFinished()) {
+      ostringstream ostr;
+      ostr << "Server-based list edit of " << v->size() << " entries acknowledged";
+      SignalLog(LogEvent::INFO, ostr.str());
+
+      server_based_contact_list.emit(ev);
+      m_reqidcache->remove( snac->RequestID() );
+    }
   }
 
   /**
@@ -2464,6 +3393,223 @@ namespace ICQ2000
     return m_web_aware;
   }
 
+  /**
+   *  Batch up contact status changes. Instead of a StatusChangeEvent
+   *  on contact_status_change_signal for each contact, the changes are
+   *  collected and signalled on presence_batch as a single
+   *  PresenceBatchEvent. This saves a flood of signals at sign-on,
+   *  when the server sends the status of every contact online.
+   *
+   *  With a window of 0 the batch is signalled after each lot of data
+   *  from the server is handled, otherwise once the window has passed
+   *  since the first change in it (checked as data comes in, and in
+   *  Poll). Changes to your own status are signalled as normal.
+   *
+   * @param b whether to batch status changes
+   * @param window the time to collect changes over, in seconds
+   */
+  void Client::setPresenceBatching(bool b, unsigned int window)
+  {
+    m_presence_batching = b;
+    m_presence_window = window;
+    if (!b) FlushPresenceBatch(true);
+  }
+
+  /**
+   *  get whether contact status changes are being batched
+   */
+  bool Client::getPresenceBatching() const
+  {
+    return m_presence_batching;
+  }
+
+  /**
+   *  Batch up the messages stored on the server while we were
+   *  offline. Rather than a MessageEvent on messaged for each, they
+   *  are gathered until the server has sent them all, translated
+   *  together, sorted by time and signalled on offline_messages as a
+   *  single OfflineMessageBatchEvent, before the server is told it
+   *  can delete them.
+   *
+   * @param b whether to batch offline messages
+   */
+  void Client::setOfflineMessageBatching(bool b)
+  {
+    m_offline_batching = b;
+  }
+
+  /**
+   *  get whether offline messages are being batched
+   */
+  bool Client::getOfflineMessageBatching() const
+  {
+    return m_offline_batching;
+  }
+
+  /**
+   *  Get a snapshot of the metrics: traffic to and from the server
+   *  by FLAP channel, SNACs received by family, parse errors, direct
+   *  connections made and failed and how long messages took to be
+   *  acknowledged, counted since they were last reset; and the
+   *  current depth of the queues and caches.
+   */
+  Metrics Client::getMetrics()
+  {
+    m_metrics.userinfo_queue = m_userinfo_fetcher->queued();
+    m_metrics.dc_queue = m_dccache->queued();
+    m_metrics.reqid_cache = m_reqidcache->size();
+    m_metrics.cookie_cache = m_cookiecache->size();
+    m_metrics.dc_cache = m_dccache->size();
+    m_metrics.ft_cache = m_ftcache->size();
+    return m_metrics;
+  }
+
+  /**
+   *  Zero the metrics counters.
+   */
+  void Client::resetMetrics()
+  {
+    m_metrics.clear();
+  }
+
+  /**
+   *  Signal a snapshot of the metrics on metrics every so often, from
+   *  Poll, so the interval is only as good as Poll is regular.
+   *
+   * @param s seconds between snapshots, 0 to stop
+   */
+  void Client::setMetricsInterval(unsigned int s)
+  {
+    m_metrics_interval = s;
+    m_metrics_last = time(NULL);
+  }
+
+  /**
+   *  get the seconds between snapshots on metrics, 0 for none
+   */
+  unsigned int Client::getMetricsInterval() const
+  {
+    return m_metrics_interval;
+  }
+
+  /**
+   *  Trace the stages a message goes through, from SendEvent to the
+   *  messageack signal: choosing a route, being written to the
+   *  socket, the ACK from the server or the other client, and being
+   *  signalled. Only one in every sample messages is traced, so it
+   *  can be left on.
+   *
+   * @param sample trace one message in this many, 0 to stop tracing
+   * @see writeMessageTrace
+   */
+  void Client::setMessageTracing(unsigned int sample)
+  {
+    m_tracer->setSampling(sample);
+  }
+
+  /**
+   *  get how many messages there are to each one traced, 0 for none
+   */
+  unsigned int Client::getMessageTracing() const
+  {
+    return m_tracer->getSampling();
+  }
+
+  /**
+   *  Write the messages traced so far to a file in the trace event
+   *  JSON format, which chrome://tracing and Perfetto will load. Each
+   *  contact gets a track, with a span for each message and its
+   *  stages inside it. The last 1000 messages are kept.
+   *
+   * @param filename file to write to
+   * @return whether the file could be written
+   */
+  bool Client::writeMessageTrace(const string& filename) const
+  {
+    return m_tracer->write(filename);
+  }
+
+  /**
+   *  Forget the messages traced so far.
+   */
+  void Client::clearMessageTrace()
+  {
+    m_tracer->clear();
+  }
+
+  /**
+   *  Start recording every packet received from the server and from
+   *  direct connections to a file, with the time it arrived. The
+   *  capture can be fed back in later with replayServerData.
+   *
+   * @param filename file to write the capture to
+   * @return whether the file could be opened
+   */
+  bool Client::startCapture(const string& filename)
+  {
+    return m_capture->open(filename);
+  }
+
+  /**
+   *  Stop recording packets and close the capture file.
+   */
+  void Client::stopCapture()
+  {
+    m_capture->close();
+  }
+
+  /**
+   *  get whether packets are being captured
+   */
+  bool Client::isCapturing() const
+  {
+    return m_capture->isOpen();
+  }
+
+  /**
+   *  Put the client into replay mode, as though a connection to the
+   *  authorizer had just been established. Nothing is sent and no
+   *  connection is made to the BOS server while replaying - the
+   *  server packets are instead supplied with replayServerData.
+   */
+  void Client::beginReplay()
+  {
+    if (m_state != NOT_CONNECTED) return;
+
+    m_replaying = true;
+    m_server_stream = 1;
+    m_recv->clear();
+    m_framer->reset();
+    m_state = AUTH_AWAITING_CONN_ACK;
+  }
+
+  /**
+   *  Feed data to the client as though it had been received from the
+   *  server. Only valid between beginReplay and endReplay.
+   *
+   * @param data the bytes received, need not fall on FLAP boundaries
+   * @param len length of data
+   */
+  void Client::replayServerData(const unsigned char *data, unsigned int len)
+  {
+    if (!m_replaying) return;
+
+    m_recv->Pack(data, len);
+    Parse();
+  }
+
+  /**
+   *  Leave replay mode, disconnecting as though requested.
+   */
+  void Client::endReplay()
+  {
+    if (!m_replaying) return;
+
+    Disconnect(DisconnectedEvent::REQUESTED);
+    m_recv->clear();
+    m_replaying = false;
+  }
+
   void Client::contactlist_cb(ContactListEvent *ev)
   {
     if (ev->getType() == ContactListEvent::UserAdded)
@@ -2491,12 +3637,27 @@ namespace ICQ2000
       // remove all direct connections for that contact
       m_dccache->removeContact(c);
 
+      // still on the server-based list until the next sync
+      if (c->getServerBased()) m_sbl_removed.add(c);
+
     }
     else if (ev->getType() == ContactListEvent::GroupAdded)
     {
     }
     else if (ev->getType() == ContactListEvent::GroupRemoved)
     {
+      GroupRemovedEvent *gev = static_cast<GroupRemovedEvent*>(ev);
+      const ContactTree::Group& gp = gev->get_group();
+
+      if (m_sbl_groups.count( gp.get_id() ) != 0) {
+	m_sbl_removed_groups[ gp.get_id() ] = gp.get_label();
+
+	ContactTree::Group::const_iterator curr = gp.begin();
+	while (curr != gp.end()) {
+	  if ((*curr)->getServerBased()) m_sbl_removed.add(*curr);
+	  ++curr;
+	}
+      }
     }
     else if (ev->getType() == ContactListEvent::CompleteUpdate)
     {
@@ -2646,6 +3807,9 @@ namespace ICQ2000
 
     if ( !c->isICQContact() ) return;
 
+    // a detailed request covers everything the simple one would
+    if ( m_userinfo_fetcher->pending( c->getUIN() ) ) return;
+
     SignalLog(LogEvent::INFO, "Sending request Simple Userinfo Request");
     FLAPwrapSNACandSend( SrvRequestSimpleUserInfo( m_self->getUIN(), c->getUIN() ) );
   }
@@ -2655,19 +3819,161 @@ namespace ICQ2000
    *  server has replied with the details the library will signal a
    *  user info changed for this contact.
    *
+   *  Requests are scheduled: one for a contact already waiting or
+   *  in progress is collapsed into it, a contact whose details were
+   *  fetched within the cache TTL is not asked for again, and
+   *  requests are sent out no faster than the fetch rate allows.
+   *
    * @param c contact to fetch info for
-   * @see ContactListEvent
+   * @return handle completing when the details have arrived
+   * @see ContactListEvent, setUserInfoCacheTTL, setUserInfoFetchRate
    */
-  void Client::fetchDetailContactInfo(ContactRef c) {
-    if ( !c->isICQContact() ) return;
+  RequestHandleRef Client::fetchDetailContactInfo(ContactRef c) {
+    return fetchDetailContactInfo(c, false);
+  }
 
-    SignalLog(LogEvent::INFO, "Sending request Detailed Userinfo Request");
+  /**
+   *  Request the detailed contact information for a Contact.
+   *
+   * @param c contact to fetch info for
+   * @param force fetch even if the cached details are still fresh
+   * @return handle completing when the details have arrived
+   */
+  RequestHandleRef Client::fetchDetailContactInfo(ContactRef c, bool force) {
+    RequestHandleRef h = queueDetailContactInfo(c, force);
+    SendQueuedUserInfo();
+    return h;
+  }
 
-    unsigned int reqid = NextRequestID();
-    m_reqidcache->insert( reqid, new UserInfoCacheValue(c) );
-    SrvRequestDetailUserInfo ssnac( m_self->getUIN(), c->getUIN() );
-    ssnac.setRequestID( reqid );
-    FLAPwrapSNACandSend( ssnac );
+  /*
+   * Add a contact to the detailed info queue, without sending.
+   */
+  RequestHandleRef Client::queueDetailContactInfo(ContactRef c, bool force) {
+    if ( !c->isICQContact() ) return finished_request(RequestHandle::UserInfo, RequestHandle::Cancelled);
+    return m_userinfo_fetcher->request(c, force);
+  }
+
+  /*
+   * Send out as many queued detailed info requests as the fetch rate
+   * allows right now.
+   */
+  void Client::SendQueuedUserInfo() {
+    if (m_state != BOS_LOGGED_IN) return;
+
+    time_t now = time(NULL);
+    RequestHandleRef h;
+    while ( (h = m_userinfo_fetcher->next(now)).get() != NULL ) {
+      SignalLog(LogEvent::INFO, "Sending request Detailed Userinfo Request");
+
+      ContactRef c = h->getContact();
+      unsigned int reqid = NextRequestID();
+      TrackRequest( reqid, new UserInfoCacheValue(c), h );
+      SrvRequestDetailUserInfo ssnac( m_self->getUIN(), c->getUIN() );
+      ssnac.setRequestID( reqid );
+      FLAPwrapSNACandSend( ssnac );
+    }
+  }
+
+  /*
+   * Register an outstanding request under its request id, with the
+   * handle that completes when the entry is removed or expires.
+   */
+  RequestHandleRef Client::TrackRequest(unsigned int reqid, RequestIDCacheValue *v, RequestHandleRef h)
+  {
+    h->setRequestID(reqid);
+    v->setHandle(h);
+    m_reqidcache->insert( reqid, v );
+    return h;
+  }
+
+  /**
+   *  Cancel an outstanding request. The handle completes as
+   *  Cancelled, and the request is given up on as if it had timed out
+   *  (so a search signals its result as expired). Replies arriving
+   *  for it afterwards are dropped. Handles for requests that were
+   *  collapsed together are shared, cancelling one cancels them all.
+   *
+   * @param h the request's handle
+   */
+  void Client::cancelRequest(RequestHandleRef h)
+  {
+    if (h.get() == NULL || h->isDone()) return;
+
+    if (h->getRequestID() == 0) {
+      // not sent yet
+      if (h->getType() == RequestHandle::UserInfo)
+	m_userinfo_fetcher->cancel( h->getContact()->getUIN() );
+      h->finish(RequestHandle::Cancelled);
+      return;
+    }
+
+    // an edit's unanswered entries, so its placeholder goes with the last ACK
+    unsigned int outstanding = 0;
+    if (m_reqidcache->exists( h->getRequestID() )) {
+      RequestIDCacheValue *v = (*m_reqidcache)[ h->getRequestID() ];
+      if (v->getType() == RequestIDCacheValue::ServerBasedContact)
+	outstanding = static_cast<ServerBasedContactCacheValue*>(v)->remaining();
+    }
+
+    h->finish(RequestHandle::Cancelled);
+    m_reqidcache->expire( h->getRequestID() );
+    m_reqidcache->insert( h->getRequestID(), new CancelledCacheValue(outstanding) );
+  }
+
+  /**
+   *  set how long fetched contact details are considered fresh,
+   *  during which fetchDetailContactInfo won't ask for them again.
+   *
+   * @param ttl time in seconds, 0 disables the cache
+   */
+  void Client::setUserInfoCacheTTL(unsigned int ttl)
+  {
+    m_userinfo_fetcher->setTTL(ttl);
+  }
+
+  unsigned int Client::getUserInfoCacheTTL() const
+  {
+    return m_userinfo_fetcher->getTTL();
+  }
+
+  /**
+   *  set the pacing of detailed user info requests
+   *
+   * @param per_second requests sent per second at most, 0 for no limit
+   * @param max_outstanding requests awaiting a reply at most
+   */
+  void Client::setUserInfoFetchRate(unsigned int per_second, unsigned int max_outstanding)
+  {
+    m_userinfo_fetcher->setRate(per_second, max_outstanding);
+  }
+
+  /**
+   *  forget that a contact's details are fresh, so the next
+   *  fetchDetailContactInfo goes to the server.
+   *
+   * @param uin the contact's uin
+   */
+  void Client::invalidateUserInfo(unsigned int uin)
+  {
+    m_userinfo_fetcher->invalidate(uin);
+  }
+
+  /**
+   *  get counters for detailed user info fetches
+   *
+   * @param requested calls to fetch detailed info
+   * @param collapsed requests merged into one already waiting
+   * @param cached requests answered from fresh details
+   * @param sent requests sent to the server
+   */
+  void Client::getUserInfoFetchStats(unsigned int& requested, unsigned int& collapsed,
+				     unsigned int& cached, unsigned int& sent) const
+  {
+    UserInfoFetcher::Stats st = m_userinfo_fetcher->getStats();
+    requested = st.requested;
+    collapsed = st.collapsed;
+    cached = st.cached;
+    sent = st.sent;
   }
 
   void Client::fetchSelfSimpleContactInfo()
@@ -2677,7 +3983,7 @@ namespace ICQ2000
 
   void Client::fetchSelfDetailContactInfo()
   {
-    fetchDetailContactInfo(m_self);
+    fetchDetailContactInfo(m_self, true);
   }
 
   SearchResultEvent* Client::searchForContacts
@@ -2687,7 +3993,7 @@ namespace ICQ2000
     SearchResultEvent *ev = new SearchResultEvent( SearchResultEvent::ShortWhitepage );
 
     unsigned int reqid = NextRequestID();
-    m_reqidcache->insert( reqid, new SearchCacheValue( ev ) );
+    ev->setRequestHandle( TrackRequest( reqid, new SearchCacheValue( ev ), new RequestHandle(RequestHandle::Search) ) );
 
     SrvRequestShortWP ssnac( m_self->getUIN(), nickname, firstname, lastname );
     ssnac.setRequestID( reqid );
@@ -2709,7 +4015,7 @@ namespace ICQ2000
     SearchResultEvent *ev = new SearchResultEvent( SearchResultEvent::FullWhitepage );
 
     unsigned int reqid = NextRequestID();
-    m_reqidcache->insert( reqid, new SearchCacheValue( ev ) );
+    ev->setRequestHandle( TrackRequest( reqid, new SearchCacheValue( ev ), new RequestHandle(RequestHandle::Search) ) );
 
     unsigned short min_age, max_age;
 
@@ -2760,7 +4066,7 @@ namespace ICQ2000
     SearchResultEvent *ev = new SearchResultEvent( SearchResultEvent::UIN );
 
     unsigned int reqid = NextRequestID();
-    m_reqidcache->insert( reqid, new SearchCacheValue( ev ) );
+    ev->setRequestHandle( TrackRequest( reqid, new SearchCacheValue( ev ), new RequestHandle(RequestHandle::Search) ) );
 
     SrvRequestSimpleUserInfo ssnac( m_self->getUIN(), uin );
     ssnac.setRequestID( reqid );
@@ -2775,7 +4081,7 @@ namespace ICQ2000
   {
     SearchResultEvent *ev = new SearchResultEvent( SearchResultEvent::Keyword );
     unsigned int reqid = NextRequestID();
-    m_reqidcache->insert( reqid, new SearchCacheValue( ev ) );
+    ev->setRequestHandle( TrackRequest( reqid, new SearchCacheValue( ev ), new RequestHandle(RequestHandle::Search) ) );
     
     SrvRequestKeywordSearch ssnac( m_self->getUIN(), keyword );
     ssnac.setRequestID( reqid );
@@ -2790,7 +4096,7 @@ namespace ICQ2000
   {
     SearchResultEvent *ev = new SearchResultEvent( SearchResultEvent::RandomChat );
     unsigned int reqid = NextRequestID();
-    m_reqidcache->insert( reqid, new SearchCacheValue( ev ) );
+    ev->setRequestHandle( TrackRequest( reqid, new SearchCacheValue( ev ), new RequestHandle(RequestHandle::Search) ) );
     
     SrvRequestRandomChat ssnac( m_self->getUIN(), group );
     ssnac.setRequestID( reqid );
@@ -3208,6 +4514,53 @@ namespace ICQ2000
     return m_out_dc;
   }
   
+  /**
+   *  set the maximum number of direct connections kept open. When a
+   *  new connection would go over this the least recently used idle
+   *  one is closed. Connections with messages pending are never
+   *  closed, so the limit can be exceeded if all are busy.
+   *
+   * @param n maximum open direct connections, 0 for no limit
+   */
+  void Client::setMaxDirectConnections(unsigned int n)
+  {
+    m_dccache->setMaxOpen(n);
+  }
+
+  /**
+   *  get the maximum number of direct connections kept open
+   *
+   * @return maximum open direct connections, 0 for no limit
+   */
+  unsigned int Client::getMaxDirectConnections() const
+  {
+    return m_dccache->getMaxOpen();
+  }
+
+  /**
+   *  get the number of direct connections open
+   */
+  unsigned int Client::getDirectConnectionCount() const
+  {
+    return m_dccache->size();
+  }
+
+  /**
+   *  get counters for direct connection lookups. The hit rate is
+   *  reuses / lookups.
+   *
+   * @param lookups times a connection to a contact was looked for
+   * @param reuses times an open connection was found
+   * @param evictions idle connections closed to keep under the limit
+   */
+  void Client::getDirectConnectionStats(unsigned int& lookups, unsigned int& reuses,
+					unsigned int& evictions) const
+  {
+    lookups = m_dccache->getLookups();
+    reuses = m_dccache->getReuses();
+    evictions = m_dccache->getEvictions();
+  }
+
   /** 
    *  set the upper bound of the portrange for incoming connections (esp. behind a firewall)
    *  you have to restart the TCPServer(s) for this to take effect
@@ -27,6 +27,7 @@
 
 #include "userinfoconstants.h"
 #include "Capabilities.h"
+#include "PresenceTable.h"
 
 #include "events.h"
 
@@ -36,6 +37,16 @@ using std::istringstream;
 
 namespace ICQ2000 {
 
+  struct Contact::DetailInfo
+  {
+    HomepageInfo homepage;
+    EmailInfo email;
+    WorkInfo work;
+    PersonalInterestInfo interests;
+    BackgroundInfo background;
+    std::string about;
+  };
+
   /**
    *  Do not use this constructor outside the library.
    *  It constructs a contact that is virtual, but doesn't have
@@ -43,14 +54,14 @@ namespace ICQ2000 {
    */
   Contact::Contact()
     : count(0), m_virtualcontact(true), m_uin(nextImaginaryUIN()), m_status(STATUS_OFFLINE), 
-      m_invisible(false), m_seqnum(0xffff)
+      m_invisible(false), m_capabilities(NULL), m_seqnum(0xffff), m_details(NULL)
   {
     Init();
   }
 
   Contact::Contact(unsigned int uin)
     : count(0), m_virtualcontact(false), m_uin(uin), m_status(STATUS_OFFLINE), 
-      m_invisible(false), m_capabilities( new Capabilities() ), m_seqnum(0xffff)
+      m_invisible(false), m_capabilities(NULL), m_seqnum(0xffff), m_details(NULL)
   {
     m_main_home_info.alias = UINtoString(m_uin);
     Init();
@@ -58,8 +69,8 @@ namespace ICQ2000 {
 
   Contact::Contact(const string& a)
     : count(0), m_virtualcontact(true), m_uin(nextImaginaryUIN()),
-      m_status(STATUS_OFFLINE), m_invisible(false), m_capabilities( new Capabilities() ),
-      m_seqnum(0xffff)
+      m_status(STATUS_OFFLINE), m_invisible(false), m_capabilities(NULL),
+      m_seqnum(0xffff), m_details(NULL)
   {
     m_main_home_info.alias = a;
     Init();
@@ -67,7 +78,9 @@ namespace ICQ2000 {
 
   Contact::~Contact()
   {
+    while (m_presence != NULL) m_presence->remove(this);
     delete m_capabilities;
+    delete m_details;
   }
 
   void Contact::Init()
@@ -89,14 +102,21 @@ namespace ICQ2000 {
     m_tag_id = 0;
     m_server_based = false;
     m_authreq = false;
+    m_dirty = 0;
+    m_update_depth = 0;
+    m_presence = NULL;
+    m_presence_row = 0;
+    m_presence_more = NULL;
   }
 
   unsigned int Contact::getUIN() const { return m_uin; }
 
   void Contact::setUIN(unsigned int uin) {
+    if (m_uin == uin && !m_virtualcontact) return;
     m_uin = uin;
     m_virtualcontact = false;
-    userinfo_change_emit();
+    presence_changed();
+    field_changed(Field_UIN);
   }
 
   string Contact::getStringUIN() const { return UINtoString(m_uin); }
@@ -146,15 +166,21 @@ namespace ICQ2000 {
   bool Contact::getDirect() const { return (m_direct && m_status != STATUS_OFFLINE); }
 
   void Contact::setDirect(bool b) {
+    if (m_direct == b) return;
     m_direct = b;
-    userinfo_change_emit(true);
+    field_changed(Field_Direct);
   }
 
   bool Contact::get_accept_adv_msgs() const {
-    return (m_status != STATUS_OFFLINE && m_capabilities->get_accept_adv_msgs());
+    return (m_status != STATUS_OFFLINE && m_capabilities != NULL
+	    && m_capabilities->get_accept_adv_msgs());
   }
 
-  Capabilities Contact::get_capabilities() const { return * m_capabilities; }
+  Capabilities Contact::get_capabilities() const
+  {
+    if (m_capabilities == NULL) return Capabilities();
+    return * m_capabilities;
+  }
 
   unsigned int Contact::get_signon_time() const { return m_signon_time; }
 
@@ -182,28 +208,33 @@ namespace ICQ2000 {
   bool Contact::getServerBased() const { return m_server_based; }
 
   void Contact::setMobileNo(const string& mn) {
+    if (m_main_home_info.getMobileNo() == mn) return;
     m_main_home_info.setMobileNo(mn);
-    userinfo_change_emit();
+    field_changed(Field_MobileNo);
   }
 
   void Contact::setAlias(const string& al) {
+    if (m_main_home_info.alias == al) return;
     m_main_home_info.alias = al;
-    userinfo_change_emit();
+    field_changed(Field_Alias);
   }
 
   void Contact::setFirstName(const string& fn) {
+    if (m_main_home_info.firstname == fn) return;
     m_main_home_info.firstname = fn;
-    userinfo_change_emit();
+    field_changed(Field_FirstName);
   }
 
   void Contact::setLastName(const string& ln) {
+    if (m_main_home_info.lastname == ln) return;
     m_main_home_info.lastname = ln;
-    userinfo_change_emit();
+    field_changed(Field_LastName);
   }
 
   void Contact::setEmail(const string& em) {
+    if (m_main_home_info.email == em) return;
     m_main_home_info.email = em;
-    userinfo_change_emit();
+    field_changed(Field_Email);
   }
 
   void Contact::setStatus(Status st) {
@@ -211,6 +242,14 @@ namespace ICQ2000 {
   }
 
   void Contact::setStatus(Status st, bool i) {
+    setStatus(st, i, true);
+  }
+
+  /**
+   *  set the status, optionally without signalling the change. Client
+   *  uses this when batching up presence changes.
+   */
+  void Contact::setStatus(Status st, bool i, bool emit_signal) {
     if (m_status == st && m_invisible == i) return;
     
     StatusChangeEvent sev(this, st, m_status);
@@ -228,11 +267,24 @@ namespace ICQ2000 {
       m_ext_port = 0;
       m_lan_port = 0;
       m_tcp_version = 0;
-      m_capabilities->clear();
+      delete m_capabilities;
+      m_capabilities = NULL;
       m_last_online_time = time(NULL);
     }
 
-    status_change_signal.emit( &sev );
+    presence_changed();
+
+    if (emit_signal) status_change_signal.emit( &sev );
+  }
+
+  // copy the presence into the contact's row in each tree it is in
+  void Contact::presence_changed()
+  {
+    if (m_presence == NULL) return;
+    m_presence->update(this);
+    if (m_presence_more == NULL) return;
+    for (unsigned int n = 0; n < m_presence_more->size(); ++n)
+      (*m_presence_more)[n].first->update(this);
   }
 
   void Contact::userinfo_change_emit()
@@ -242,27 +294,83 @@ namespace ICQ2000 {
 
   void Contact::userinfo_change_emit(bool is_transient_detail)
   {
-    UserInfoChangeEvent ev(this, is_transient_detail);
+    field_changed(is_transient_detail ? Field_Transient : Field_All);
+  }
+
+  /**
+   *  Record that some fields have changed. Outside of an update
+   *  transaction this signals straight away, inside one the fields are
+   *  accumulated and signalled once when the outermost transaction ends.
+   *
+   * @param fields bitmask of Contact::Field values
+   */
+  void Contact::field_changed(unsigned int fields)
+  {
+    if (m_update_depth > 0) {
+      m_dirty |= fields;
+      return;
+    }
+
+    UserInfoChangeEvent ev(this, (fields & ~Field_Transient) == 0, fields);
     userinfo_change_signal.emit(&ev);
   }
 
+  /**
+   *  Start coalescing changes. Must be paired with end_update(),
+   *  prefer the scoped Contact::UpdateTransaction.
+   */
+  void Contact::begin_update()
+  {
+    ++m_update_depth;
+  }
+
+  /**
+   *  End an update started with begin_update(). When the outermost
+   *  update ends a single UserInfoChangeEvent is signalled for everything
+   *  that changed, if anything did.
+   */
+  void Contact::end_update()
+  {
+    if (m_update_depth == 0 || --m_update_depth > 0) return;
+
+    unsigned int fields = m_dirty;
+    m_dirty = 0;
+    if (fields != 0) field_changed(fields);
+  }
+
+  bool Contact::in_update() const { return m_update_depth > 0; }
+
+  Contact::UpdateTransaction::UpdateTransaction(const ContactRef& c)
+    : m_contact(c)
+  {
+    m_contact->begin_update();
+  }
+
+  Contact::UpdateTransaction::~UpdateTransaction()
+  {
+    m_contact->end_update();
+  }
+
   void Contact::setInvisible(bool inv) {
     setStatus(m_status, inv);
   }
 
   void Contact::setAuthReq(bool b) {
+    if (m_authreq == b) return;
     m_authreq = b;
-    userinfo_change_emit(true);
+    field_changed(Field_Auth);
   }
 
   void Contact::setAuthAwait(bool b) {
+    if (m_authawait == b) return;
     m_authawait = b;
-    userinfo_change_emit(true);
+    field_changed(Field_Auth);
   }
 
   void Contact::setServerBased(bool b) {
+    if (m_server_based == b) return;
     m_server_based = b;
-    userinfo_change_emit(true);
+    field_changed(Field_ServerBased);
   }
 
   bool Contact::isICQContact() const { return !m_virtualcontact; }
@@ -276,40 +384,47 @@ namespace ICQ2000 {
   }
 
   void Contact::setExtIP(unsigned int ip) { 
+    if (m_ext_ip == ip) return;
     m_ext_ip = ip;
-    userinfo_change_emit(true);
+    field_changed(Field_Network);
   }
 
   void Contact::setLanIP(unsigned int ip) {
+    if (m_lan_ip == ip) return;
     m_lan_ip = ip;
-    userinfo_change_emit(true);
+    field_changed(Field_Network);
   }
 
   void Contact::setExtPort(unsigned short port) {
+    if (m_ext_port == port) return;
     m_ext_port = port;
-    userinfo_change_emit(true);
+    field_changed(Field_Network);
   }
 
   void Contact::setLanPort(unsigned short port) {
+    if (m_lan_port == port) return;
     m_lan_port = port;
-    userinfo_change_emit(true);
+    field_changed(Field_Network);
   }
 
   void Contact::setTCPVersion(unsigned char v) {
+    if (m_tcp_version == v) return;
     m_tcp_version = v;
-    userinfo_change_emit(true);
+    field_changed(Field_Network);
   }
 
   void Contact::setDCCookie(unsigned int cookie) {
+    if (m_dc_cookie == cookie) return;
     m_dc_cookie = cookie;
-    userinfo_change_emit(true);
+    field_changed(Field_Network);
   }
 
   void Contact::setServerSideInfo(unsigned short group_id, unsigned short tag_id)
   {
+    if (m_group_id == group_id && m_tag_id == tag_id) return;
     m_group_id = group_id;
     m_tag_id = tag_id;
-    userinfo_change_emit(true);
+    field_changed(Field_ServerBased);
   }
 
   unsigned short Contact::getServerSideGroupID() const {
@@ -331,87 +446,152 @@ namespace ICQ2000 {
 
   void Contact::set_capabilities(const Capabilities& c)
   {
-    (*m_capabilities) = c;
+    if (get_capabilities() == c) return;
+    if (m_capabilities == NULL) m_capabilities = new Capabilities(c);
+    else (*m_capabilities) = c;
+    field_changed(Field_Capabilities);
   }
 
   void Contact::set_signon_time(unsigned int t)
   {
+    if (m_signon_time == t) return;
     m_signon_time = t;
-    userinfo_change_emit(true);
+    field_changed(Field_Times);
   }
 
   void Contact::set_last_online_time(unsigned int t)
   {
+    if (m_last_online_time == t) return;
     m_last_online_time = t;
-    userinfo_change_emit(true);
+    field_changed(Field_Times);
   }
 
   void Contact::set_last_status_change_time(unsigned int t)
   {
+    if (m_last_status_change_time == t) return;
     m_last_status_change_time = t;
-    userinfo_change_emit(true);
+    presence_changed();
+    field_changed(Field_Times);
   }
 
   void Contact::set_last_message_time(unsigned int t)
   {
+    if (m_last_message_time == t) return;
     m_last_message_time = t;
-    userinfo_change_emit(true);
+    field_changed(Field_Times);
   }
 
   void Contact::set_last_away_msg_check_time(unsigned int t)
   {
+    if (m_last_away_msg_check_time == t) return;
     m_last_away_msg_check_time = t;
-    userinfo_change_emit(true);
+    field_changed(Field_Times);
   }
 
   void Contact::setMainHomeInfo(const MainHomeInfo& s) {
     m_main_home_info = s;
-    userinfo_change_emit();
+    field_changed(Field_MainHome);
   }
 
   void Contact::setHomepageInfo(const HomepageInfo& s) {
-    m_homepage_info = s;
-    userinfo_change_emit();
+    details().homepage = s;
+    field_changed(Field_Homepage);
   }
 
   void Contact::setEmailInfo(const EmailInfo& s) {
-    m_email_info = s;
-    userinfo_change_emit();
+    details().email = s;
+    field_changed(Field_EmailInfo);
   }
 
   void Contact::setWorkInfo(const WorkInfo& s) {
-    m_work_info = s;
-    userinfo_change_emit();
+    details().work = s;
+    field_changed(Field_Work);
   }
 
   void Contact::setInterestInfo(const PersonalInterestInfo& s) {
-    m_personal_interest_info = s;
-    userinfo_change_emit();
+    details().interests = s;
+    field_changed(Field_Interests);
   }
 
   void Contact::setBackgroundInfo(const BackgroundInfo& b) {
-    m_background_info = b;
-    userinfo_change_emit();
+    details().background = b;
+    field_changed(Field_Background);
   }
 
   void Contact::setAboutInfo(const string& about) {
-    m_about = about;
-    userinfo_change_emit();
+    details().about = about;
+    field_changed(Field_About);
+  }
+
+  /*
+   * The detailed fields, allocated the first time they're wanted
+   * for writing.
+   */
+  Contact::DetailInfo& Contact::details()
+  {
+    if (m_details == NULL) m_details = new DetailInfo();
+    return *m_details;
+  }
+
+  /*
+   * The detailed fields for reading - the defaults, for a contact
+   * that hasn't any.
+   */
+  const Contact::DetailInfo& Contact::details() const
+  {
+    static const DetailInfo none;
+    return (m_details == NULL ? none : *m_details);
+  }
+
+  /**
+   *  whether the contact has any of the detailed fields (homepage,
+   *  email, work, interests, background, about), as fetched by
+   *  Client::fetchDetailContactInfo
+   */
+  bool Contact::hasDetailInfo() const { return (m_details != NULL); }
+
+  /**
+   *  drop the detailed fields, to free up the memory they take
+   */
+  void Contact::clearDetailInfo()
+  {
+    if (m_details == NULL) return;
+    delete m_details;
+    m_details = NULL;
+    field_changed(Field_Homepage | Field_EmailInfo | Field_Work
+		  | Field_Interests | Field_Background | Field_About);
   }
 
   Contact::MainHomeInfo& Contact::getMainHomeInfo() { return m_main_home_info; }
 
-  Contact::HomepageInfo& Contact::getHomepageInfo() { return m_homepage_info; }
+  /**
+   *  The non-const get*Info methods for the detailed fields give them
+   *  to be written to, so make room for them if the contact has none
+   *  yet. Prefer the const versions for reading.
+   */
+  Contact::HomepageInfo& Contact::getHomepageInfo() { return details().homepage; }
+
+  Contact::WorkInfo& Contact::getWorkInfo() { return details().work; }
+
+  Contact::PersonalInterestInfo& Contact::getPersonalInterestInfo() { return details().interests; }
+
+  Contact::BackgroundInfo& Contact::getBackgroundInfo() { return details().background; }
+
+  Contact::EmailInfo& Contact::getEmailInfo() { return details().email; }
+
+  const string& Contact::getAboutInfo() const { return details().about; }
+
+  const Contact::MainHomeInfo& Contact::getMainHomeInfo() const { return m_main_home_info; }
 
-  Contact::WorkInfo& Contact::getWorkInfo() { return m_work_info; }
+  const Contact::HomepageInfo& Contact::getHomepageInfo() const { return details().homepage; }
 
-  Contact::PersonalInterestInfo& Contact::getPersonalInterestInfo() { return m_personal_interest_info; }
+  const Contact::WorkInfo& Contact::getWorkInfo() const { return details().work; }
 
-  Contact::BackgroundInfo& Contact::getBackgroundInfo() { return m_background_info; }
+  const Contact::PersonalInterestInfo& Contact::getPersonalInterestInfo() const { return details().interests; }
 
-  Contact::EmailInfo& Contact::getEmailInfo() { return m_email_info; }
+  const Contact::BackgroundInfo& Contact::getBackgroundInfo() const { return details().background; }
 
-  const string& Contact::getAboutInfo() const { return m_about; }
+  const Contact::EmailInfo& Contact::getEmailInfo() const { return details().email; }
 
   unsigned short Contact::nextSeqNum() {
     return --m_seqnum;
@@ -590,7 +770,8 @@ namespace ICQ2000 {
   bool Contact::getBirthday() const { return m_bday; }
 
   void Contact::setBirthday(bool b) {
+    if (m_bday == b) return;
     m_bday = b;
-    userinfo_change_emit(true);
+    field_changed(Field_Birthday);
   }
 }
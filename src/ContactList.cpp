@@ -81,6 +81,10 @@ namespace ICQ2000 {
     }
   }
 
+  void ContactList::clear() {
+    m_cmap.clear();
+  }
+
   bool ContactList::empty() const {
     return m_cmap.empty();
   }
@@ -0,0 +1,496 @@
+/*
+ * ContactSnapshot - on-disk cache of a ContactTree
+ *
+ * Copyright (C) 2001 Barnaby Gray <barnaby@beedesign.co.uk>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#include "ContactSnapshot.h"
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <vector>
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+
+#include "buffer.h"
+#include "exceptions.h"
+
+using std::string;
+using std::vector;
+
+namespace ICQ2000 {
+
+  namespace {
+
+    const unsigned char Magic[4] = { 'I', 'C', 'T', 'S' };
+
+    const unsigned int Header_Size  = 32;
+    const unsigned int Group_Size   = 8;
+    const unsigned int Contact_Size = 16;
+
+    const unsigned short Flag_Virtual     = 0x0001;
+    const unsigned short Flag_AuthReq     = 0x0002;
+    const unsigned short Flag_AuthAwait   = 0x0004;
+    const unsigned short Flag_ServerBased = 0x0008;
+    const unsigned short Flag_Details     = 0x0010;
+
+    bool uin_less(const ContactRef& a, const ContactRef& b)
+    {
+      return a->getUIN() < b->getUIN();
+    }
+
+    struct ContactEntry {
+      ContactRef contact;
+      unsigned short group_id;
+    };
+
+    bool entry_less(const ContactEntry& a, const ContactEntry& b)
+    {
+      return uin_less(a.contact, b.contact);
+    }
+
+    /*
+     * bounds-checked little-endian reader over the (possibly mapped)
+     * snapshot image
+     */
+    class Reader
+    {
+     private:
+      const unsigned char *m_data;
+      unsigned int m_size, m_pos;
+
+      void need(unsigned int n) const
+      {
+	if (m_pos + n > m_size || m_pos + n < m_pos)
+	  throw ParseException("Contact snapshot truncated");
+      }
+
+     public:
+      Reader(const unsigned char *d, unsigned int size, unsigned int pos = 0)
+	: m_data(d), m_size(size), m_pos(pos) { }
+
+      unsigned char u8()
+      {
+	need(1);
+	return m_data[m_pos++];
+      }
+
+      unsigned short u16()
+      {
+	need(2);
+	unsigned short r = m_data[m_pos] | (m_data[m_pos+1] << 8);
+	m_pos += 2;
+	return r;
+      }
+
+      unsigned int u32()
+      {
+	need(4);
+	unsigned int r = m_data[m_pos] | (m_data[m_pos+1] << 8)
+	  | (m_data[m_pos+2] << 16) | (m_data[m_pos+3] << 24);
+	m_pos += 4;
+	return r;
+      }
+
+      string str()
+      {
+	unsigned short len = u16();
+	need(len);
+	string s( (const char*)m_data + m_pos, len );
+	m_pos += len;
+	return s;
+      }
+    };
+
+    void write_details(Buffer& b, const Contact& c)
+    {
+      const Contact::MainHomeInfo& mhi = c.getMainHomeInfo();
+      b << mhi.alias
+	<< mhi.firstname
+	<< mhi.lastname
+	<< mhi.email
+	<< mhi.city
+	<< mhi.state
+	<< mhi.phone
+	<< mhi.fax
+	<< mhi.street
+	<< mhi.zip
+	<< mhi.getMobileNo()
+	<< (unsigned short)mhi.country
+	<< (unsigned short)(short)mhi.timezone;
+
+      if (!c.hasDetailInfo()) return;
+
+      const Contact::HomepageInfo& hpi = c.getHomepageInfo();
+      b << hpi.age
+	<< (unsigned char)hpi.sex
+	<< (unsigned char)hpi.lang1
+	<< (unsigned char)hpi.lang2
+	<< (unsigned char)hpi.lang3
+	<< hpi.homepage
+	<< hpi.birth_year
+	<< hpi.birth_month
+	<< hpi.birth_day;
+
+      const Contact::EmailInfo& ei = c.getEmailInfo();
+      b << (unsigned short)ei.emails.size();
+      Contact::EmailInfo::EmailList::const_iterator ecurr = ei.emails.begin();
+      while (ecurr != ei.emails.end()) {
+	b << (*ecurr);
+	++ecurr;
+      }
+
+      const Contact::WorkInfo& wi = c.getWorkInfo();
+      b << wi.city
+	<< wi.state
+	<< wi.street
+	<< wi.zip
+	<< wi.country
+	<< wi.company_name
+	<< wi.company_dept
+	<< wi.company_position
+	<< wi.company_web;
+
+      const Contact::PersonalInterestInfo& pi = c.getPersonalInterestInfo();
+      b << (unsigned short)pi.interests.size();
+      Contact::PersonalInterestInfo::InterestList::const_iterator icurr = pi.interests.begin();
+      while (icurr != pi.interests.end()) {
+	b << (*icurr).first << (*icurr).second;
+	++icurr;
+      }
+
+      const Contact::BackgroundInfo& bi = c.getBackgroundInfo();
+      b << (unsigned short)bi.schools.size();
+      Contact::BackgroundInfo::SchoolList::const_iterator scurr = bi.schools.begin();
+      while (scurr != bi.schools.end()) {
+	b << (*scurr).first << (*scurr).second;
+	++scurr;
+      }
+
+      b << c.getAboutInfo();
+    }
+
+    void read_details(Reader& r, Contact& c, bool details)
+    {
+      Contact::MainHomeInfo mhi;
+      mhi.alias = r.str();
+      mhi.firstname = r.str();
+      mhi.lastname = r.str();
+      mhi.email = r.str();
+      mhi.city = r.str();
+      mhi.state = r.str();
+      mhi.phone = r.str();
+      mhi.fax = r.str();
+      mhi.street = r.str();
+      mhi.zip = r.str();
+      mhi.setMobileNo( r.str() );
+      mhi.country = (Country)r.u16();
+      mhi.timezone = (Timezone)(short)r.u16();
+      c.setMainHomeInfo(mhi);
+
+      if (!details) return;
+
+      Contact::HomepageInfo& hpi = c.getHomepageInfo();
+      hpi.age = r.u8();
+      hpi.sex = (Sex)r.u8();
+      hpi.lang1 = (Language)r.u8();
+      hpi.lang2 = (Language)r.u8();
+      hpi.lang3 = (Language)r.u8();
+      hpi.homepage = r.str();
+      hpi.birth_year = r.u16();
+      hpi.birth_month = r.u8();
+      hpi.birth_day = r.u8();
+
+      Contact::EmailInfo& ei = c.getEmailInfo();
+      ei.emails.clear();
+      unsigned short n = r.u16();
+      while (n--) ei.addEmailAddress( r.str() );
+
+      Contact::WorkInfo wi;
+      wi.city = r.str();
+      wi.state = r.str();
+      wi.street = r.str();
+      wi.zip = r.str();
+      wi.country = r.u16();
+      wi.company_name = r.str();
+      wi.company_dept = r.str();
+      wi.company_position = r.str();
+      wi.company_web = r.str();
+      c.setWorkInfo(wi);
+
+      Contact::PersonalInterestInfo& pi = c.getPersonalInterestInfo();
+      pi.interests.clear();
+      n = r.u16();
+      while (n--) {
+	unsigned short cat = r.u16();
+	pi.addInterest( cat, r.str() );
+      }
+
+      Contact::BackgroundInfo& bi = c.getBackgroundInfo();
+      bi.schools.clear();
+      n = r.u16();
+      while (n--) {
+	unsigned short cat = r.u16();
+	bi.addSchool( cat, r.str() );
+      }
+
+      c.setAboutInfo( r.str() );
+    }
+
+    void parse(const unsigned char *d, unsigned int size, ContactTree& tree,
+	       unsigned int& sbl_timestamp, unsigned short& sbl_count)
+    {
+      Reader r(d, size);
+
+      for (unsigned int i = 0; i < sizeof(Magic); ++i)
+	if (r.u8() != Magic[i]) throw ParseException("Not a contact snapshot");
+
+      if (r.u16() != ContactSnapshot::Version) throw ParseException("Contact snapshot version mismatch");
+      if (r.u16() != Header_Size) throw ParseException("Contact snapshot header size mismatch");
+
+      unsigned int timestamp = r.u32();
+      unsigned short count = r.u16();
+      unsigned short n_groups = r.u16();
+      unsigned int n_contacts = r.u32();
+      unsigned int groups_off = r.u32();
+      unsigned int contacts_off = r.u32();
+
+      // groups first, so contacts can find theirs
+      Reader gr(d, size, groups_off);
+      for (unsigned short i = 0; i < n_groups; ++i) {
+	unsigned short id = gr.u16();
+	gr.u16(); // padding
+	Reader sr(d, size, gr.u32());
+	string label = sr.str();
+	if (tree.exists_group(id)) tree.lookup_group(id).set_label(label);
+	else tree.add_group(label, id);
+      }
+
+      Reader cr(d, size, contacts_off);
+      for (unsigned int i = 0; i < n_contacts; ++i) {
+	unsigned int uin = cr.u32();
+	unsigned short group_id = cr.u16();
+	unsigned short tag_id = cr.u16();
+	unsigned short flags = cr.u16();
+	cr.u16(); // padding
+	Reader dr(d, size, cr.u32());
+
+	// lookup_group would make up a group for an id it doesn't know
+	if (!tree.exists_group(group_id)) throw ParseException("Contact snapshot contact in unknown group");
+
+	ContactRef c;
+	if (flags & Flag_Virtual) c = ContactRef(new Contact(string()));
+	else c = ContactRef(new Contact(uin));
+
+	read_details(dr, *c, flags & Flag_Details);
+	c->setServerSideInfo(group_id, tag_id);
+	c->setAuthReq( flags & Flag_AuthReq );
+	c->setAuthAwait( flags & Flag_AuthAwait );
+	c->setServerBased( flags & Flag_ServerBased );
+
+	tree.lookup_group(group_id).add(c);
+      }
+
+      sbl_timestamp = timestamp;
+      sbl_count = count;
+    }
+  }
+
+  /**
+   *  Write a snapshot of the tree to a file. The file is written to a
+   *  temporary name and renamed into place, so a crash never leaves a
+   *  half-written snapshot behind.
+   *
+   * @param filename where to write
+   * @param tree the tree to snapshot
+   * @param sbl_timestamp last modification time of the server-based list
+   * @param sbl_count number of items on the server-based list
+   * @return whether the snapshot was written
+   */
+  bool ContactSnapshot::save(const string& filename, ContactTree& tree,
+			     unsigned int sbl_timestamp, unsigned short sbl_count)
+  {
+    vector<ContactEntry> entries;
+    vector<ContactTree::Group*> groups;
+
+    ContactTree::iterator curr = tree.begin();
+    while (curr != tree.end()) {
+      groups.push_back( &(*curr) );
+      ContactTree::Group::iterator gcurr = (*curr).begin();
+      while (gcurr != (*curr).end()) {
+	ContactEntry e;
+	e.contact = (*gcurr);
+	e.group_id = (*curr).get_id();
+	entries.push_back(e);
+	++gcurr;
+      }
+      ++curr;
+    }
+
+    std::sort( entries.begin(), entries.end(), entry_less );
+
+    const unsigned int groups_off = Header_Size;
+    const unsigned int contacts_off = groups_off + groups.size() * Group_Size;
+    const unsigned int data_off = contacts_off + entries.size() * Contact_Size;
+
+    Buffer index, data;
+    index.setLittleEndian();
+    data.setLittleEndian();
+
+    index.Pack( Magic, sizeof(Magic) );
+    index << Version
+	  << (unsigned short)Header_Size
+	  << sbl_timestamp
+	  << sbl_count
+	  << (unsigned short)groups.size()
+	  << (unsigned int)entries.size()
+	  << groups_off
+	  << contacts_off
+	  << data_off;
+
+    vector<ContactTree::Group*>::const_iterator gcurr = groups.begin();
+    while (gcurr != groups.end()) {
+      index << (*gcurr)->get_id()
+	    << (unsigned short)0x0000
+	    << (unsigned int)(data_off + data.size());
+      data << (*gcurr)->get_label();
+      ++gcurr;
+    }
+
+    vector<ContactEntry>::const_iterator ecurr = entries.begin();
+    while (ecurr != entries.end()) {
+      ContactRef c = (*ecurr).contact;
+
+      unsigned short flags = 0;
+      if (c->isVirtualContact()) flags |= Flag_Virtual;
+      if (c->getAuthReq()) flags |= Flag_AuthReq;
+      if (c->getAuthAwait()) flags |= Flag_AuthAwait;
+      if (c->getServerBased()) flags |= Flag_ServerBased;
+      if (c->hasDetailInfo()) flags |= Flag_Details;
+
+      index << c->getUIN()
+	    << (*ecurr).group_id
+	    << c->getServerSideID()
+	    << flags
+	    << (unsigned short)0x0000
+	    << (unsigned int)(data_off + data.size());
+      write_details(data, *c);
+      ++ecurr;
+    }
+
+    string tmpname = filename + ".tmp";
+    FILE *f = fopen( tmpname.c_str(), "wb" );
+    if (f == NULL) return false;
+
+    bool ok = (fwrite( &index[0], 1, index.size(), f ) == index.size());
+    if (ok && data.size() > 0)
+      ok = (fwrite( &data[0], 1, data.size(), f ) == data.size());
+    if (fclose(f) != 0) ok = false;
+
+    if (!ok || rename( tmpname.c_str(), filename.c_str() ) != 0) {
+      unlink( tmpname.c_str() );
+      return false;
+    }
+
+    return true;
+  }
+
+  /**
+   *  Load a snapshot into a tree. Groups that already exist (by id)
+   *  are reused. Nothing is added to the tree if the file is missing,
+   *  the wrong version or corrupt.
+   *
+   * @param filename the snapshot file
+   * @param tree the tree to load into
+   * @param sbl_timestamp set to the stored server-based list timestamp
+   * @param sbl_count set to the stored server-based list item count
+   * @return whether the snapshot was loaded
+   */
+  bool ContactSnapshot::load(const string& filename, ContactTree& tree,
+			     unsigned int& sbl_timestamp, unsigned short& sbl_count)
+  {
+    int fd = open( filename.c_str(), O_RDONLY );
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)Header_Size) {
+      close(fd);
+      return false;
+    }
+    unsigned int size = st.st_size;
+
+    // parse into a scratch tree, so a corrupt file can't leave a half loaded one
+    ContactTree scratch;
+    bool ok = true;
+
+#ifdef HAVE_MMAP
+    void *m = mmap( NULL, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close(fd);
+    if (m == MAP_FAILED) return false;
+
+    try {
+      parse( (const unsigned char*)m, size, scratch, sbl_timestamp, sbl_count );
+    } catch(ParseException& e) {
+      ok = false;
+    }
+    munmap( m, size );
+#else
+    vector<unsigned char> image(size);
+    ok = (read( fd, &image[0], size ) == (ssize_t)size);
+    close(fd);
+
+    if (ok) {
+      try {
+	parse( &image[0], size, scratch, sbl_timestamp, sbl_count );
+      } catch(ParseException& e) {
+	ok = false;
+      }
+    }
+#endif
+
+    if (!ok) return false;
+
+    ContactTree::iterator curr = scratch.begin();
+    while (curr != scratch.end()) {
+      ContactTree::Group& gp = tree.exists_group( (*curr).get_id() )
+	? tree.lookup_group( (*curr).get_id() )
+	: tree.add_group( (*curr).get_label(), (*curr).get_id() );
+
+      ContactTree::Group::iterator gcurr = (*curr).begin();
+      while (gcurr != (*curr).end()) {
+	if (!tree.exists( (*gcurr)->getUIN() )) gp.add( *gcurr );
+	++gcurr;
+      }
+      ++curr;
+    }
+
+    return true;
+  }
+
+}
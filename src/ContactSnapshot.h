@@ -0,0 +1,68 @@
+/*
+ * ContactSnapshot - on-disk cache of a ContactTree
+ *
+ * Copyright (C) 2001 Barnaby Gray <barnaby@beedesign.co.uk>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#ifndef CONTACTSNAPSHOT_H
+#define CONTACTSNAPSHOT_H
+
+#include <string>
+
+#include "ContactTree.h"
+
+namespace ICQ2000 {
+
+  /*
+   * Binary snapshot of a ContactTree, so a client can come up with
+   * its whole contact list (groups, server-side ids and the cached
+   * detailed user info) without going to the server for it.
+   *
+   * The file is all little-endian, fixed offsets:
+   *
+   *   header    32 bytes   magic, version, SBL timestamp/count,
+   *                        counts and offsets of the sections below
+   *   groups    8 bytes    per group: id, label offset
+   *   contacts  16 bytes   per contact, sorted by UIN: uin, group id,
+   *                        tag id, flags, details offset
+   *   data                 length-prefixed strings and detail blobs -
+   *                        the main details, then the rest only for
+   *                        contacts flagged as having them
+   *
+   * The fixed size records mean the file can be mapped and read in
+   * place - nothing needs parsing before the index can be walked.
+   *
+   * The SBL timestamp and item count stored with the snapshot are
+   * those of the server-based list it was last reconciled with, so
+   * the server can be asked whether anything changed since.
+   */
+  class ContactSnapshot
+  {
+   public:
+    static const unsigned short Version = 2;
+
+    static bool save(const std::string& filename, ContactTree& tree,
+		     unsigned int sbl_timestamp, unsigned short sbl_count);
+
+    static bool load(const std::string& filename, ContactTree& tree,
+		     unsigned int& sbl_timestamp, unsigned short& sbl_count);
+  };
+
+}
+
+#endif
@@ -55,15 +55,16 @@ namespace ICQ2000 {
   // ============================================================================
 
   _ContactTree_Group::_ContactTree_Group(const std::string& l, unsigned short id)
-    : m_id(id), m_label(l)
+    : m_id(id), m_label(l), m_presence(NULL)
   { }
   
   _ContactTree_Group::_ContactTree_Group()
-    : m_id(0), m_label("")
+    : m_id(0), m_label(""), m_presence(NULL)
   { }
   
+  // a copy isn't in any tree's presence table until the tree says
   _ContactTree_Group::_ContactTree_Group(const _ContactTree_Group& gp)
-    : m_crefs( gp.m_crefs ), m_id( gp.m_id ), m_label( gp.m_label )
+    : m_crefs( gp.m_crefs ), m_id( gp.m_id ), m_label( gp.m_label ), m_presence(NULL)
   { }
   
   unsigned short _ContactTree_Group::get_id() const
@@ -115,6 +116,7 @@ namespace ICQ2000 {
 
   ContactRef _ContactTree_Group::add(ContactRef ct) {
     m_crefs.insert( std::make_pair(ct->getUIN(), ct) );
+    if (m_presence != NULL) m_presence->add(ct.get(), m_id);
 
     // fire off signal
     UserAddedEvent uev( ct, *this );
@@ -134,6 +136,7 @@ namespace ICQ2000 {
 
   void _ContactTree_Group::relocate_to(ContactRef ct) {
     m_crefs.insert( std::make_pair(ct->getUIN(), ct) );
+    if (m_presence != NULL) m_presence->add(ct.get(), m_id);
   }
 
   void _ContactTree_Group::remove(unsigned int uin) {
@@ -142,6 +145,7 @@ namespace ICQ2000 {
       UserRemovedEvent uev( m_crefs[uin], *this );
       contactlist_signal.emit( &uev );
 
+      if (m_presence != NULL) m_presence->remove(m_crefs[uin].get());
       m_crefs.erase(uin);
     }
   }
@@ -201,11 +205,49 @@ namespace ICQ2000 {
   //  ContactTree
   // ============================================================================
 
-  ContactTree::ContactTree() { }
+  ContactTree::ContactTree()
+    : m_update_depth(0)
+  { }
   
+  /*
+   * The copy has a presence table of its own, the contacts then have
+   * a row in both this and the original's.
+   */
   ContactTree::ContactTree(const ContactTree& ct)
-    : m_groups( ct.m_groups ) 
-  { }
+    : m_groups( ct.m_groups ), m_update_depth(0)
+  {
+    track_presence();
+  }
+
+  /*
+   * Assigned groups are copied as the copy constructor does, rather
+   * than assigned, so they don't take on the other tree's signal
+   * connections.
+   */
+  ContactTree& ContactTree::operator=(const ContactTree& ct)
+  {
+    if (this == &ct) return *this;
+
+    m_presence.clear();
+    m_groups.clear();
+    m_groups.insert( m_groups.end(), ct.m_groups.begin(), ct.m_groups.end() );
+    track_presence();
+
+    return *this;
+  }
+
+  // point the groups at our presence table, and give their contacts rows in it
+  void ContactTree::track_presence()
+  {
+    ITERATE_GROUPS_BEGIN
+    (*curr).m_presence = &m_presence;
+    Group::iterator gcurr = (*curr).begin();
+    while (gcurr != (*curr).end()) {
+      m_presence.add( (*gcurr).get(), (*curr).get_id() );
+      ++gcurr;
+    }
+    ITERATE_GROUPS_END
+  }
   
   ContactRef ContactTree::operator[](unsigned int uin)
   {
@@ -250,15 +292,18 @@ namespace ICQ2000 {
 
     Group gp( l, group_id );
     m_groups.push_back(gp);
+    m_groups.back().m_presence = &m_presence;
 
     // propagate signals up to ContactTree object
-    m_groups.back().contactlist_signal.connect( contactlist_signal );
+    if (m_update_depth == 0) m_groups.back().contactlist_signal.connect( contactlist_signal );
     m_groups.back().contact_status_change_signal.connect( contact_status_change_signal );
     m_groups.back().contact_userinfo_change_signal.connect( contact_userinfo_change_signal );
 
     // fireoff event
-    GroupAddedEvent ev(m_groups.back());
-    contactlist_signal.emit( &ev );
+    if (m_update_depth == 0) {
+      GroupAddedEvent ev(m_groups.back());
+      contactlist_signal.emit( &ev );
+    }
     
     return m_groups.back();
   }
@@ -273,10 +318,17 @@ namespace ICQ2000 {
     ITERATE_GROUPS_BEGIN
     if ((*curr).get_id() == group_id) {
       // emit event
-      GroupRemovedEvent ev(*curr);
-      contactlist_signal.emit( &ev );
+      if (m_update_depth == 0) {
+	GroupRemovedEvent ev(*curr);
+	contactlist_signal.emit( &ev );
+      }
 
-      // remove from list
+      // remove from list, and its contacts from the presence table
+      Group::iterator gcurr = (*curr).begin();
+      while (gcurr != (*curr).end()) {
+	m_presence.remove( (*gcurr).get() );
+	++gcurr;
+      }
       m_groups.erase(curr);
 
       break;
@@ -314,7 +366,39 @@ namespace ICQ2000 {
     from.relocate_from(ct);
     to.relocate_to(ct);
     
-    UserRelocatedEvent ev(ct, to, from);
+    if (m_update_depth == 0) {
+      UserRelocatedEvent ev(ct, to, from);
+      contactlist_signal.emit( &ev );
+    }
+  }
+
+  /**
+   *  Start a bulk update of the tree. Until the matching end_update()
+   *  no ContactListEvents are signalled for the changes made, instead
+   *  a single CompleteUpdateEvent is signalled at the end. Calls may
+   *  be nested.
+   */
+  void ContactTree::begin_update()
+  {
+    if (m_update_depth++ > 0) return;
+
+    ITERATE_GROUPS_BEGIN
+    (*curr).contactlist_signal.disconnect( &contactlist_signal );
+    ITERATE_GROUPS_END
+  }
+
+  /**
+   *  Finish a bulk update started with begin_update().
+   */
+  void ContactTree::end_update()
+  {
+    if (m_update_depth == 0 || --m_update_depth > 0) return;
+
+    ITERATE_GROUPS_BEGIN
+    (*curr).contactlist_signal.connect( contactlist_signal );
+    ITERATE_GROUPS_END
+
+    CompleteUpdateEvent ev;
     contactlist_signal.emit( &ev );
   }
   
@@ -341,6 +425,15 @@ namespace ICQ2000 {
   {
     return m_groups.size();
   }
+
+  /**
+   *  get the presence of every contact in the tree, for queries over
+   *  the whole list
+   */
+  const PresenceTable& ContactTree::presence() const
+  {
+    return m_presence;
+  }
   
   bool ContactTree::empty() const
   {
@@ -23,33 +23,121 @@
 #define DCCACHE_H
 
 #include "Cache.h"
+#include "DirectClient.h"
+
+#include <map>
 
 #include "libicq2000/sigslot.h"
 
 namespace ICQ2000
 {
-  /* predeclare classes */
-  class DirectClient;
-  
   /* fd -> DirectClient cache
    *
    * Where the party is at. Once a DirectClient object is added to the
-   * cache MM for it is assumed on the cache. Also lookups for a
-   * Contact are done in linear time now, it was just too much of a
-   * head-ache maintaining the uin map in Client.
+   * cache MM for it is assumed on the cache. Lookups for a Contact go
+   * through a uin index, kept up to date as connections are added,
+   * finish their handshake (when an incoming connection finds out who
+   * it is from) and are removed.
+   *
+   * The number of open connections can be capped, in which case the
+   * least recently used idle connection is closed to make room for a
+   * new one.
    */
   class DCCache : public Cache<int, DirectClient*>
   {
+   private:
+    std::map<unsigned int, DirectClient*> m_uin_index;
+    std::map<int, unsigned int> m_last_use;
+    std::map<unsigned int, int> m_lru;	// use clock -> fd, oldest first
+    unsigned int m_use_clock, m_max_open;
+    unsigned int m_lookups, m_reuses, m_evictions;
+
+    void index(DirectClient *dc)
+    {
+      if (dc->getContact().get() != NULL)
+	/* Direct Connections won't have a contact associated
+	 * with them initially just after having been accepted as
+	 * an incoming connection (we don't know who they are
+	 * yet) - so Contact could be a NULL ref.
+	 */
+	m_uin_index[ dc->getContact()->getUIN() ] = dc;
+    }
+
+    void used(int fd)
+    {
+      std::map<int, unsigned int>::iterator i = m_last_use.find(fd);
+      if (i != m_last_use.end()) m_lru.erase( (*i).second );
+      m_last_use[fd] = ++m_use_clock;
+      m_lru[m_use_clock] = fd;
+    }
+
+    // close idle connections until there's room for n more
+    void evict(unsigned int n, int keep_fd)
+    {
+      while (m_max_open != 0 && m_last_use.size() + n > m_max_open) {
+	std::map<unsigned int, int>::iterator curr = m_lru.begin();
+	while (curr != m_lru.end()) {
+	  /* never the most recently used, it may be the one whose
+	   * incoming message got us here */
+	  if ((*curr).second != keep_fd && (*curr).first != m_use_clock) {
+	    literator l = lookup( (*curr).second );
+	    if (l != m_list.end() && (*l).getValue()->isIdle()) break;
+	  }
+	  ++curr;
+	}
+
+	// everything busy, let it go over
+	if (curr == m_lru.end()) break;
+
+	++m_evictions;
+	remove( (*curr).second );
+      }
+    }
+
    public:
-    DCCache() { }
+    DCCache()
+      : m_use_clock(0), m_max_open(0),
+	m_lookups(0), m_reuses(0), m_evictions(0)
+    { }
+
     ~DCCache()
     {
       removeAll();
     }
 
+    void add(DirectClient *dc)
+    {
+      evict( 1, dc->getfd() );
+      insert( dc->getfd(), dc );
+      index(dc);
+      used( dc->getfd() );
+    }
+
+    // mark as just used, and pick up the contact once it is known
+    void touch(int fd)
+    {
+      literator l = lookup(fd);
+      if (l == m_list.end()) return;
+      index( (*l).getValue() );
+      used(fd);
+    }
+
     void removeItem(const DCCache::literator& l)
     {
-      delete ((*l).getValue());
+      DirectClient *dc = (*l).getValue();
+      if (dc->getContact().get() != NULL) {
+	// a later connection to the same contact may have taken its place
+	std::map<unsigned int, DirectClient*>::iterator i = m_uin_index.find( dc->getContact()->getUIN() );
+	if (i != m_uin_index.end() && (*i).second == dc) m_uin_index.erase(i);
+      }
+
+      std::map<int, unsigned int>::iterator u = m_last_use.find( (*l).getKey() );
+      if (u != m_last_use.end()) {
+	m_lru.erase( (*u).second );
+	m_last_use.erase(u);
+      }
+
+      delete dc;
       Cache<int, DirectClient*>::removeItem(l);
     }
 
@@ -70,11 +158,6 @@ namespace ICQ2000
 	DirectClient *dc = (*curr).getValue();
 	++next;
 	if ( dc->getContact().get() != NULL
-	     /* Direct Connections won't have a contact associated
-	      * with them initially just after having been accepted as
-	      * an incoming connection (we don't know who they are
-	      * yet) - so Contact could be a NULL ref.
-	      */
 	     && dc->getContact()->getUIN() == c->getUIN() ) {
 	  removeItem(curr);
 	}
@@ -84,23 +167,24 @@ namespace ICQ2000
 
     DirectClient* getByContact(const ContactRef& c)
     {
-      // linear lookup
-      literator curr = m_list.begin();
-      while ( curr != m_list.end() ) {
-	DirectClient *dc = (*curr).getValue();
-	if (  dc->getContact().get() != NULL
-	     /* Direct Connections won't have a contact associated
-	      * with them initially just after having been accepted as
-	      * an incoming connection (we don't know who they are
-	      * yet) - so Contact could be a NULL ref.
-	      */
-	     && dc->getContact()->getUIN() == c->getUIN() )
-	  return dc; // found it
+      ++m_lookups;
 
-	++curr;
+      std::map<unsigned int, DirectClient*>::iterator i = m_uin_index.find( c->getUIN() );
+      if (i == m_uin_index.end() && m_uin_index.size() < m_last_use.size()) {
+	// some not indexed yet, see if their contact is known now
+	literator curr = m_list.begin();
+	while ( curr != m_list.end() ) {
+	  index( (*curr).getValue() );
+	  ++curr;
+	}
+	i = m_uin_index.find( c->getUIN() );
       }
 
-      return NULL; // not found
+      if (i == m_uin_index.end()) return NULL; // not found
+
+      ++m_reuses;
+      used( (*i).second->getfd() );
+      return (*i).second;
     }
 
     void clearoutMessagesPoll()
@@ -113,8 +197,57 @@ namespace ICQ2000
       }
     }
 
+    // messages waiting on connections to come up, over all of them
+    unsigned int queued()
+    {
+      unsigned int n = 0;
+      literator curr = m_list.begin();
+      while ( curr != m_list.end() ) {
+	n += (*curr).getValue()->queued();
+	++curr;
+      }
+      return n;
+    }
+
+    unsigned int getMaxOpen() const { return m_max_open; }
+    void setMaxOpen(unsigned int n) { m_max_open = n; evict(0, -1); }
+
+    unsigned int getLookups() const { return m_lookups; }
+    unsigned int getReuses() const { return m_reuses; }
+    unsigned int getEvictions() const { return m_evictions; }
+    unsigned int size() const { return m_last_use.size(); }
+
     sigslot::signal1<DirectClient*> expired;
   };
+
+  // how a contact was last reached directly
+  enum DCPath {
+    DCPath_LAN,
+    DCPath_External,
+    DCPath_Unreachable
+  };
+
+  /* uin -> DCPath cache
+   *
+   * Remembers which of a contact's addresses answered, so later
+   * connections go straight there, or straight via the server if
+   * neither did. Entries time out so the addresses are tried again.
+   */
+  class DCPathCache : public Cache<unsigned int, DCPath>
+  {
+   public:
+    DCPathCache() { }
+    ~DCPathCache()
+    {
+      removeAll();
+    }
+
+    void set(unsigned int uin, DCPath p)
+    {
+      remove(uin);
+      insert(uin, p);
+    }
+  };
   
 }
 
@@ -22,6 +22,8 @@
 #include "DirectClient.h"
 
 #include "ICQ.h"
+#include "Capture.h"
+#include "MessageTrace.h"
 #include "constants.h"
 
 #include "sstream_fix.h"
@@ -51,8 +53,8 @@ namespace ICQ2000 {
 			     ContactTree *cl, unsigned int ext_ip, unsigned short server_port)
     : m_state(WAITING_FOR_INIT), m_recv(),
       m_self_contact(self), m_contact(NULL), m_contact_list(cl), 
-      m_message_handler(mh), m_incoming(true), m_local_ext_ip(ext_ip),
-      m_local_server_port(server_port)
+      m_message_handler(mh), m_incoming(true), m_partner(NULL), m_probe(false), m_local_ext_ip(ext_ip),
+      m_local_server_port(server_port), m_capture(NULL), m_tracer(NULL)
   {
     m_socket = sock;
     Init();
@@ -64,8 +66,8 @@ namespace ICQ2000 {
   DirectClient::DirectClient(ContactRef self, ContactRef c, MessageHandler *mh, unsigned int ext_ip,
 			     unsigned short server_port)
     : m_state(NOT_CONNECTED), m_recv(), m_self_contact(self), 
-      m_contact(c), m_message_handler(mh), m_incoming(false), m_local_ext_ip(ext_ip),
-      m_local_server_port(server_port)
+      m_contact(c), m_message_handler(mh), m_incoming(false), m_partner(NULL), m_probe(false), m_local_ext_ip(ext_ip),
+      m_local_server_port(server_port), m_capture(NULL), m_tracer(NULL)
       
   {
     Init();
@@ -75,6 +77,12 @@ namespace ICQ2000 {
 
   DirectClient::~DirectClient()
   {
+    if (m_partner != NULL) {
+      // the other attempt carries on with anything queued
+      m_partner->m_partner = NULL;
+      m_partner->m_msgqueue.splice( m_partner->m_msgqueue.end(), m_msgqueue );
+    }
+
     m_msgcache.expireAll();
     
     while (!m_msgqueue.empty()) {
@@ -89,18 +97,23 @@ namespace ICQ2000 {
   void DirectClient::Init()
   {
     m_seqnum = 0xFFFF;
+    m_remote_uin = 0;
     m_msgcache.setDefaultTimeout(30);
     m_msgcache.expired.connect( this, &DirectClient::expired_cb) ;
   }
 
   void DirectClient::Connect() {
+    Connect( m_contact->getLanIP(), m_contact->getLanPort() );
+  }
+
+  void DirectClient::Connect(unsigned int ip, unsigned short port) {
     m_remote_tcp_version = m_contact->getTCPVersion();
     if (m_remote_tcp_version >= 7) m_eff_tcp_version = 7;
     else if (m_remote_tcp_version == 6) m_eff_tcp_version = 6;
     else throw DisconnectedException("Cannot direct connect to client with too old TCP version");
 
-    m_socket->setRemoteIP( m_contact->getLanIP() );
-    m_socket->setRemotePort( m_contact->getLanPort() );
+    m_socket->setRemoteIP( ip );
+    m_socket->setRemotePort( port );
     m_socket->setBlocking(false);
     m_socket->Connect();
     SignalAddSocket( m_socket->getSocketHandle(), SocketEvent::WRITE );
@@ -128,6 +141,73 @@ namespace ICQ2000 {
     m_msgcache.clearoutPoll();
   }
   
+  /*
+   * Connected with nothing queued or waiting to be acked, so it can
+   * be closed without losing anything.
+   */
+  bool DirectClient::isIdle() const
+  {
+    return m_state == CONNECTED && m_msgqueue.empty() && m_msgcache.empty();
+  }
+
+  /*
+   * Messages waiting for the connection to come up before they can
+   * be sent.
+   */
+  unsigned int DirectClient::queued() const
+  {
+    return m_msgqueue.size();
+  }
+
+  bool DirectClient::isConnected() const
+  {
+    return m_state == CONNECTED;
+  }
+
+  bool DirectClient::isIncoming() const
+  {
+    return m_incoming;
+  }
+
+  /*
+   * Pair up two outgoing attempts to the same contact. Whichever is
+   * deleted first hands its queued messages over to the other.
+   */
+  void DirectClient::setRacePartner(DirectClient *dc)
+  {
+    m_partner = dc;
+    dc->m_partner = this;
+  }
+
+  DirectClient* DirectClient::getRacePartner() const
+  {
+    return m_partner;
+  }
+
+  /*
+   * Mark an outgoing attempt as only finding out whether an address
+   * works. Messages go another way until it has connected.
+   */
+  void DirectClient::setProbe(bool b)
+  {
+    m_probe = b;
+  }
+
+  bool DirectClient::isProbe() const
+  {
+    return m_probe;
+  }
+
+  /*
+   * Take over the queued messages of another connection, sending them
+   * straight away if we are connected.
+   */
+  void DirectClient::takeQueue(DirectClient *dc)
+  {
+    m_msgqueue.splice( m_msgqueue.end(), dc->m_msgqueue );
+    if (m_state == CONNECTED) flush_queue();
+  }
+
   void DirectClient::expired_cb(MessageEvent *ev) {
     ev->setFinished(false);
     ev->setDelivered(false);
@@ -169,6 +249,8 @@ namespace ICQ2000 {
       Buffer sb;
       m_recv.chopOffBuffer( sb, length+2 );
 
+      if (m_capture != NULL) m_capture->record(CaptureSink::Direct, m_remote_uin, sb);
+
       ostringstream ostr;
       ostr << "Received packet from " << IPtoString( m_socket->getRemoteIP() ) << ":" << m_socket->getRemotePort() << endl << sb;
       SignalLog(LogEvent::DIRECTPACKET, ostr.str());
@@ -480,6 +562,7 @@ namespace ICQ2000 {
       if ( m_msgcache.exists(seqnum) )
       {
 	MessageEvent *ev = m_msgcache[seqnum];
+	if (m_tracer != NULL) m_tracer->mark(ev, MessageTracer::Ack);
 	ev->setDirect(true);
 	m_message_handler->handleIncomingACK( ev, icqsubtype );
 	m_msgcache.remove(seqnum);
@@ -524,8 +607,22 @@ namespace ICQ2000 {
   }
 
   bool DirectClient::Decrypt(Buffer& in, Buffer& out) {
+    if (!DecryptPacket(in, out, m_eff_tcp_version)) return false;
 
-    if (m_eff_tcp_version >= 6) {
+    ostringstream ostr;
+    ostr << "Decrypted Direct packet from "  << IPtoString( m_socket->getRemoteIP() ) << ":" << m_socket->getRemotePort() << endl << out;
+    SignalLog(LogEvent::DIRECTPACKET, ostr.str());
+      
+    return true;
+  }
+
+  /*
+   * The cipher on its own, it depends on nothing of the connection
+   * but the TCP version.
+   */
+  bool DirectClient::DecryptPacket(Buffer& in, Buffer& out, unsigned short tcp_version) {
+
+    if (tcp_version >= 6) {
       // Huge *thanks* to licq for this code
     
       unsigned long hex, key, B1, M1;
@@ -533,7 +630,7 @@ namespace ICQ2000 {
       unsigned char X1, X2, X3;
       unsigned int correction;
 
-      if (m_eff_tcp_version == 7) correction = 3;
+      if (tcp_version == 7) correction = 3;
       else correction = 2;
 
       unsigned int size = in.size()-correction;
@@ -545,7 +642,7 @@ namespace ICQ2000 {
       in >> length;
       out << length;
 
-      if (m_eff_tcp_version == 7) {
+      if (tcp_version == 7) {
 	unsigned char start_byte;
 	in >> start_byte;
 	out << start_byte;
@@ -592,10 +689,6 @@ namespace ICQ2000 {
       }
     }
 
-    ostringstream ostr;
-    ostr << "Decrypted Direct packet from "  << IPtoString( m_socket->getRemoteIP() ) << ":" << m_socket->getRemotePort() << endl << out;
-    SignalLog(LogEvent::DIRECTPACKET, ostr.str());
-      
     return true;
   }
 
@@ -605,7 +698,11 @@ namespace ICQ2000 {
     ostr << "Unencrypted packet to "  << IPtoString( m_socket->getRemoteIP() ) << ":" << m_socket->getRemotePort() << endl << in;
     SignalLog(LogEvent::DIRECTPACKET, ostr.str());
       
-    if (m_eff_tcp_version == 6 || m_eff_tcp_version == 7) {
+    EncryptPacket(in, out, m_eff_tcp_version);
+  }
+
+  void DirectClient::EncryptPacket(Buffer& in, Buffer& out, unsigned short tcp_version) {
+    if (tcp_version == 6 || tcp_version == 7) {
       // Huge *thanks* to licq for this code
     
       unsigned long hex, key, B1, M1;
@@ -616,7 +713,7 @@ namespace ICQ2000 {
       in.setLittleEndian();
       out.setLittleEndian();
 
-      if (m_eff_tcp_version == 7) {
+      if (tcp_version == 7) {
 	// correction for next byte
 	out << (unsigned short)(size + 1);
 	out << (unsigned char)0x02;
@@ -716,6 +813,12 @@ namespace ICQ2000 {
     Encrypt(b,c);
     Send(c);
 
+    if (m_tracer != NULL && m_tracer->traced(ev)) {
+      ostringstream ostr;
+      ostr << "seq " << seqnum;
+      m_tracer->written(ev, ostr.str());
+    }
+
     // Save seqnum so later ACK or CANCEL could be sent.
     if (ist->getType() == MSG_Type_FT)
     {
@@ -837,4 +940,8 @@ namespace ICQ2000 {
 
   ContactRef DirectClient::getContact() const { return m_contact; }
 
+  void DirectClient::setCaptureSink(CaptureSink *cs) { m_capture = cs; }
+
+  void DirectClient::setTracer(MessageTracer *t) { m_tracer = t; }
+
 }
@@ -41,6 +41,8 @@
 namespace ICQ2000 {
 
   class UINICQSubType;
+  class CaptureSink;
+  class MessageTracer;
   
   class DirectClient : public SocketClient {
    private:
@@ -61,6 +63,12 @@ namespace ICQ2000 {
 
     bool m_incoming;
 
+    // the other attempt when racing LAN and external addresses
+    DirectClient *m_partner;
+
+    // trying an address nothing says works, so not sent through yet
+    bool m_probe;
+
     unsigned short m_remote_tcp_version;
     unsigned int m_remote_uin;
     unsigned char m_tcp_flags;
@@ -69,6 +77,9 @@ namespace ICQ2000 {
     unsigned int m_local_ext_ip, m_session_id;
     unsigned short m_local_server_port;
 
+    CaptureSink *m_capture;
+    MessageTracer *m_tracer;
+
     void Parse();
     void ParseInitPacket(Buffer &b);
     void ParseInitAck(Buffer &b);
@@ -106,6 +117,7 @@ namespace ICQ2000 {
     ~DirectClient();
 
     void Connect();
+    void Connect(unsigned int ip, unsigned short port);
     void FinishNonBlockingConnect();
     void Recv();
 
@@ -115,9 +127,24 @@ namespace ICQ2000 {
     int getfd() const;
     TCPSocket* getSocket() const;
     void clearoutMessagesPoll();
+    bool isIdle() const;
+    unsigned int queued() const;
+    bool isConnected() const;
+    bool isIncoming() const;
+
+    void setRacePartner(DirectClient *dc);
+    DirectClient* getRacePartner() const;
+    void takeQueue(DirectClient *dc);
+    void setProbe(bool b);
+    bool isProbe() const;
 
     void setContact(ContactRef c);
     ContactRef getContact() const;
+    void setCaptureSink(CaptureSink *cs);
+    void setTracer(MessageTracer *t);
+
+    static bool DecryptPacket(Buffer& in, Buffer& out, unsigned short tcp_version);
+    static void EncryptPacket(Buffer& in, Buffer& out, unsigned short tcp_version);
     void SendEvent(MessageEvent* ev);
     void SendFTACK(FileTransferEvent *ev);
     void SendFTCancel(FileTransferEvent *ev);
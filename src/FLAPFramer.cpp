@@ -0,0 +1,148 @@
+/*
+ * FLAPFramer
+ *
+ * Copyright (C) 2001 Barnaby Gray <barnaby@beedesign.co.uk>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#include "FLAPFramer.h"
+
+namespace ICQ2000 {
+
+  FLAPFramer::FLAPFramer()
+    : m_channel(0), m_seqnum(0), m_length(0)
+  {
+    reset();
+  }
+
+  /*
+   * Start again for a new connection. The frame itself is left
+   * alone, as the last FLAP may still be being parsed.
+   */
+  void FLAPFramer::reset()
+  {
+    m_state = Start;
+    m_have_seqnum = false;
+    m_in_sequence = true;
+    m_expected_seqnum = m_next_seqnum = 0;
+    m_skipped = 0;
+  }
+
+  // move n bytes from the input onto the end of the frame
+  void FLAPFramer::take(Buffer& in, unsigned int n)
+  {
+    if (n == 0) return;
+    m_frame.Pack( &in[in.pos()], n );
+    in.advance(n);
+  }
+
+  /*
+   * The server counts up from wherever it started, wrapping at
+   * 0x8000 (some servers go on to 0xffff).
+   */
+  void FLAPFramer::check_seqnum()
+  {
+    if (m_have_seqnum) {
+      m_expected_seqnum = m_next_seqnum;
+      m_in_sequence = (m_seqnum == m_expected_seqnum
+		       || (m_expected_seqnum == 0x8000 && m_seqnum == 0));
+    } else {
+      m_expected_seqnum = m_seqnum;
+      m_in_sequence = true;
+      m_have_seqnum = true;
+    }
+
+    // carry on from what we got, so one gap isn't reported forever
+    m_next_seqnum = m_seqnum + 1;
+  }
+
+  /*
+   * Carry on framing from the input's position. Returns when a FLAP
+   * is complete, when bytes had to be skipped (getSkipped says how
+   * many) or when the input is used up.
+   */
+  FLAPFramer::Result FLAPFramer::next(Buffer& in)
+  {
+    while (true) {
+      switch(m_state) {
+
+      case Start:
+      {
+	unsigned int p = in.pos(), end = in.size();
+	while (p < end && in[p] != StartByte) ++p;
+
+	if (p != in.pos()) {
+	  m_skipped = p - in.pos();
+	  in.setPos(p);
+	  return Skipped;
+	}
+	if (p == end) return Incomplete;
+
+	m_frame.clear();
+	m_frame.setBigEndian();
+	m_state = Header;
+	break;
+      }
+
+      case Header:
+      {
+	unsigned int n = HeaderSize - m_frame.size();
+	if (n > in.remains()) n = in.remains();
+	take(in, n);
+	if (m_frame.size() < HeaderSize) return Incomplete;
+
+	m_channel = m_frame[1];
+	if (m_channel < 1 || m_channel > 5) {
+	  /* not a FLAP header after all - throw away the start byte
+	   * and anything up to the next one in what we have */
+	  unsigned int k = 1;
+	  while (k < HeaderSize && m_frame[k] != StartByte) ++k;
+
+	  unsigned char rest[HeaderSize];
+	  for (unsigned int i = k; i < HeaderSize; ++i) rest[i-k] = m_frame[i];
+	  m_frame.clear();
+	  m_frame.Pack(rest, HeaderSize - k);
+
+	  m_skipped = k;
+	  if (m_frame.empty()) m_state = Start;
+	  return Skipped;
+	}
+
+	m_seqnum = (m_frame[2] << 8) | m_frame[3];
+	m_length = (m_frame[4] << 8) | m_frame[5];
+	m_state = Body;
+	break;
+      }
+
+      case Body:
+      {
+	unsigned int n = HeaderSize + m_length - m_frame.size();
+	if (n > in.remains()) n = in.remains();
+	take(in, n);
+	if (m_frame.size() < HeaderSize + m_length) return Incomplete;
+
+	check_seqnum();
+	m_frame.setPos(HeaderSize);
+	m_state = Start;
+	return Complete;
+      }
+
+      }
+    }
+  }
+
+}
@@ -0,0 +1,91 @@
+/*
+ * FLAPFramer
+ *
+ * Copyright (C) 2001 Barnaby Gray <barnaby@beedesign.co.uk>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#ifndef FLAPFRAMER_H
+#define FLAPFRAMER_H
+
+#include "buffer.h"
+
+namespace ICQ2000 {
+
+  /*
+   * Splits the stream from the server into FLAPs.
+   *
+   * Bytes are taken from the input as they arrive and copied once,
+   * into the frame being built, so a FLAP split over several reads
+   * is picked up where it left off rather than its header being read
+   * again each time. The frame buffer is reused from one FLAP to the
+   * next, so once it has grown to the largest FLAP seen no more
+   * allocation is done.
+   *
+   * Anything that isn't a FLAP is skipped up to the next 0x2a start
+   * byte, and sequence numbers are checked to go up one at a time.
+   */
+  class FLAPFramer {
+   public:
+    enum Result {
+      Incomplete,   // input used up, waiting for more
+      Complete,     // a whole FLAP is in frame()
+      Skipped       // bytes thrown away to find a start byte
+    };
+
+    static const unsigned char StartByte = 0x2a;
+    static const unsigned int HeaderSize = 6;
+
+   private:
+    enum State {
+      Start,
+      Header,
+      Body
+    };
+
+    State m_state;
+    Buffer m_frame;
+
+    unsigned char m_channel;
+    unsigned short m_seqnum, m_length;
+
+    bool m_have_seqnum, m_in_sequence;
+    unsigned short m_expected_seqnum, m_next_seqnum;
+    unsigned int m_skipped;
+
+    void take(Buffer& in, unsigned int n);
+    void check_seqnum();
+
+   public:
+    FLAPFramer();
+
+    void reset();
+    Result next(Buffer& in);
+
+    Buffer& frame() { return m_frame; }
+    unsigned char getChannel() const { return m_channel; }
+    unsigned short getSeqNum() const { return m_seqnum; }
+    unsigned short getLength() const { return m_length; }
+
+    bool inSequence() const { return m_in_sequence; }
+    unsigned short getExpectedSeqNum() const { return m_expected_seqnum; }
+    unsigned int getSkipped() const { return m_skipped; }
+  };
+
+}
+
+#endif
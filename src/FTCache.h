@@ -74,7 +74,7 @@ namespace ICQ2000
     void remove_and_not_delete(const int &k) {
 	 literator i = lookup(k);
 	 if (i != m_list.end())
-	    m_list.erase(i);
+	    erase(i);
     }
 
 
@@ -22,6 +22,7 @@
 #include "ICBMCookie.h"
 
 #include <stdlib.h>
+#include <stdio.h>
 
 namespace ICQ2000 {
 
@@ -45,10 +46,20 @@ namespace ICQ2000 {
       << m_c2;
   }
 
+  std::string ICBMCookie::toString() const {
+    char s[17];
+    sprintf(s, "%08x%08x", m_c1, m_c2);
+    return std::string(s);
+  }
+
   bool ICBMCookie::operator==(const ICBMCookie& c) const {
     return (m_c1 == c.m_c1 && m_c2 == c.m_c2);
   }
 
+  bool ICBMCookie::operator<(const ICBMCookie& c) const {
+    return (m_c1 < c.m_c1 || (m_c1 == c.m_c1 && m_c2 < c.m_c2));
+  }
+
   ICBMCookie& ICBMCookie::operator=(const ICBMCookie& c) {
     m_c1 = c.m_c1;
     m_c2 = c.m_c2;
@@ -39,7 +39,10 @@ namespace ICQ2000 {
     void Parse(Buffer& b);
     void Output(Buffer& b) const;
 
+    std::string toString() const;
+
     bool operator==(const ICBMCookie& c) const;
+    bool operator<(const ICBMCookie& c) const;
     ICBMCookie& operator=(const ICBMCookie& c);
   };
 
@@ -20,22 +20,31 @@
  */ 
 
 #include "ICQ.h"
+#include "ObjectPool.h"
 
 #include "sstream_fix.h"
-#include <memory>
 
 using std::string;
 using std::list;
 using std::ostringstream;
-using std::auto_ptr;
 
 namespace ICQ2000 {
 
   // ----------------- ICQSubtypes ----------------
 
+  static ObjectPool& subtype_pool()
+  {
+    static ObjectPool *pool = new ObjectPool(128);
+    return *pool;
+  }
+
   ICQSubType::ICQSubType()
     : m_flags(0x0000) { }
 
+  void* ICQSubType::operator new(size_t n) { return subtype_pool().allocate(n); }
+
+  void ICQSubType::operator delete(void *p, size_t n) { subtype_pool().deallocate(p, n); }
+
   ICQSubType* ICQSubType::ParseICQSubType(Buffer& b, bool adv, bool ack) {
     unsigned char type, flags;
     b >> type
@@ -471,64 +480,44 @@ namespace ICQ2000 {
     string xmlstr;
     b.UnpackUint32String(xmlstr);
 
-    string::iterator s = xmlstr.begin();
-    auto_ptr<XmlNode> top(XmlNode::parse(s, xmlstr.end()));
-
-    if (top.get() == NULL) throw ParseException("Couldn't parse xml data in Message SNAC");
-
     if (m_type == SMS) {
 
       // -------- Normal SMS Message ---------
-      if (top->getTag() != "sms_message") throw ParseException("No <sms_message> tag found in xml data");
-      XmlBranch *sms_message = dynamic_cast<XmlBranch*>(top.get());
-      if (sms_message == NULL || !sms_message->exists("text")) throw ParseException("No <text> tag found in xml data");
-      XmlLeaf *text = sms_message->getLeaf("text");
-      if (text == NULL) throw ParseException("<text> tag is not a leaf in xml data");
-      m_message = text->getValue();
-      
       /**
        * Extra fields
        * senders_network is always blank from my mobile
        */
-      XmlLeaf *source = sms_message->getLeaf("source");
-      if (source != NULL) m_source = source->getValue();
-
-      XmlLeaf *sender = sms_message->getLeaf("sender");
-      if (sender != NULL) m_sender = sender->getValue();
-
-      XmlLeaf *senders_network = sms_message->getLeaf("senders_network");
-      if (senders_network != NULL) m_senders_network = senders_network->getValue();
-
-      XmlLeaf *time = sms_message->getLeaf("time");
-      if (time != NULL) m_time = time->getValue();
+      XmlReader::Field fields[] = {
+	{ "text", &m_message, false },
+	{ "source", &m_source, false },
+	{ "sender", &m_sender, false },
+	{ "senders_network", &m_senders_network, false },
+	{ "time", &m_time, false }
+      };
+
+      if (!XmlReader::extract(xmlstr, "sms_message", fields, sizeof(fields)/sizeof(fields[0])))
+	throw ParseException("Couldn't parse <sms_message> in xml data");
+      if (!fields[0].found) throw ParseException("No <text> tag found in xml data");
 
       // ----------------------------------
 
     } else if (m_type == SMS_Receipt) {
 
       // -- SMS Delivery Receipt Success --
-      if (top->getTag() != "sms_delivery_receipt") throw ParseException("No <sms_delivery_receipt> tag found in xml data");
-      XmlBranch *sms_rcpt = dynamic_cast<XmlBranch*>(top.get());
-      if (sms_rcpt == NULL) throw ParseException("No tags found in <sms_delivery_receipt>");
-
-      XmlLeaf *message_id = sms_rcpt->getLeaf("message_id");
-      if (message_id != NULL) m_message_id = message_id->getValue();
+      string delivered;
+      XmlReader::Field fields[] = {
+	{ "message_id", &m_message_id, false },
+	{ "destination", &m_destination, false },
+	{ "delivered", &delivered, false },
+	{ "text", &m_message, false },
+	{ "submition_time", &m_submission_time, false }, // can they not spell!
+	{ "delivery_time", &m_delivery_time, false }
+      };
 
-      XmlLeaf *destination = sms_rcpt->getLeaf("destination");
-      if (destination != NULL) m_destination = destination->getValue();
+      if (!XmlReader::extract(xmlstr, "sms_delivery_receipt", fields, sizeof(fields)/sizeof(fields[0])))
+	throw ParseException("Couldn't parse <sms_delivery_receipt> in xml data");
 
-      XmlLeaf *delivered = sms_rcpt->getLeaf("delivered");
-      m_delivered = false;
-      if (delivered != NULL && delivered->getValue() == "Yes") m_delivered = true;
-
-      XmlLeaf *text = sms_rcpt->getLeaf("text");
-      if (text != NULL) m_message = text->getValue();
-
-      XmlLeaf *submission_time = sms_rcpt->getLeaf("submition_time"); // can they not spell!
-      if (submission_time != NULL) m_submission_time = submission_time->getValue();
-
-      XmlLeaf *delivery_time = sms_rcpt->getLeaf("delivery_time");
-      if (delivery_time != NULL) m_delivery_time = delivery_time->getValue();
+      m_delivered = (delivered == "Yes");
 
       // could do with parsing errors for Failure
 
@@ -554,6 +543,8 @@ namespace ICQ2000 {
       m_email(email), m_message(msg), m_auth(auth)  { }
 
   string AuthReqICQSubType::getMessage() const { return m_message; }
+
+  void AuthReqICQSubType::setMessage(const string& msg) { m_message = msg; }
   
   void AuthReqICQSubType::ParseBodyUIN(Buffer& b) {
     string text;
@@ -22,6 +22,7 @@
 #ifndef ICQ_H
 #define ICQ_H
 
+#include <stddef.h>
 #include <string>
 #include <list>
 
@@ -91,6 +92,10 @@ namespace ICQ2000 {
     ICQSubType();
     virtual ~ICQSubType() { }
 
+    // one is parsed/built per message, storage comes from a pool
+    static void* operator new(size_t n);
+    static void operator delete(void *p, size_t n);
+
     static ICQSubType* ParseICQSubType(Buffer& b, bool adv, bool ack);
     void Output(Buffer& b) const;
 
@@ -269,6 +274,7 @@ namespace ICQ2000 {
 		      const std::string& msg);
 
     std::string getMessage() const;
+    void setMessage(const std::string& msg);
 
     void ParseBodyUIN(Buffer& b);
     void OutputBodyUIN(Buffer& b) const;
@@ -26,6 +26,9 @@
 #include "sstream_fix.h"
 #include "Translator.h"
 
+#include <algorithm>
+#include <map>
+
 using std::string;
 using std::ostringstream;
 using std::endl;
@@ -36,6 +39,11 @@ namespace ICQ2000
   MessageHandler::MessageHandler(ContactRef self, ContactTree *cl, Translator * & tr)
     : m_self_contact(self), m_contact_list(cl), m_translator(tr)
   { }
+
+  MessageHandler::~MessageHandler()
+  {
+    dropOfflineMessages();
+  }
   
   /*
    * This method handles:
@@ -60,7 +68,7 @@ namespace ICQ2000
     }
     
     UINICQSubType *uist = dynamic_cast<UINICQSubType*>(ist);
-    MessageEvent *ev = ICQSubTypeToEvent(ist, contact, advanced);
+    MessageEvent *ev = ICQSubTypeToEvent(ist, contact, advanced, m_translator);
     ICQMessageEvent *mev = dynamic_cast<ICQMessageEvent*>(ev);
 
     Status st = m_self_contact->getStatus();
@@ -167,6 +175,173 @@ namespace ICQ2000
     return ack;
   }
 
+  /*
+   * Hold on to an offline message until the server says that's all
+   * of them. Takes ownership of the ICQSubType.
+   */
+  void MessageHandler::queueOfflineMessage(ICQSubType *ist, time_t t)
+  {
+    OfflineMessage m;
+    m.icq = ist;
+    m.time = t;
+    m.translated = false;
+    m_offline.push_back(m);
+  }
+
+  /*
+   * Throw away offline messages gathered so far, when the connection
+   * goes before they were all received. They weren't ACKed, so the
+   * server sends them again next time.
+   */
+  void MessageHandler::dropOfflineMessages()
+  {
+    std::vector<OfflineMessage>::iterator curr = m_offline.begin();
+    while (curr != m_offline.end()) {
+      delete (*curr).icq;
+      ++curr;
+    }
+    m_offline.clear();
+  }
+
+  bool MessageHandler::offline_message_before(const OfflineMessage& a, const OfflineMessage& b)
+  {
+    return a.time < b.time;
+  }
+
+  /*
+   * Signal all the offline messages gathered in one batch, oldest
+   * first. Unlike handleIncoming, each contact's last message time is
+   * only set once, and there is no per message logging.
+   */
+  void MessageHandler::flushOfflineMessages()
+  {
+    if (m_offline.empty()) return;
+
+    std::stable_sort( m_offline.begin(), m_offline.end(), offline_message_before );
+    translateOfflineMessages();
+
+    static NULLTranslator untranslated;
+    bool to_contact_list = (m_self_contact->getStatus() == STATUS_OCCUPIED
+			    || m_self_contact->getStatus() == STATUS_DND);
+
+    OfflineMessageBatchEvent bev;
+    std::map<unsigned int, ContactRef> senders;
+    std::map<unsigned int, time_t> last_time;
+
+    std::vector<OfflineMessage>::iterator curr = m_offline.begin();
+    while (curr != m_offline.end()) {
+      ContactRef contact;
+      bool advanced;
+      MessageEvent *ev = NULL;
+
+      if ((*curr).icq->getType() != MSG_Type_FT)
+	ev = ICQSubTypeToEvent( (*curr).icq, contact, advanced,
+				(*curr).translated ? &untranslated : m_translator );
+
+      if (ev != NULL && ev->getType() != MessageEvent::AwayMessage) {
+	ICQMessageEvent *mev = dynamic_cast<ICQMessageEvent*>(ev);
+	if (mev != NULL && to_contact_list) mev->setToContactList(true);
+
+	ev->setTime( (*curr).time );
+	ev->setDelivered(true);
+	bev.add(ev);
+
+	senders[ contact->getUIN() ] = contact;
+	last_time[ contact->getUIN() ] = (*curr).time;
+      } else {
+	delete ev;
+      }
+
+      delete (*curr).icq;
+      ++curr;
+    }
+    m_offline.clear();
+
+    std::map<unsigned int, ContactRef>::iterator scurr = senders.begin();
+    while (scurr != senders.end()) {
+      (*scurr).second->set_last_message_time( last_time[ (*scurr).first ] );
+      ++scurr;
+    }
+
+    ostringstream ostr;
+    ostr << "Received " << bev.size() << " offline messages from "
+	 << senders.size() << " contacts";
+    SignalLog( LogEvent::INFO, ostr.str() );
+
+    if (!bev.empty()) offline_messages.emit(&bev);
+  }
+
+  /*
+   * Translate the text of the gathered offline messages with one
+   * Translator call per contact, rather than one per string.
+   */
+  void MessageHandler::translateOfflineMessages()
+  {
+    std::map< unsigned int, std::vector<std::string> > texts;
+
+    std::vector<OfflineMessage>::iterator curr = m_offline.begin();
+    while (curr != m_offline.end()) {
+      ICQSubType *ist = (*curr).icq;
+      std::vector<std::string> *v = NULL;
+      switch(ist->getType()) {
+      case MSG_Type_Normal:
+	v = &texts[ static_cast<UINICQSubType*>(ist)->getSource() ];
+	v->push_back( static_cast<NormalICQSubType*>(ist)->getMessage() );
+	break;
+      case MSG_Type_URL:
+	v = &texts[ static_cast<UINICQSubType*>(ist)->getSource() ];
+	v->push_back( static_cast<URLICQSubType*>(ist)->getMessage() );
+	v->push_back( static_cast<URLICQSubType*>(ist)->getURL() );
+	break;
+      case MSG_Type_AuthReq:
+	v = &texts[ static_cast<UINICQSubType*>(ist)->getSource() ];
+	v->push_back( static_cast<AuthReqICQSubType*>(ist)->getMessage() );
+	break;
+      case MSG_Type_AuthRej:
+	v = &texts[ static_cast<UINICQSubType*>(ist)->getSource() ];
+	v->push_back( static_cast<AuthRejICQSubType*>(ist)->getMessage() );
+	break;
+      default:
+	break;
+      }
+      (*curr).translated = (v != NULL);
+      ++curr;
+    }
+
+    std::map< unsigned int, std::vector<std::string> >::iterator tcurr = texts.begin();
+    while (tcurr != texts.end()) {
+      m_translator->server_to_client_batch( (*tcurr).second, ENCODING_CONTACT_LOCALE, lookupUIN( (*tcurr).first ) );
+      ++tcurr;
+    }
+
+    // put them back, in the same order they were taken out
+    std::map< unsigned int, unsigned int > pos;
+    curr = m_offline.begin();
+    while (curr != m_offline.end()) {
+      if ((*curr).translated) {
+	UINICQSubType *ist = static_cast<UINICQSubType*>( (*curr).icq );
+	std::vector<std::string>& v = texts[ ist->getSource() ];
+	unsigned int& n = pos[ ist->getSource() ];
+	switch(ist->getType()) {
+	case MSG_Type_Normal:
+	  static_cast<NormalICQSubType*>(ist)->setMessage( v[n++] );
+	  break;
+	case MSG_Type_URL:
+	  static_cast<URLICQSubType*>(ist)->setMessage( v[n++] );
+	  static_cast<URLICQSubType*>(ist)->setURL( v[n++] );
+	  break;
+	case MSG_Type_AuthReq:
+	  static_cast<AuthReqICQSubType*>(ist)->setMessage( v[n++] );
+	  break;
+	case MSG_Type_AuthRej:
+	  static_cast<AuthRejICQSubType*>(ist)->setMessage( v[n++] );
+	  break;
+	}
+      }
+      ++curr;
+    }
+  }
+
   FileTransferEvent* MessageHandler::handleIncomingFT(FTICQSubType *ist,
 						      bool direct)
   {
@@ -302,7 +477,7 @@ namespace ICQ2000
   /**
    *  Convert a UINICQSubType into an ICQMessageEvent
    */
-  ICQMessageEvent* MessageHandler::UINICQSubTypeToEvent(UINICQSubType *st, const ContactRef& contact)
+  ICQMessageEvent* MessageHandler::UINICQSubTypeToEvent(UINICQSubType *st, const ContactRef& contact, Translator *tr)
   {
     ICQMessageEvent *e = NULL;
     unsigned short type = st->getType();
@@ -313,7 +488,7 @@ namespace ICQ2000
     {
       NormalICQSubType *nst = static_cast<NormalICQSubType*>(st);
       e = new NormalMessageEvent(contact,
-				 m_translator->server_to_client( nst->getMessage(), ENCODING_CONTACT_LOCALE, contact ),
+				 tr->server_to_client( nst->getMessage(), ENCODING_CONTACT_LOCALE, contact ),
 				 nst->isMultiParty() );
       break;
     }
@@ -322,22 +497,22 @@ namespace ICQ2000
     {
       URLICQSubType *ust = static_cast<URLICQSubType*>(st);
       e = new URLMessageEvent(contact,
-			      m_translator->server_to_client( ust->getMessage(), ENCODING_CONTACT_LOCALE, contact ),
-			      m_translator->server_to_client( ust->getURL(), ENCODING_CONTACT_LOCALE, contact ));
+			      tr->server_to_client( ust->getMessage(), ENCODING_CONTACT_LOCALE, contact ),
+			      tr->server_to_client( ust->getURL(), ENCODING_CONTACT_LOCALE, contact ));
       break;
     }
 
     case MSG_Type_AuthReq:
     {
       AuthReqICQSubType *ust = static_cast<AuthReqICQSubType*>(st);
-      e = new AuthReqEvent(contact, m_translator->server_to_client( ust->getMessage(), ENCODING_CONTACT_LOCALE, contact ) );
+      e = new AuthReqEvent(contact, tr->server_to_client( ust->getMessage(), ENCODING_CONTACT_LOCALE, contact ) );
       break;
     }
 
     case MSG_Type_AuthRej:
     {
       AuthRejICQSubType *ust = static_cast<AuthRejICQSubType*>(st);
-      e = new AuthAckEvent(contact, m_translator->server_to_client( ust->getMessage(), ENCODING_CONTACT_LOCALE, contact ), false);
+      e = new AuthAckEvent(contact, tr->server_to_client( ust->getMessage(), ENCODING_CONTACT_LOCALE, contact ), false);
       break;
     }
 
@@ -387,7 +562,7 @@ namespace ICQ2000
   /**
    *  Convert an ICQSubType into a MessageEvent
    */
-  MessageEvent* MessageHandler::ICQSubTypeToEvent(ICQSubType *st, ContactRef& contact, bool& adv)
+  MessageEvent* MessageHandler::ICQSubTypeToEvent(ICQSubType *st, ContactRef& contact, bool& adv, Translator *tr)
   {
     MessageEvent *e = NULL;
 
@@ -411,7 +586,7 @@ namespace ICQ2000
       UINICQSubType *ist = static_cast<UINICQSubType*>(st);
       adv = ist->isAdvanced();
       contact = lookupUIN( ist->getSource() );
-      e = UINICQSubTypeToEvent(ist, contact);
+      e = UINICQSubTypeToEvent(ist, contact, tr);
       break;
     }
 
@@ -419,24 +594,24 @@ namespace ICQ2000
     {
       // these come from 'magic' UIN 10
       EmailExICQSubType *subtype = static_cast<EmailExICQSubType*>(st);
-      std::string email = m_translator->server_to_client( subtype->getEmail(), ENCODING_ISO_8859_1, contact );
+      std::string email = tr->server_to_client( subtype->getEmail(), ENCODING_ISO_8859_1, contact );
       contact = lookupEmail( email, subtype->getSender() );
       e = new EmailExEvent(contact,
 			   email,
-			   m_translator->server_to_client( subtype->getSender(), ENCODING_ISO_8859_1, contact ),
-			   m_translator->server_to_client( subtype->getMessage(), ENCODING_ISO_8859_1, contact ));
+			   tr->server_to_client( subtype->getSender(), ENCODING_ISO_8859_1, contact ),
+			   tr->server_to_client( subtype->getMessage(), ENCODING_ISO_8859_1, contact ));
       break;
     }
 
     case MSG_Type_WebPager:
     {
       WebPagerICQSubType *subtype = static_cast<WebPagerICQSubType*>(st);
-      std::string email = m_translator->server_to_client( subtype->getEmail(), ENCODING_ISO_8859_1, contact );
+      std::string email = tr->server_to_client( subtype->getEmail(), ENCODING_ISO_8859_1, contact );
       contact = lookupEmail( email, subtype->getSender() );
       e = new WebPagerEvent(contact,
 			    email,
-			    m_translator->server_to_client( subtype->getEmail(), ENCODING_ISO_8859_1, contact ),
-			    m_translator->server_to_client( subtype->getMessage(), ENCODING_ISO_8859_1, contact ));
+			    tr->server_to_client( subtype->getEmail(), ENCODING_ISO_8859_1, contact ),
+			    tr->server_to_client( subtype->getMessage(), ENCODING_ISO_8859_1, contact ));
       break;
     }
 
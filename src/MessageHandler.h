@@ -23,6 +23,7 @@
 #define MESSAGEHANDLER_H
 
 #include <time.h>
+#include <vector>
 
 #include "libicq2000/sigslot.h"
 
@@ -54,8 +55,19 @@ namespace ICQ2000
     Translator * & m_translator;
     /* a reference to the pointer in Client */
     
-    MessageEvent* ICQSubTypeToEvent(ICQSubType *st, ContactRef& contact, bool& adv);
-    ICQMessageEvent* UINICQSubTypeToEvent(UINICQSubType *st, const ContactRef& contact);
+    struct OfflineMessage {
+      ICQSubType *icq;
+      time_t time;
+      bool translated;
+    };
+
+    std::vector<OfflineMessage> m_offline;
+
+    MessageEvent* ICQSubTypeToEvent(ICQSubType *st, ContactRef& contact, bool& adv, Translator *tr);
+    ICQMessageEvent* UINICQSubTypeToEvent(UINICQSubType *st, const ContactRef& contact, Translator *tr);
+
+    void translateOfflineMessages();
+    static bool offline_message_before(const OfflineMessage& a, const OfflineMessage& b);
 
     ContactRef lookupUIN(unsigned int uin);
     ContactRef lookupEmail(const std::string& email, const std::string& alias);
@@ -67,9 +79,15 @@ namespace ICQ2000
     
   public:
     MessageHandler(ContactRef self, ContactTree *cl, Translator * & tr);
+    ~MessageHandler();
 
     // incoming messages
     bool handleIncoming(ICQSubType* icq, time_t t = 0);
+
+    // offline messages, gathered and signalled as one batch
+    void queueOfflineMessage(ICQSubType* icq, time_t t);
+    void flushOfflineMessages();
+    void dropOfflineMessages();
     FileTransferEvent* handleIncomingFT(FTICQSubType* icq, bool direct);
     
     // outgoing messages
@@ -85,6 +103,7 @@ namespace ICQ2000
     void handleIncomingFTCancel(FileTransferEvent *ev);
     
     sigslot::signal1<MessageEvent*> messaged;
+    sigslot::signal1<OfflineMessageBatchEvent*> offline_messages;
     sigslot::signal1<MessageEvent*> messageack;
     sigslot::signal1<ICQMessageEvent*> want_auto_resp;
     sigslot::signal1<LogEvent*> logger;
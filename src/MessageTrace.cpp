@@ -0,0 +1,222 @@
+/*
+ * MessageTrace
+ *
+ * Copyright (C) 2001 Barnaby Gray <barnaby@beedesign.co.uk>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#include "MessageTrace.h"
+
+#include <stdio.h>
+#include <sys/time.h>
+
+#include "events.h"
+#include "Contact.h"
+
+namespace ICQ2000 {
+
+  MessageTracer::MessageTracer()
+    : m_done_count(0), m_sample(0), m_count(0), m_next_id(0), m_capacity(1000)
+  { }
+
+  double MessageTracer::now_us()
+  {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000.0 + tv.tv_usec;
+  }
+
+  /*
+   * Each span runs from one mark to the next, and is named for the
+   * stage it ends at.
+   */
+  const char *MessageTracer::span_name(Stage st)
+  {
+    switch(st) {
+    case RouteDirect:
+    case RouteServer:  return "route";
+    case Write:        return "write";
+    case Ack:          return "ack wait";
+    case DirectFailed: return "direct failed";
+    case Emit:         return "deliver";
+    default:           return "send";
+    }
+  }
+
+  /*
+   * Trace one in every n messages, 0 to stop tracing.
+   */
+  void MessageTracer::setSampling(unsigned int n)
+  {
+    m_sample = n;
+    m_count = 0;
+    if (n == 0) m_open.clear();
+  }
+
+  unsigned int MessageTracer::getSampling() const { return m_sample; }
+
+  void MessageTracer::setCapacity(unsigned int n)
+  {
+    m_capacity = n;
+    while (m_done_count > m_capacity) {
+      m_done.pop_front();
+      --m_done_count;
+    }
+  }
+
+  // keep a finished trace, dropping the oldest over capacity
+  void MessageTracer::done(const Trace& t)
+  {
+    m_done.push_back(t);
+    if (++m_done_count > m_capacity) {
+      m_done.pop_front();
+      --m_done_count;
+    }
+  }
+
+  void MessageTracer::begin(MessageEvent *ev)
+  {
+    if (m_sample == 0) return;
+
+    // a new message may have been given an old one's address
+    m_open.erase(ev);
+    if (m_count++ % m_sample != 0) return;
+
+    Trace& t = m_open[ev];
+    t.id = ++m_next_id;
+    t.uin = ev->getContact()->getUIN();
+    mark(ev, Send);
+  }
+
+  /*
+   * Whether a message is being traced, so callers can skip working
+   * out what to pass to written() for the ones that aren't.
+   */
+  bool MessageTracer::traced(MessageEvent *ev) const
+  {
+    return !m_open.empty() && m_open.find(ev) != m_open.end();
+  }
+
+  void MessageTracer::mark(MessageEvent *ev, Stage st)
+  {
+    std::map<MessageEvent*, Trace>::iterator i = m_open.find(ev);
+    if (i == m_open.end()) return;
+
+    Mark m;
+    m.stage = st;
+    m.usec = now_us();
+    (*i).second.marks.push_back(m);
+  }
+
+  /*
+   * The message has been written to a socket, under the given ICBM
+   * cookie or sequence number. A message that went direct first and
+   * then through the server collects both.
+   */
+  void MessageTracer::written(MessageEvent *ev, const std::string& key)
+  {
+    std::map<MessageEvent*, Trace>::iterator i = m_open.find(ev);
+    if (i == m_open.end()) return;
+
+    std::string& k = (*i).second.key;
+    if (!k.empty() && !key.empty()) k += " ";
+    k += key;
+    mark(ev, Write);
+  }
+
+  void MessageTracer::finish(MessageEvent *ev)
+  {
+    std::map<MessageEvent*, Trace>::iterator i = m_open.find(ev);
+    if (i == m_open.end()) return;
+
+    mark(ev, Emit);
+    done( (*i).second );
+    m_open.erase(i);
+  }
+
+  unsigned int MessageTracer::size() const { return m_done_count; }
+
+  void MessageTracer::clear()
+  {
+    m_done.clear();
+    m_done_count = 0;
+  }
+
+  /*
+   * Write the finished traces out as trace event JSON. Each message
+   * is a complete event on its contact's track, with its stages as
+   * complete events nested inside it.
+   */
+  bool MessageTracer::write(const std::string& filename) const
+  {
+    FILE *f = fopen(filename.c_str(), "w");
+    if (f == NULL) return false;
+
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+    bool first = true;
+    std::list<Trace>::const_iterator curr = m_done.begin();
+    while (curr != m_done.end()) {
+      const Trace& t = *curr;
+      const Mark& start = t.marks.front();
+      const Mark& end = t.marks.back();
+
+      fprintf(f, "%s\n{\"name\":\"message\",\"cat\":\"message\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+	      "\"ts\":%.0f,\"dur\":%.0f,\"args\":{\"id\":%u,\"key\":\"%s\",\"acked\":%s}}",
+	      (first ? "" : ","), t.uin, start.usec, end.usec - start.usec,
+	      t.id, t.key.c_str(), (end.stage == Emit ? "true" : "false"));
+      first = false;
+
+      for (unsigned int n = 1; n < t.marks.size(); ++n) {
+	const Mark& a = t.marks[n-1];
+	const Mark& b = t.marks[n];
+	fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"stage\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+		"\"ts\":%.0f,\"dur\":%.0f,\"args\":{\"id\":%u",
+		span_name(b.stage), t.uin, a.usec, b.usec - a.usec, t.id);
+	if (b.stage == RouteDirect) fprintf(f, ",\"route\":\"direct\"");
+	if (b.stage == RouteServer) fprintf(f, ",\"route\":\"server\"");
+	fprintf(f, "}}");
+      }
+
+      ++curr;
+    }
+
+    fprintf(f, "\n]}\n");
+    return (fclose(f) == 0);
+  }
+
+  /*
+   * Messages that never got as far as messageack (a file transfer
+   * nobody answered, say) are finished off as they are after a
+   * while, and show up in the trace with the stages they got to.
+   */
+  void MessageTracer::clearoutPoll()
+  {
+    double cutoff = now_us() - 5 * 60 * 1000000.0;
+
+    std::map<MessageEvent*, Trace>::iterator i = m_open.begin();
+    while (i != m_open.end()) {
+      if ((*i).second.marks.front().usec < cutoff) {
+	done( (*i).second );
+	m_open.erase(i++);
+      } else {
+	++i;
+      }
+    }
+  }
+
+}
@@ -0,0 +1,102 @@
+/*
+ * MessageTrace
+ *
+ * Copyright (C) 2001 Barnaby Gray <barnaby@beedesign.co.uk>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#ifndef MESSAGETRACE_H
+#define MESSAGETRACE_H
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace ICQ2000 {
+
+  class MessageEvent;
+
+  /*
+   * Timestamps each stage an outgoing message goes through, from
+   * Client::SendEvent to the messageack signal, so slow deliveries
+   * can be pinned on a stage. A message is followed by its
+   * MessageEvent, as it passes through, and labelled with the ICBM
+   * cookie or direct connection sequence number it went out with.
+   *
+   * Only one in every so many messages is traced, so it can be left
+   * on. Finished traces are kept up to a limit, oldest dropped first,
+   * and written out in the trace event JSON format that
+   * chrome://tracing and Perfetto read.
+   */
+  class MessageTracer {
+   public:
+    enum Stage {
+      Send,          // Client::SendEvent
+      RouteDirect,   // decided to send direct
+      RouteServer,   // decided to send through the server
+      Write,         // written to the socket
+      Ack,           // ACK from the server or peer
+      DirectFailed,  // direct failed, to be resent through the server
+      Emit           // signalled on messageack
+    };
+
+   private:
+    struct Mark {
+      Stage stage;
+      double usec;
+    };
+
+    struct Trace {
+      unsigned int id, uin;
+      std::string key;
+      std::vector<Mark> marks;
+    };
+
+    std::map<MessageEvent*, Trace> m_open;
+    std::list<Trace> m_done;
+    unsigned int m_done_count;    // std::list::size() walks the list
+    unsigned int m_sample, m_count, m_next_id, m_capacity;
+
+    void done(const Trace& t);
+
+    static double now_us();
+    static const char *span_name(Stage st);
+
+   public:
+    MessageTracer();
+
+    void setSampling(unsigned int n);
+    unsigned int getSampling() const;
+    void setCapacity(unsigned int n);
+
+    void begin(MessageEvent *ev);
+    bool traced(MessageEvent *ev) const;
+    void mark(MessageEvent *ev, Stage st);
+    void written(MessageEvent *ev, const std::string& key);
+    void finish(MessageEvent *ev);
+
+    unsigned int size() const;
+    void clear();
+    bool write(const std::string& filename) const;
+
+    void clearoutPoll();
+  };
+
+}
+
+#endif
@@ -0,0 +1,106 @@
+/*
+ * Metrics
+ *
+ * Copyright (C) 2001 Barnaby Gray <barnaby@beedesign.co.uk>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#include "Metrics.h"
+
+namespace ICQ2000 {
+
+  const unsigned int LatencyHistogram::Bounds[LatencyHistogram::Buckets-1] =
+    { 10, 25, 50, 100, 250, 500, 1000, 2500, 5000 };
+
+  LatencyHistogram::LatencyHistogram()
+  {
+    clear();
+  }
+
+  void LatencyHistogram::add(unsigned int ms)
+  {
+    unsigned int n = 0;
+    while (n < Buckets-1 && ms > Bounds[n]) ++n;
+    ++bucket[n];
+
+    ++count;
+    total += ms;
+    if (ms > max) max = ms;
+  }
+
+  void LatencyHistogram::clear()
+  {
+    for (unsigned int n = 0; n < Buckets; ++n) bucket[n] = 0;
+    count = 0;
+    max = 0;
+    total = 0;
+  }
+
+  /**
+   *  get the mean latency in ms
+   */
+  unsigned int LatencyHistogram::mean() const
+  {
+    return (count == 0 ? 0 : total / count);
+  }
+
+  /**
+   *  get an upper bound on the p'th percentile latency in ms, to the
+   *  resolution of the buckets
+   *
+   * @param p percentile, 0-100
+   */
+  unsigned int LatencyHistogram::percentile(unsigned int p) const
+  {
+    if (count == 0) return 0;
+
+    unsigned long want = ((unsigned long)count * p + 99) / 100, seen = 0;
+    for (unsigned int n = 0; n < Buckets-1; ++n) {
+      seen += bucket[n];
+      if (seen >= want) return (Bounds[n] < max ? Bounds[n] : max);
+    }
+    return max;
+  }
+
+  Metrics::Metrics()
+  {
+    clear();
+  }
+
+  /**
+   *  zero all the counters, and start counting again from now
+   */
+  void Metrics::clear()
+  {
+    since = time(NULL);
+
+    for (unsigned int n = 0; n < Channels; ++n) {
+      packets_in[n] = packets_out[n] = 0;
+      bytes_in[n] = bytes_out[n] = 0;
+    }
+    for (unsigned int n = 0; n < Families; ++n) snacs_in[n] = 0;
+
+    parse_errors = seq_errors = resyncs = 0;
+    dc_connects = dc_failures = 0;
+    ack_latency_server.clear();
+    ack_latency_direct.clear();
+
+    userinfo_queue = dc_queue = 0;
+    reqid_cache = cookie_cache = dc_cache = ft_cache = 0;
+  }
+
+}
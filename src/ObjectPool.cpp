@@ -0,0 +1,110 @@
+/*
+ * ObjectPool
+ *
+ * Copyright (C) 2001 Barnaby Gray <barnaby@beedesign.co.uk>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#include "ObjectPool.h"
+
+#include <new>
+
+namespace ICQ2000 {
+
+  ObjectPool::ObjectPool(size_t max_size, size_t granularity, unsigned int max_free)
+    : m_max_size(max_size), m_granularity(granularity), m_max_free(max_free),
+      m_allocs(0), m_reuses(0)
+  {
+    // a free block must be able to hold the list link
+    if (m_granularity < sizeof(FreeBlock)) m_granularity = sizeof(FreeBlock);
+
+    size_t n = bucket_index(m_max_size) + 1;
+    m_buckets = new Bucket[n];
+    for (size_t i = 0; i < n; ++i) {
+      m_buckets[i].head = NULL;
+      m_buckets[i].free = 0;
+    }
+  }
+
+  ObjectPool::~ObjectPool()
+  {
+    purge();
+    delete [] m_buckets;
+  }
+
+  size_t ObjectPool::bucket_index(size_t n) const
+  {
+    if (n == 0) n = 1;
+    return (n - 1) / m_granularity;
+  }
+
+  void* ObjectPool::allocate(size_t n)
+  {
+    ++m_allocs;
+    if (n > m_max_size) return ::operator new(n);
+
+    Bucket& bk = m_buckets[ bucket_index(n) ];
+    if (bk.head != NULL) {
+      FreeBlock *fb = bk.head;
+      bk.head = fb->next;
+      --bk.free;
+      ++m_reuses;
+      return fb;
+    }
+
+    // round up, so the block can be reused for anything in its bucket
+    return ::operator new( (bucket_index(n) + 1) * m_granularity );
+  }
+
+  void ObjectPool::deallocate(void *p, size_t n)
+  {
+    if (p == NULL) return;
+
+    if (n > m_max_size) {
+      ::operator delete(p);
+      return;
+    }
+
+    Bucket& bk = m_buckets[ bucket_index(n) ];
+    if (bk.free >= m_max_free) {
+      ::operator delete(p);
+      return;
+    }
+
+    FreeBlock *fb = static_cast<FreeBlock*>(p);
+    fb->next = bk.head;
+    bk.head = fb;
+    ++bk.free;
+  }
+
+  /**
+   *  Hand all cached blocks back to the system.
+   */
+  void ObjectPool::purge()
+  {
+    size_t n = bucket_index(m_max_size) + 1;
+    for (size_t i = 0; i < n; ++i) {
+      while (m_buckets[i].head != NULL) {
+	FreeBlock *fb = m_buckets[i].head;
+	m_buckets[i].head = fb->next;
+	::operator delete(fb);
+      }
+      m_buckets[i].free = 0;
+    }
+  }
+
+}
@@ -0,0 +1,83 @@
+/*
+ * ObjectPool
+ *
+ * Copyright (C) 2001 Barnaby Gray <barnaby@beedesign.co.uk>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#ifndef OBJECTPOOL_H
+#define OBJECTPOOL_H
+
+#include <stddef.h>
+
+namespace ICQ2000 {
+
+  /*
+   * Size-bucketed free-list allocator.
+   *
+   * Classes that are created and destroyed once per message
+   * (MessageEvents, ICQSubTypes) route their class operator new/delete
+   * through one of these, so that steady message traffic recycles the
+   * same blocks instead of going to malloc/free for every packet.
+   *
+   * Requests are rounded up to the granularity and served from the
+   * matching bucket. Anything larger than max_size goes straight to
+   * ::operator new. At most max_free blocks are kept per bucket, the
+   * rest are handed back to the system on deallocate.
+   *
+   * The library is single-threaded, so no locking is done.
+   */
+  class ObjectPool
+  {
+   private:
+    struct FreeBlock {
+      FreeBlock *next;
+    };
+
+    struct Bucket {
+      FreeBlock *head;
+      unsigned int free;
+    };
+
+    size_t m_max_size, m_granularity;
+    unsigned int m_max_free;
+    Bucket *m_buckets;
+
+    unsigned int m_allocs, m_reuses;
+
+    size_t bucket_index(size_t n) const;
+
+    // not copyable
+    ObjectPool(const ObjectPool&);
+    ObjectPool& operator=(const ObjectPool&);
+    
+   public:
+    ObjectPool(size_t max_size, size_t granularity = 16, unsigned int max_free = 64);
+    ~ObjectPool();
+
+    void* allocate(size_t n);
+    void deallocate(void *p, size_t n);
+
+    void purge();
+
+    unsigned int getAllocations() const { return m_allocs; }
+    unsigned int getReuses() const { return m_reuses; }
+  };
+
+}
+
+#endif
@@ -0,0 +1,323 @@
+/*
+ * PresenceTable
+ *
+ * Copyright (C) 2001 Barnaby Gray <barnaby@beedesign.co.uk>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#include "PresenceTable.h"
+
+#include "Contact.h"
+
+using std::vector;
+
+namespace ICQ2000 {
+
+  PresenceTable::StatusCounts::StatusCounts()
+  {
+    for (unsigned int n = 0; n <= STATUS_OFFLINE; ++n) count[n] = 0;
+  }
+
+  /**
+   *  number of contacts not offline
+   */
+  unsigned int PresenceTable::StatusCounts::online() const
+  {
+    return total() - count[STATUS_OFFLINE];
+  }
+
+  unsigned int PresenceTable::StatusCounts::total() const
+  {
+    unsigned int ret = 0;
+    for (unsigned int n = 0; n <= STATUS_OFFLINE; ++n) ret += count[n];
+    return ret;
+  }
+
+  PresenceTable::PresenceTable()
+  { }
+
+  PresenceTable::~PresenceTable()
+  {
+    for (unsigned int n = 0; n < m_contact.size(); ++n)
+      detach(m_contact[n]);
+  }
+
+  /*
+   * Where a contact keeps the number of its row in this table, NULL if
+   * it hasn't one.
+   */
+  const unsigned int *PresenceTable::row_of(const Contact *c) const
+  {
+    if (c->m_presence == this) return &(c->m_presence_row);
+    if (c->m_presence_more == NULL) return NULL;
+
+    for (unsigned int n = 0; n < c->m_presence_more->size(); ++n)
+      if ((*c->m_presence_more)[n].first == this) return &((*c->m_presence_more)[n].second);
+    return NULL;
+  }
+
+  unsigned int *PresenceTable::row_of(Contact *c)
+  {
+    if (c->m_presence == this) return &(c->m_presence_row);
+    if (c->m_presence_more == NULL) return NULL;
+
+    for (unsigned int n = 0; n < c->m_presence_more->size(); ++n)
+      if ((*c->m_presence_more)[n].first == this) return &((*c->m_presence_more)[n].second);
+    return NULL;
+  }
+
+  // give a contact a row in this table
+  void PresenceTable::attach(Contact *c, unsigned int row)
+  {
+    if (c->m_presence == NULL) {
+      c->m_presence = this;
+      c->m_presence_row = row;
+      return;
+    }
+
+    if (c->m_presence_more == NULL)
+      c->m_presence_more = new vector< std::pair<PresenceTable*, unsigned int> >();
+    c->m_presence_more->push_back( std::make_pair(this, row) );
+  }
+
+  // take away a contact's row in this table
+  void PresenceTable::detach(Contact *c)
+  {
+    vector< std::pair<PresenceTable*, unsigned int> > *more = c->m_presence_more;
+
+    if (c->m_presence == this) {
+      if (more == NULL) {
+	c->m_presence = NULL;
+	return;
+      }
+      c->m_presence = more->back().first;
+      c->m_presence_row = more->back().second;
+      more->pop_back();
+    } else if (more != NULL) {
+      for (unsigned int n = 0; n < more->size(); ++n) {
+	if ((*more)[n].first == this) {
+	  (*more)[n] = more->back();
+	  more->pop_back();
+	  break;
+	}
+      }
+    }
+
+    if (more != NULL && more->empty()) {
+      delete more;
+      c->m_presence_more = NULL;
+    }
+  }
+
+  /**
+   *  Add a row for a contact, or if it has one already move it to
+   *  the group.
+   */
+  void PresenceTable::add(Contact *c, unsigned short group_id)
+  {
+    unsigned int *r = row_of(c);
+    if (r != NULL) {
+      unsigned int row = *r;
+      count(m_group_id[row], m_status[row], -1);
+      m_group_id[row] = group_id;
+      count(group_id, m_status[row], 1);
+      return;
+    }
+
+    attach(c, m_contact.size());
+
+    m_uin.push_back(0);
+    m_status.push_back(STATUS_OFFLINE);
+    m_invisible.push_back(0);
+    m_last_status_change_time.push_back(0);
+    m_group_id.push_back(group_id);
+    m_contact.push_back(c);
+    count(group_id, STATUS_OFFLINE, 1);
+
+    update(c);
+  }
+
+  /**
+   *  Remove a contact's row. The last row is moved into its place.
+   */
+  void PresenceTable::remove(Contact *c)
+  {
+    unsigned int *r = row_of(c);
+    if (r == NULL) return;
+
+    unsigned int row = *r, last = m_contact.size() - 1;
+    count(m_group_id[row], m_status[row], -1);
+    if (row != last) {
+      m_uin[row] = m_uin[last];
+      m_status[row] = m_status[last];
+      m_invisible[row] = m_invisible[last];
+      m_last_status_change_time[row] = m_last_status_change_time[last];
+      m_group_id[row] = m_group_id[last];
+      m_contact[row] = m_contact[last];
+      *row_of(m_contact[row]) = row;
+    }
+
+    m_uin.pop_back();
+    m_status.pop_back();
+    m_invisible.pop_back();
+    m_last_status_change_time.pop_back();
+    m_group_id.pop_back();
+    m_contact.pop_back();
+
+    detach(c);
+  }
+
+  /**
+   *  Remove every row.
+   */
+  void PresenceTable::clear()
+  {
+    for (unsigned int n = 0; n < m_contact.size(); ++n)
+      detach(m_contact[n]);
+
+    m_uin.clear();
+    m_status.clear();
+    m_invisible.clear();
+    m_last_status_change_time.clear();
+    m_group_id.clear();
+    m_contact.clear();
+    m_counts.clear();
+  }
+
+  /**
+   *  Copy a contact's presence into its row.
+   */
+  void PresenceTable::update(const Contact *c)
+  {
+    const unsigned int *r = row_of(c);
+    if (r == NULL) return;
+
+    unsigned int row = *r;
+    if (m_status[row] != c->getStatus()) {
+      count(m_group_id[row], m_status[row], -1);
+      count(m_group_id[row], c->getStatus(), 1);
+    }
+
+    m_uin[row] = c->getUIN();
+    m_status[row] = c->getStatus();
+    m_invisible[row] = c->isInvisible();
+    m_last_status_change_time[row] = c->get_last_status_change_time();
+  }
+
+  unsigned int PresenceTable::size() const
+  {
+    return m_uin.size();
+  }
+
+  bool PresenceTable::empty() const
+  {
+    return m_uin.empty();
+  }
+
+  /**
+   *  number of contacts not offline
+   */
+  unsigned int PresenceTable::online_count() const
+  {
+    unsigned int ret = 0;
+    const unsigned int n = m_status.size();
+    for (unsigned int i = 0; i < n; ++i)
+      ret += (m_status[i] != STATUS_OFFLINE);
+    return ret;
+  }
+
+  /**
+   *  get the uins of all the contacts not offline
+   *
+   * @param uins appended to
+   */
+  void PresenceTable::online(vector<unsigned int>& uins) const
+  {
+    const unsigned int n = m_status.size();
+    for (unsigned int i = 0; i < n; ++i)
+      if (m_status[i] != STATUS_OFFLINE) uins.push_back(m_uin[i]);
+  }
+
+  /**
+   *  get the uins of all the contacts with a status
+   *
+   * @param st the status
+   * @param uins appended to
+   */
+  void PresenceTable::with_status(Status st, vector<unsigned int>& uins) const
+  {
+    const unsigned int n = m_status.size();
+    for (unsigned int i = 0; i < n; ++i)
+      if (m_status[i] == st) uins.push_back(m_uin[i]);
+  }
+
+  /**
+   *  get the uins of all the contacts whose status has changed since
+   *  a time
+   *
+   * @param t the time, as from time()
+   * @param uins appended to
+   */
+  void PresenceTable::changed_since(unsigned int t, vector<unsigned int>& uins) const
+  {
+    const unsigned int n = m_last_status_change_time.size();
+    for (unsigned int i = 0; i < n; ++i)
+      if (m_last_status_change_time[i] >= t) uins.push_back(m_uin[i]);
+  }
+
+  void PresenceTable::count(unsigned short group_id, unsigned char status, int d)
+  {
+    StatusCounts& c = m_counts[group_id];
+    c.count[status] += d;
+    if (d < 0 && c.total() == 0) m_counts.erase(group_id);
+  }
+
+  /**
+   *  count the contacts with each status
+   */
+  PresenceTable::StatusCounts PresenceTable::status_counts() const
+  {
+    StatusCounts ret;
+    GroupCounts::const_iterator curr = m_counts.begin();
+    while (curr != m_counts.end()) {
+      for (unsigned int n = 0; n <= STATUS_OFFLINE; ++n)
+	ret.count[n] += (*curr).second.count[n];
+      ++curr;
+    }
+    return ret;
+  }
+
+  /**
+   *  count the contacts in a group with each status
+   */
+  PresenceTable::StatusCounts PresenceTable::status_counts(unsigned short group_id) const
+  {
+    GroupCounts::const_iterator i = m_counts.find(group_id);
+    if (i == m_counts.end()) return StatusCounts();
+    return (*i).second;
+  }
+
+  /**
+   *  get the counts of contacts with each status, for every group
+   *  with contacts in
+   */
+  const PresenceTable::GroupCounts& PresenceTable::group_status_counts() const
+  {
+    return m_counts;
+  }
+
+}
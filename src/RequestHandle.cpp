@@ -0,0 +1,65 @@
+/*
+ * RequestHandle
+ *
+ * Copyright (C) 2001 Barnaby Gray <barnaby@beedesign.co.uk>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#include "RequestHandle.h"
+
+namespace ICQ2000 {
+
+  RequestHandle::RequestHandle(Type t)
+    : count(0), m_type(t), m_state(Pending), m_reqid(0)
+  { }
+
+  RequestHandle::RequestHandle(Type t, ContactRef c)
+    : count(0), m_type(t), m_state(Pending), m_reqid(0), m_contact(c)
+  { }
+
+  RequestHandle::Type RequestHandle::getType() const { return m_type; }
+
+  RequestHandle::State RequestHandle::getState() const { return m_state; }
+
+  bool RequestHandle::isDone() const { return m_state != Pending; }
+
+  /**
+   *  get the request id the request was sent with, 0 if it hasn't
+   *  been sent yet
+   */
+  unsigned int RequestHandle::getRequestID() const { return m_reqid; }
+
+  /**
+   *  get the contact the request is about, for user info requests
+   */
+  ContactRef RequestHandle::getContact() const { return m_contact; }
+
+  void RequestHandle::setRequestID(unsigned int reqid) { m_reqid = reqid; }
+
+  /**
+   *  Complete the request. Only the first call has any effect.
+   *
+   * @param st the final state
+   */
+  void RequestHandle::finish(State st)
+  {
+    if (m_state != Pending || st == Pending) return;
+    m_state = st;
+    completed.emit(this);
+  }
+
+}
@@ -22,24 +22,34 @@
 #ifndef REQUESTIDCACHE_H
 #define REQUESTIDCACHE_H
 
+#include <vector>
+
 #include "Cache.h"
 
 #include "libicq2000/sigslot.h"
+#include "libicq2000/RequestHandle.h"
 
 namespace ICQ2000 {
 
   class RequestIDCacheValue {
+   private:
+    RequestHandleRef m_handle;
+
    public:
     enum Type {
       UserInfo,
       SMSMessage,
       Search,
-      ServerBasedContact
+      ServerBasedContact,
+      Cancelled
     };
 
     virtual ~RequestIDCacheValue() { }
 
     virtual Type getType() const = 0;
+
+    RequestHandleRef getHandle() const { return m_handle; }
+    void setHandle(const RequestHandleRef& h) { m_handle = h; }
   };
 
   class UserInfoCacheValue : public RequestIDCacheValue {
@@ -77,22 +87,89 @@ namespace ICQ2000 {
     Type getType() const { return Search; }
   };
 
-  /*  class ServerBasedContactCacheValue : public RequestIDCacheValue {
+  /*
+   * Stands in for a request that has been given up on, so replies
+   * still arriving for it are dropped quietly until it times out.
+   * For a server-based list edit it counts down the entries still to
+   * be ACKed, so it can go once the last EditACK is in.
+   */
+  class CancelledCacheValue : public RequestIDCacheValue {
+   private:
+    unsigned int m_outstanding;
+
+   public:
+    CancelledCacheValue(unsigned int outstanding = 0) : m_outstanding(outstanding) { }
+    Type getType() const { return Cancelled; }
+
+    // true once the last outstanding entry is ACKed
+    bool acked(unsigned int n)
+    {
+      if (m_outstanding == 0) return false;
+      m_outstanding = (n < m_outstanding ? m_outstanding - n : 0);
+      return (m_outstanding == 0);
+    }
+  };
+
+  /*
+   * One server-based list edit transaction. Every SNAC in it is sent
+   * with the same request id, the server ACKs each entry in the order
+   * sent, so the entries are kept in that order here and matched up
+   * one by one as the EditACKs come in.
+   */
+  class ServerBasedContactCacheValue : public RequestIDCacheValue {
+   public:
+    enum ItemType {
+      Contact_Add,
+      Contact_Remove,
+      Group_Add,
+      Group_Remove,
+      Group_Update
+    };
+
+    struct Item {
+      ItemType type;
+      ContactRef contact;
+      unsigned short group_id;
+    };
+
    private:
     ServerBasedContactEvent *m_ev;
+    std::vector<Item> m_items;
+    unsigned int m_acked;
 
    public:
-    ServerBasedContactCacheValue( ServerBasedContactEvent *ev ) : m_ev(ev) { }
+    ServerBasedContactCacheValue( ServerBasedContactEvent *ev ) : m_ev(ev), m_acked(0) { }
+    virtual ~ServerBasedContactCacheValue() { delete m_ev; }
     ServerBasedContactEvent *getEvent() const { return m_ev; }
+
+    void addItem(ItemType t, const ContactRef& c, unsigned short group_id)
+    {
+      Item i;
+      i.type = t;
+      i.contact = c;
+      i.group_id = group_id;
+      m_items.push_back(i);
+    }
+
+    unsigned int size() const { return m_items.size(); }
+    unsigned int remaining() const { return m_items.size() - m_acked; }
+    bool isFinished() const { return m_acked >= m_items.size(); }
+    Item& nextItem() { return m_items[m_acked++]; }
+
     Type getType() const { return ServerBasedContact; }
   };
-  */
 
   class RequestIDCache : public Cache<unsigned int, RequestIDCacheValue*> {
    public:
     RequestIDCache() { }
     ~RequestIDCache()
     {
+      // too late to be telling anyone
+      literator curr = m_list.begin();
+      while (curr != m_list.end()) {
+	(*curr).getValue()->setHandle( RequestHandleRef() );
+	++curr;
+      }
       removeAll();
     }
 
@@ -100,12 +177,21 @@ namespace ICQ2000 {
     
     void expireItem(const RequestIDCache::literator& l) {
       expired.emit( (*l).getValue() );
+
+      RequestHandleRef h = (*l).getValue()->getHandle();
+      if (h.get() != NULL) h->finish(RequestHandle::Expired);
       Cache<unsigned int, RequestIDCacheValue*>::expireItem(l);
     }
 
+    /*
+     * A request removed other than by expiring has had its last reply,
+     * its handle completes once the entry is gone.
+     */
     void removeItem(const RequestIDCache::literator& l) {
+      RequestHandleRef h = (*l).getValue()->getHandle();
       delete ((*l).getValue());
       Cache<unsigned int, RequestIDCacheValue*>::removeItem(l);
+      if (h.get() != NULL) h->finish(RequestHandle::Completed);
     }
 
   };
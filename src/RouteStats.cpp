@@ -0,0 +1,161 @@
+/*
+ * RouteStats
+ *
+ * Copyright (C) 2001 Barnaby Gray <barnaby@beedesign.co.uk>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#include "RouteStats.h"
+
+#include <sys/time.h>
+
+#include "events.h"
+#include "Contact.h"
+
+namespace ICQ2000 {
+
+  RouteStats::PathStats::PathStats()
+    : srtt(0), sent(0), acked(0), failed(0),
+      consecutive_failures(0), retry_at(0)
+  { }
+
+  unsigned long RouteStats::now_ms()
+  {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000UL + tv.tv_usec / 1000;
+  }
+
+  void RouteStats::sent(MessageEvent *ev, Route r)
+  {
+    Pending p;
+    p.uin = ev->getContact()->getUIN();
+    p.route = r;
+    p.start = now_ms();
+    m_pending[ ev->getSerial() ] = p;
+
+    ++(m_contacts[p.uin].path[r].sent);
+  }
+
+  /*
+   * Returns false for a message that wasn't waiting on an ACK,
+   * otherwise the route it went and how long the ACK took, in ms.
+   */
+  bool RouteStats::acked(MessageEvent *ev, Route& r, unsigned int& rtt)
+  {
+    std::map<unsigned int, Pending>::iterator i = m_pending.find( ev->getSerial() );
+    if (i == m_pending.end()) return false;
+
+    r = (*i).second.route;
+    PathStats& ps = m_contacts[ (*i).second.uin ].path[r];
+    rtt = now_ms() - (*i).second.start;
+
+    // same smoothing as TCP's srtt, 1/8 of each new sample
+    if (ps.acked == 0) ps.srtt = rtt;
+    else ps.srtt = (7 * ps.srtt + rtt) / 8;
+
+    ++ps.acked;
+    ps.consecutive_failures = 0;
+    ps.retry_at = 0;
+
+    m_pending.erase(i);
+    return true;
+  }
+
+  void RouteStats::failed(MessageEvent *ev, Route r)
+  {
+    std::map<unsigned int, Pending>::iterator i = m_pending.find( ev->getSerial() );
+    if (i != m_pending.end()) {
+      failed( (*i).second.uin, (*i).second.route );
+      m_pending.erase(i);
+    } else {
+      failed( ev->getContact()->getUIN(), r );
+    }
+  }
+
+  void RouteStats::failed(unsigned int uin, Route r)
+  {
+    PathStats& ps = m_contacts[uin].path[r];
+    ++ps.failed;
+    ++ps.consecutive_failures;
+
+    if (ps.consecutive_failures >= DegradeAfter) {
+      unsigned int backoff = MinBackoff;
+      for (unsigned int n = DegradeAfter; n < ps.consecutive_failures && backoff < MaxBackoff; ++n)
+	backoff *= 2;
+      if (backoff > MaxBackoff) backoff = MaxBackoff;
+      ps.retry_at = time(NULL) + backoff;
+    }
+  }
+
+  /*
+   * Whether a path is worth trying, either because it isn't degraded
+   * or because it is due a probe.
+   */
+  bool RouteStats::usable(unsigned int uin, Route r) const
+  {
+    std::map<unsigned int, ContactRoutes>::const_iterator i = m_contacts.find(uin);
+    if (i == m_contacts.end()) return true;
+
+    const PathStats& ps = (*i).second.path[r];
+    return ps.consecutive_failures < DegradeAfter || time(NULL) >= ps.retry_at;
+  }
+
+  /*
+   * Expected time to delivery in ms. Paths not tried yet come out as
+   * 0, so they get tried.
+   */
+  unsigned int RouteStats::expected(unsigned int uin, Route r) const
+  {
+    std::map<unsigned int, ContactRoutes>::const_iterator i = m_contacts.find(uin);
+    if (i == m_contacts.end()) return 0;
+
+    const PathStats& ps = (*i).second.path[r];
+    unsigned int done = ps.acked + ps.failed;
+    if (done == 0) return 0;
+
+    return ps.srtt + (unsigned int)((double)FailurePenalty * ps.failed / done);
+  }
+
+  RouteStats::PathStats RouteStats::get(unsigned int uin, Route r) const
+  {
+    std::map<unsigned int, ContactRoutes>::const_iterator i = m_contacts.find(uin);
+    if (i == m_contacts.end()) return PathStats();
+    return (*i).second.path[r];
+  }
+
+  void RouteStats::reset(unsigned int uin)
+  {
+    m_contacts.erase(uin);
+  }
+
+  /*
+   * Messages that never got an ack or a failure (a cancelled file
+   * transfer, say) shouldn't be kept forever.
+   */
+  void RouteStats::clearoutPoll()
+  {
+    unsigned long cutoff = now_ms() - 5 * 60 * 1000UL;
+
+    std::map<unsigned int, Pending>::iterator i = m_pending.begin();
+    while (i != m_pending.end()) {
+      if ((*i).second.start < cutoff) m_pending.erase(i++);
+      else ++i;
+    }
+  }
+
+}
@@ -0,0 +1,100 @@
+/*
+ * RouteStats
+ *
+ * Copyright (C) 2001 Barnaby Gray <barnaby@beedesign.co.uk>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#ifndef ROUTESTATS_H
+#define ROUTESTATS_H
+
+#include <map>
+#include <time.h>
+
+namespace ICQ2000 {
+
+  class MessageEvent;
+
+  /*
+   * Delivery statistics per contact for the two ways of sending a
+   * message that get acknowledged: direct, and advanced through the
+   * server. Client uses them to pick the path with the lowest
+   * expected latency, counting failures as a timeout's worth of
+   * delay.
+   *
+   * A path that fails repeatedly is degraded: it isn't used again
+   * until a backoff period has passed, after which one message is
+   * allowed through as a probe. Each failed probe doubles the
+   * backoff, a success clears it.
+   */
+  class RouteStats {
+   public:
+    enum Route {
+      Direct,
+      Advanced,
+      Route_Count
+    };
+
+    struct PathStats {
+      unsigned int srtt;                 // smoothed round trip, in ms
+      unsigned int sent, acked, failed;
+      unsigned int consecutive_failures;
+      time_t retry_at;                   // degraded until then
+
+      PathStats();
+    };
+
+   private:
+    struct Pending {
+      unsigned int uin;
+      Route route;
+      unsigned long start;
+    };
+
+    struct ContactRoutes {
+      PathStats path[Route_Count];
+    };
+
+    std::map<unsigned int, ContactRoutes> m_contacts;
+    // by MessageEvent serial - pooled events reuse addresses
+    std::map<unsigned int, Pending> m_pending;
+
+    static unsigned long now_ms();
+    void failed(unsigned int uin, Route r);
+
+   public:
+    // failures this many in a row degrade a path
+    static const unsigned int DegradeAfter = 2;
+    static const unsigned int FailurePenalty = 30000;
+    static const unsigned int MinBackoff = 60;
+    static const unsigned int MaxBackoff = 1800;
+
+    void sent(MessageEvent *ev, Route r);
+    bool acked(MessageEvent *ev, Route& r, unsigned int& rtt);
+    void failed(MessageEvent *ev, Route r);
+
+    bool usable(unsigned int uin, Route r) const;
+    unsigned int expected(unsigned int uin, Route r) const;
+    PathStats get(unsigned int uin, Route r) const;
+
+    void reset(unsigned int uin);
+    void clearoutPoll();
+  };
+
+}
+
+#endif
@@ -0,0 +1,92 @@
+/*
+ * SBLEdit - a server-based list edit transaction
+ *
+ * Copyright (C) 2001 Barnaby Gray <barnaby@beedesign.co.uk>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#ifndef SBLEDIT_H
+#define SBLEDIT_H
+
+#include <list>
+#include <set>
+#include <utility>
+
+#include "SNAC-SBL.h"
+
+namespace ICQ2000 {
+
+  /*
+   * The changes making up one edit of the server-based list, as
+   * worked out by diffing the ContactTree against what the server
+   * holds. Client packs these into as few Add/Remove/Update Entry
+   * SNACs as it can, between a single Begin and Commit Edit.
+   *
+   * A contact moving group is both removed (from its old group) and
+   * added (to its new one), as the server has no move operation.
+   */
+  class SBLEdit
+  {
+   public:
+    typedef std::pair<ContactRef, unsigned short> ContactEntry;
+
+    // rough limit on the size of one Add/Remove/Update Entry SNAC
+    static const unsigned int MaxSNACBytes = 7000;
+
+    std::list<SBLGroupEntry> add_groups, remove_groups;
+
+    // contacts to add, with the group they are to go in
+    std::list<ContactEntry> add_contacts;
+
+    // contacts to remove, from the group the server has them in
+    std::list<ContactRef> remove_contacts;
+
+    // groups whose list of members changes
+    std::set<unsigned short> touched_groups;
+
+    void addContact(const ContactRef& c, unsigned short group_id)
+    {
+      add_contacts.push_back( ContactEntry(c, group_id) );
+      touched_groups.insert(group_id);
+    }
+
+    void removeContact(const ContactRef& c)
+    {
+      remove_contacts.push_back(c);
+      touched_groups.insert( c->getServerSideGroupID() );
+    }
+
+    void addGroup(const std::string& label, unsigned short group_id)
+    {
+      add_groups.push_back( SBLGroupEntry(label, group_id) );
+    }
+
+    void removeGroup(const std::string& label, unsigned short group_id)
+    {
+      remove_groups.push_back( SBLGroupEntry(label, group_id) );
+    }
+
+    bool empty() const
+    {
+      return add_groups.empty() && remove_groups.empty()
+	&& add_contacts.empty() && remove_contacts.empty();
+    }
+  };
+
+}
+
+#endif
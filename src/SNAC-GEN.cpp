@@ -22,6 +22,7 @@
 #include "SNAC-GEN.h"
 
 #include "TLV.h"
+#include "TLVSchema.h"
 #include "buffer.h"
 
 namespace ICQ2000 {
@@ -114,14 +115,15 @@ namespace ICQ2000 {
     : m_status(status), m_sendextra(false), m_web_aware(web_aware) { }
 
   void SetStatusSNAC::OutputBody(Buffer& b) const {
-    StatusTLV stlv(ALLOWDIRECT_EVERYONE, (m_web_aware ? WEBAWARE_WEBAWARE : WEBAWARE_NORMAL), m_status);
-    b << stlv;
+    Schema::Record<Schema::SetStatus> tlvs;
+    Schema::set<Schema::Status>(tlvs, Schema::StatusValue(ALLOWDIRECT_EVERYONE,
+							   (m_web_aware ? WEBAWARE_WEBAWARE : WEBAWARE_NORMAL),
+							   m_status));
     if (m_sendextra) {
-      UnknownTLV utlv;
-      b << utlv;
-      LANDetailsTLV ltlv(m_ip, m_port);
-      b << ltlv;
+      Schema::set<Schema::Unknown>(tlvs, 0);
+      Schema::set<Schema::LANDetails>(tlvs, Schema::LANDetailsValue(m_ip, m_port));
     }
+    tlvs.output(b);
   }
 
   void SetStatusSNAC::setSendExtra(bool b) { m_sendextra = b; }
@@ -31,6 +31,13 @@ namespace ICQ2000 {
 
   // --------------- Server-based Lists (Family 0x0013) SNACs --------------
 
+  const unsigned short Entry_UIN        = 0x0000;
+  const unsigned short Entry_Group      = 0x0001;
+  const unsigned short Entry_VisSetting = 0x0004;
+  const unsigned short Entry_ICQTIC     = 0x0009;
+  const unsigned short Entry_Invisible  = 0x000e;
+  const unsigned short Entry_ImportTime = 0x0013;
+
   // ============================================================================
   //  Request SBL rights
   // ============================================================================
@@ -50,8 +57,37 @@ namespace ICQ2000 {
   
   void SBLRightsReplySNAC::ParseBody(Buffer& b) 
   {
-    TLVList tlvlist;
-    tlvlist.Parse(b, TLV_ParseMode_SBL_Rights, (unsigned short)-1);
+    /* TLV 0x0004 is an array of the maximum number of items allowed
+     * for each entry type, indexed by the type. Nothing else in here
+     * is of interest.
+     */
+    while (b.remains() >= 4) {
+      unsigned short type, len;
+      b >> type
+	>> len;
+
+      if (type == 0x0004) {
+	m_max_items.clear();
+	for (unsigned short i = 0; i + 1 < len; i += 2) {
+	  unsigned short m;
+	  b >> m;
+	  m_max_items.push_back(m);
+	}
+	if (len % 2) b.advance(1);
+      } else {
+	b.advance(len);
+      }
+    }
+  }
+
+  unsigned short SBLRightsReplySNAC::getMaxContacts() const
+  {
+    return (m_max_items.size() > Entry_UIN ? m_max_items[Entry_UIN] : 0);
+  }
+
+  unsigned short SBLRightsReplySNAC::getMaxGroups() const
+  {
+    return (m_max_items.size() > Entry_Group ? m_max_items[Entry_Group] : 0);
   }
   
   // ============================================================================
@@ -65,19 +101,33 @@ namespace ICQ2000 {
     // empty
   }
 
+  // ============================================================================
+  //  Conditional SBL list request
+  // ============================================================================
+
+  /*
+   * The server replies with SBLListUnchanged if its copy still has
+   * this modification time and number of items, otherwise with the
+   * full list as for SBLRequestList.
+   */
+  SBLCheckListSNAC::SBLCheckListSNAC(unsigned int timestamp, unsigned short size)
+    : m_timestamp(timestamp), m_size(size)
+  { }
+
+  void SBLCheckListSNAC::OutputBody(Buffer& b) const
+  {
+    b << m_timestamp
+      << m_size;
+  }
+
   // ============================================================================
   //  SBL list reply
   // ============================================================================
 
-  SBLListSNAC::SBLListSNAC() { }
+  SBLListSNAC::SBLListSNAC()
+    : m_size(0), m_timestamp(0)
+  { }
   
-  const unsigned short Entry_UIN        = 0x0000;
-  const unsigned short Entry_Group      = 0x0001;
-  const unsigned short Entry_VisSetting = 0x0004;
-  const unsigned short Entry_ICQTIC     = 0x0009;
-  const unsigned short Entry_Invisible  = 0x000e;
-  const unsigned short Entry_ImportTime = 0x0013;
-
   void SBLListSNAC::ParseBody(Buffer& b)
   {
     b.advance(1); // 00
@@ -121,6 +171,9 @@ namespace ICQ2000 {
 	  ct->setMobileNo(tlv->Value());
 	}
 	
+	ct->setServerSideInfo( group_id, tag_id );
+	ct->setServerBased(true);
+
 	// add to contact tree under group
 	if (!m_tree.exists_group( group_id )) throw ParseException("Contact group_id doesn't match any group");
 	ContactTree::Group& gp = m_tree.lookup_group( group_id );
@@ -150,7 +203,7 @@ namespace ICQ2000 {
 
     }
 
-    b.advance(4);
+    b >> m_timestamp; // last modification time of the list
   }
   
   // ============================================================================
@@ -190,10 +243,59 @@ namespace ICQ2000 {
   //  SBL Add Entry
   // ============================================================================
 
+  /*
+   * entries are output the same for both adding and removing
+   */
+  static void OutputGroupEntry(Buffer& b, const SBLGroupEntry& gp)
+  {
+    b << gp.first;
+    b << gp.second;
+    b << (unsigned short) 0x0000;
+    b << Entry_Group;
+    b << (unsigned short) 0x0000;
+  }
+
+  static void OutputBuddyEntry(Buffer& b, const ContactRef& c)
+  {
+    b << c->getStringUIN();
+    b << (unsigned short) c->getServerSideGroupID();
+    b << (unsigned short) c->getServerSideID();
+    b << Entry_UIN;
+
+    Buffer::marker m = b.getAutoSizeShortMarker();
+
+    // Contact Nickname TLV
+    b << TLV_ContactNickname;
+    b << c->getAlias();
+
+    // Auth awaiting TLV
+    if (c->getAuthAwait()) {
+      b << TLV_AuthAwaited;
+      b << (unsigned short) 0x0000;
+    }
+
+    b.setAutoSizeMarker(m);
+  }
+
+  static void OutputEntries(Buffer& b, const std::list<SBLGroupEntry>& groups,
+			    const std::list<ContactRef>& buddies)
+  {
+    std::list<SBLGroupEntry>::const_iterator gcurr = groups.begin();
+    while (gcurr != groups.end()) {
+      OutputGroupEntry(b, *gcurr);
+      ++gcurr;
+    }
+
+    std::list<ContactRef>::const_iterator curr = buddies.begin();
+    while (curr != buddies.end()) {
+      OutputBuddyEntry(b, *curr);
+      ++curr;
+    }
+  }
+
   SBLAddEntrySNAC::SBLAddEntrySNAC() { }
 
   SBLAddEntrySNAC::SBLAddEntrySNAC(const ContactList& l)
-    : m_buddy_list(), m_group_id(0)
   { 
     ContactList::const_iterator curr = l.begin();
     while (curr != l.end()) {
@@ -204,91 +306,79 @@ namespace ICQ2000 {
   }
 
   SBLAddEntrySNAC::SBLAddEntrySNAC(const ContactRef& c)
-    : m_buddy_list(1, c), m_group_id(0)
+    : m_buddy_list(1, c)
   { }
 
   SBLAddEntrySNAC::SBLAddEntrySNAC(const string& group_name, unsigned short group_id)
-    : m_group_name(group_name), m_group_id(group_id)
+    : m_groups(1, SBLGroupEntry(group_name, group_id))
   { }
 
   void SBLAddEntrySNAC::addBuddy(const ContactRef& c)
   {
     m_buddy_list.push_back(c);
-    }
+  }
 
-  void SBLAddEntrySNAC::OutputBody(Buffer& b) const
+  void SBLAddEntrySNAC::addGroup(const string& group_name, unsigned short group_id)
   {
-    if (m_group_id) {
-      // a Group
-      b << m_group_name;
-      b << m_group_id;
-      b << (unsigned short) 0x0000;
-      b << (unsigned short) 0x0001;
-      b << (unsigned short) 0x0000;
-
-    } else {
-      std::list<ContactRef>::const_iterator curr = m_buddy_list.begin();
-      while (curr != m_buddy_list.end()) {
-	string suin = (*curr)->getStringUIN();
-	string alias = (*curr)->getAlias();
-
-	b << suin;
-	b << (unsigned short) (*curr)->getServerSideGroupID();
-	b << (unsigned short) (*curr)->getServerSideID();
-	b << (unsigned short) 0x0000;
-
-	Buffer::marker m = b.getAutoSizeShortMarker();
-
-	// Contact Nickname TLV
-	b << TLV_ContactNickname;
-	b << alias;
-
-	// Auth awaiting TLV
-	if((*curr)->getAuthAwait()) {
-	    b << TLV_AuthAwaited;
-	    b << (unsigned short) 0x0000;
-	}
-
-	b.setAutoSizeMarker(m);
-
-	++curr;
-      }
+    m_groups.push_back( SBLGroupEntry(group_name, group_id) );
+  }
 
-    }
+  void SBLAddEntrySNAC::OutputBody(Buffer& b) const
+  {
+    OutputEntries(b, m_groups, m_buddy_list);
   }
 
   // ============================================================================
   //  SBL Update Entry
   // ============================================================================
 
+  SBLUpdateEntrySNAC::SBLUpdateEntrySNAC() { }
+
   SBLUpdateEntrySNAC::SBLUpdateEntrySNAC(const string &group_name,
 					 unsigned short group_id,
 					 const std::vector<unsigned short> &ids)
-    : m_group_name(group_name), m_group_id(group_id), m_ids(ids)
-  { }
+  {
+    addGroup(group_name, group_id, ids);
+  }
+
+  void SBLUpdateEntrySNAC::addGroup(const string &group_name,
+				    unsigned short group_id,
+				    const std::vector<unsigned short> &ids)
+  {
+    GroupUpdate gu;
+    gu.name = group_name;
+    gu.group_id = group_id;
+    gu.ids = ids;
+    m_groups.push_back(gu);
+  }
 
   void SBLUpdateEntrySNAC::OutputBody(Buffer& b) const {
-    b << (unsigned short) m_group_name.size();
-    b.Pack(m_group_name);
-    b << m_group_id;
-    b << (unsigned short) 0x0000;
-    b << (unsigned short) 0x0001;
+    std::list<GroupUpdate>::const_iterator gcurr = m_groups.begin();
+    while (gcurr != m_groups.end()) {
+      const GroupUpdate& gu = (*gcurr);
 
-    if(m_ids.empty()) {
+      b << gu.name;
+      b << gu.group_id;
       b << (unsigned short) 0x0000;
+      b << Entry_Group;
 
-    } else {
-      b << (unsigned short) (4 + m_ids.size()*2);
-      b << (unsigned short) 0x00c8;
-      b << (unsigned short) (m_ids.size()*2);
-      // raw-coded TLV, found no suitable data structures in TLV.h
+      if(gu.ids.empty()) {
+	b << (unsigned short) 0x0000;
+
+      } else {
+	b << (unsigned short) (4 + gu.ids.size()*2);
+	b << TLV_SBL_Ids;
+	b << (unsigned short) (gu.ids.size()*2);
+
+	std::vector<unsigned short>::const_iterator curr = gu.ids.begin();
+	while (curr != gu.ids.end()) {
+	  b << (unsigned short) *curr;
+	  ++curr;
+	}
 
-      std::vector<unsigned short>::const_iterator curr = m_ids.begin();
-      while (curr != m_ids.end()) {
-	b << (unsigned short) *curr;
-	++curr;
       }
 
+      ++gcurr;
     }
   }
 
@@ -299,7 +389,6 @@ namespace ICQ2000 {
   SBLRemoveEntrySNAC::SBLRemoveEntrySNAC() { }
 
   SBLRemoveEntrySNAC::SBLRemoveEntrySNAC(const ContactList& l)
-    : m_buddy_list(), m_group_id(0)
   { 
     ContactList::const_iterator curr = l.begin();
     while (curr != l.end()) {
@@ -309,51 +398,24 @@ namespace ICQ2000 {
   }
 
   SBLRemoveEntrySNAC::SBLRemoveEntrySNAC(const ContactRef& c)
-    : m_buddy_list(1, c), m_group_id(0) { }
+    : m_buddy_list(1, c) { }
 
   SBLRemoveEntrySNAC::SBLRemoveEntrySNAC(const string &group_name, unsigned short group_id)
-    : m_group_name(group_name), m_group_id(group_id) { }
+    : m_groups(1, SBLGroupEntry(group_name, group_id)) { }
 
-  void SBLRemoveEntrySNAC::OutputBody(Buffer& b) const
+  void SBLRemoveEntrySNAC::addBuddy(const ContactRef& c)
   {
-    if(m_group_id) {
-      b << (unsigned short) m_group_name.size();
-      b.Pack(m_group_name);
-      b << m_group_id;
-      b << (unsigned short) 0x0000;
-      b << (unsigned short) 0x0001;
-      b << (unsigned short) 0x0000;
-
-    } else {
-      std::list<ContactRef>::const_iterator curr = m_buddy_list.begin();
-      while (curr != m_buddy_list.end()) {
-	string suin = (*curr)->getStringUIN();
-	string alias = (*curr)->getAlias();
-
-	b << (unsigned short) suin.size();
-	b.Pack(suin);
-	b << (unsigned short) (*curr)->getServerSideGroupID();
-	b << (unsigned short) (*curr)->getServerSideID();
-	b << (unsigned short) 0x0000;
-
-	int tlvlen = 4 + alias.size();
-	if((*curr)->getAuthAwait()) tlvlen += 4;
-
-	b << (unsigned short) tlvlen;
-
-	b << TLV_ContactNickname;
-	b << (unsigned short) alias.size();
-	b.Pack(alias);
-
-	if((*curr)->getAuthAwait()) {
-	    b << TLV_AuthAwaited;
-	    b << (unsigned short) 0x0000;
-	}
+    m_buddy_list.push_back(c);
+  }
 
-	++curr;
-      }
+  void SBLRemoveEntrySNAC::addGroup(const string& group_name, unsigned short group_id)
+  {
+    m_groups.push_back( SBLGroupEntry(group_name, group_id) );
+  }
 
-    }
+  void SBLRemoveEntrySNAC::OutputBody(Buffer& b) const
+  {
+    OutputEntries(b, m_groups, m_buddy_list);
   }
 
   // ============================================================================
@@ -373,6 +435,9 @@ namespace ICQ2000 {
         case 0x0003: m_results.push_back(AlreadyExists); break;
         case 0x000a: m_results.push_back(Failed); break;
         case 0x000e: m_results.push_back(AuthRequired); break;
+	default:
+	  // keep one result per entry, so they still line up
+	  m_results.push_back(Failed);
       }
     }
   }
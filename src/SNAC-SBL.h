@@ -24,6 +24,7 @@
 
 #include <string>
 #include <list>
+#include <vector>
 
 #include "SNAC-base.h"
 #include "Contact.h"
@@ -82,12 +83,19 @@ namespace ICQ2000 {
   
   class SBLRightsReplySNAC : public SBLFamilySNAC, public InSNAC 
   {
+   private:
+    std::vector<unsigned short> m_max_items;
+
    protected:
     void ParseBody(Buffer& b);
 
   public:
     SBLRightsReplySNAC();
 
+    // maximum number of each entry type the server will hold, 0 if not given
+    unsigned short getMaxContacts() const;
+    unsigned short getMaxGroups() const;
+
     unsigned short Subtype() const { return SNAC_SBL_Rights_Reply; }
   };
 
@@ -106,6 +114,25 @@ namespace ICQ2000 {
     unsigned short Subtype() const { return SNAC_SBL_Request_List; }
   };
   
+  // ============================================================================
+  //  Conditional SBL list request
+  // ============================================================================
+
+  class SBLCheckListSNAC : public SBLFamilySNAC, public OutSNAC
+  {
+   private:
+    unsigned int m_timestamp;
+    unsigned short m_size;
+
+   protected:
+    void OutputBody(Buffer& b) const;
+
+   public:
+    SBLCheckListSNAC(unsigned int timestamp, unsigned short size);
+
+    unsigned short Subtype() const { return SNAC_SBL_Check_List; }
+  };
+  
   // ============================================================================
   //  SBL list reply
   // ============================================================================
@@ -115,6 +142,7 @@ namespace ICQ2000 {
    private:
     ContactTree m_tree;
     unsigned short m_size;
+    unsigned int m_timestamp;
      
    protected:
     void ParseBody(Buffer& b);
@@ -124,6 +152,7 @@ namespace ICQ2000 {
     
     ContactTree& getContactTree() { return m_tree; }
     unsigned short get_size() const { return m_size; }
+    unsigned int get_timestamp() const { return m_timestamp; }
 
     unsigned short Subtype() const { return SNAC_SBL_List_From_Server; }
   };
@@ -162,12 +191,18 @@ namespace ICQ2000 {
   //  SBL Add Entry
   // ============================================================================
 
+  /*
+   * Add and Remove Entry SNACs carry any number of groups and buddies,
+   * groups first. The server acknowledges each entry in turn in a
+   * single SBLEditACKSNAC.
+   */
+  typedef std::pair<std::string, unsigned short> SBLGroupEntry;
+
   class SBLAddEntrySNAC : public SBLFamilySNAC, public OutSNAC
   {
    private:
-    std::string m_group_name;
+    std::list<SBLGroupEntry> m_groups;
     std::list<ContactRef> m_buddy_list;
-    unsigned short m_group_id;
     
    protected:
     void OutputBody(Buffer& b) const;
@@ -179,6 +214,9 @@ namespace ICQ2000 {
     SBLAddEntrySNAC(const std::string &group_name, unsigned short group_id);
 
     void addBuddy(const ContactRef& c);
+    void addGroup(const std::string &group_name, unsigned short group_id);
+
+    unsigned int size() const { return m_groups.size() + m_buddy_list.size(); }
 
     unsigned short Subtype() const { return SNAC_SBL_Add_Entry; }
   };
@@ -190,17 +228,27 @@ namespace ICQ2000 {
   class SBLUpdateEntrySNAC : public SBLFamilySNAC, public OutSNAC
   {
    private:
-     std::string m_group_name;
-     unsigned short m_group_id;
-     std::vector<unsigned short> m_ids;
+    struct GroupUpdate {
+      std::string name;
+      unsigned short group_id;
+      std::vector<unsigned short> ids;
+    };
+
+    std::list<GroupUpdate> m_groups;
 
    protected:
     void OutputBody(Buffer& b) const;
 
    public:
+    SBLUpdateEntrySNAC();
     SBLUpdateEntrySNAC(const std::string &group_name,
 		       unsigned short group_id, const std::vector<unsigned short> &ids);
 
+    void addGroup(const std::string &group_name,
+		  unsigned short group_id, const std::vector<unsigned short> &ids);
+
+    unsigned int size() const { return m_groups.size(); }
+
     unsigned short Subtype() const { return SNAC_SBL_Update_Entry; }
   };
   
@@ -211,9 +259,8 @@ namespace ICQ2000 {
   class SBLRemoveEntrySNAC : public SBLFamilySNAC, public OutSNAC
   {
    private:
-    std::string m_group_name;
+    std::list<SBLGroupEntry> m_groups;
     std::list<ContactRef> m_buddy_list;
-    unsigned short m_group_id;
     
    protected:
     void OutputBody(Buffer& b) const;
@@ -224,6 +271,11 @@ namespace ICQ2000 {
     SBLRemoveEntrySNAC(const ContactRef& c);
     SBLRemoveEntrySNAC(const std::string &group_name, unsigned short group_id);
 
+    void addBuddy(const ContactRef& c);
+    void addGroup(const std::string &group_name, unsigned short group_id);
+
+    unsigned int size() const { return m_groups.size() + m_buddy_list.size(); }
+
     unsigned short Subtype() const { return SNAC_SBL_Remove_Entry; }
   };
 
@@ -354,6 +354,7 @@ namespace ICQ2000 {
     std::string getErrorParam() const { return m_error_param; }
 
     ICQSubType *getICQSubType() const { return m_icqsubtype; }
+    ICQSubType *releaseICQSubType() { ICQSubType *ist = m_icqsubtype; m_icqsubtype = NULL; return ist; }
     unsigned int getSenderUIN() const { return m_sender_UIN; }
     time_t getTime() const { return m_time; }
 
@@ -0,0 +1,331 @@
+/*
+ * TLVSchema
+ *
+ * Copyright (C) 2001 Barnaby Gray <barnaby@beedesign.co.uk>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#ifndef TLVSCHEMA_H
+#define TLVSCHEMA_H
+
+#include <string>
+
+#include "buffer.h"
+#include "Capabilities.h"
+#include "TLV.h"
+#include "exceptions.h"
+
+namespace ICQ2000 {
+
+  /*
+   * Compile-time layouts for TLV blocks and SNACs.
+   *
+   * A TLV is declared once as a Field - its type number and a codec
+   * for its value - and a block of TLVs as a List of Fields. From
+   * the List a Record is generated holding each value and whether
+   * it was present, along with the code to parse a block into it
+   * and output it again. Dispatch on the TLV type is an inlined
+   * chain of compares against the constants in the List, so there
+   * are no TLV objects on the heap and no virtual calls; each List
+   * stands in for one of the TLV_ParseModes.
+   *
+   *   typedef Field<TLV_Status, StatusCodec> Status;
+   *   typedef List<Status, List<Port> > Block;
+   *
+   *   Record<Block> r;
+   *   parse(b, r, no_tlvs);
+   *   if (has<Status>(r)) ... get<Status>(r).status ...
+   *
+   * A TLV too short for the value its codec reads throws
+   * ParseException, rather than reading on into the next TLV. Longer
+   * ones are allowed, and parsing always carries on from the end of
+   * the TLV, whatever the codec made of it.
+   */
+  namespace Schema {
+
+    // ------------------ codecs ------------------
+
+    inline void check_length(unsigned short len, unsigned short need) {
+      if (len < need) throw ParseException("TLV too short for its value");
+    }
+
+    struct U8 {
+      typedef unsigned char value_type;
+      static void parse(Buffer& b, unsigned short len, value_type& v) { check_length(len, 1); b >> v; }
+      static void output(Buffer& b, const value_type& v) { b << v; }
+    };
+
+    struct U16 {
+      typedef unsigned short value_type;
+      static void parse(Buffer& b, unsigned short len, value_type& v) { check_length(len, 2); b >> v; }
+      static void output(Buffer& b, const value_type& v) { b << v; }
+    };
+
+    struct U32 {
+      typedef unsigned int value_type;
+      static void parse(Buffer& b, unsigned short len, value_type& v) { check_length(len, 4); b >> v; }
+      static void output(Buffer& b, const value_type& v) { b << v; }
+    };
+
+    struct Str {
+      typedef std::string value_type;
+      static void parse(Buffer& b, unsigned short len, value_type& v) { b.Unpack(v, len); }
+      static void output(Buffer& b, const value_type& v) { b.Pack(v); }
+    };
+
+    // online status, with the direct connection and web aware flags
+    struct StatusValue {
+      unsigned char allow_direct, web_aware;
+      unsigned short status;
+
+      StatusValue() : allow_direct(0), web_aware(0), status(0) { }
+      StatusValue(unsigned char ad, unsigned char wa, unsigned short st)
+	: allow_direct(ad), web_aware(wa), status(st) { }
+
+      bool birthday() const { return ((web_aware & 0x08) == 0x08); }
+    };
+
+    struct StatusCodec {
+      typedef StatusValue value_type;
+      static void parse(Buffer& b, unsigned short len, value_type& v) {
+	check_length(len, 4);
+	b >> v.allow_direct >> v.web_aware >> v.status;
+      }
+      static void output(Buffer& b, const value_type& v) {
+	b << v.allow_direct << v.web_aware << v.status;
+      }
+    };
+
+    // how to make a direct connection to a user
+    struct LANDetailsValue {
+      unsigned int lan_ip;
+      unsigned short lan_port, firewall;
+      unsigned char tcp_version;
+      unsigned int dc_cookie;
+
+      LANDetailsValue()
+	: lan_ip(0), lan_port(0), firewall(0x0400), tcp_version(7), dc_cookie(0) { }
+      LANDetailsValue(unsigned int ip, unsigned short port)
+	: lan_ip(ip), lan_port(port), firewall(0x0400), tcp_version(7), dc_cookie(0) { }
+    };
+
+    struct LANDetailsCodec {
+      typedef LANDetailsValue value_type;
+      static void parse(Buffer& b, unsigned short len, value_type& v) {
+	if (len == 0x0025) {
+	  // user accepts direct connections
+	  unsigned short port_hi;
+	  b >> v.lan_ip >> port_hi >> v.lan_port;
+	} else {
+	  check_length(len, 7);
+	}
+	// the timestamps after are skipped with the rest of the TLV
+	b >> v.firewall >> v.tcp_version >> v.dc_cookie;
+      }
+      static void output(Buffer& b, const value_type& v) {
+	b << v.lan_ip
+	  << (unsigned int)v.lan_port
+	  << v.firewall
+	  << v.tcp_version
+	  << (unsigned int)0x00000000 // dc cookie (server picks it for us (apparently))
+	  << (unsigned int)0x00000050
+	  << (unsigned short)0x0000
+	  << (unsigned short)0x0003   // number of timestamps
+	  << (unsigned int)0x3AA773EE
+	  << (unsigned int)0x3AA66380
+	  << (unsigned int)0x3A877A42
+	  << (unsigned short)0x0000;
+      }
+    };
+
+    struct CapabilitiesCodec {
+      typedef Capabilities value_type;
+      static void parse(Buffer& b, unsigned short len, value_type& v) { v.Parse(b, len); }
+      static void output(Buffer& b, const value_type& v) { v.Output(b); }
+    };
+
+    // ------------------ layouts ------------------
+
+    template <unsigned short Type, class Codec>
+    struct Field {
+      enum { type = Type };
+      typedef Codec codec;
+      typedef typename Codec::value_type value_type;
+    };
+
+    struct End { };
+
+    template <class F, class Rest = End>
+    struct List { };
+
+    template <class F>
+    struct Tag { };
+
+    template <class F>
+    struct Slot {
+      typename F::value_type value;
+      bool present;
+
+      Slot() : value(), present(false) { }
+    };
+
+    // storage and code for a List, one level of inheritance per Field
+    template <class L>
+    struct Record;
+
+    template <>
+    struct Record<End> {
+      void slot() { }
+
+      bool parse_value(unsigned short, Buffer&, unsigned short) { return false; }
+      void output(Buffer&) const { }
+      void clear() { }
+    };
+
+    template <class F, class Rest>
+    struct Record< List<F, Rest> > : public Record<Rest> {
+      Slot<F> m_slot;
+
+      using Record<Rest>::slot;
+      Slot<F>& slot(Tag<F>) { return m_slot; }
+      const Slot<F>& slot(Tag<F>) const { return m_slot; }
+
+      bool parse_value(unsigned short type, Buffer& b, unsigned short len) {
+	if (type == F::type) {
+	  F::codec::parse(b, len, m_slot.value);
+	  m_slot.present = true;
+	  return true;
+	}
+	return Record<Rest>::parse_value(type, b, len);
+      }
+
+      // present fields, in the order they are declared
+      void output(Buffer& b) const {
+	if (m_slot.present) {
+	  b << (unsigned short)F::type;
+	  Buffer::marker m = b.getAutoSizeShortMarker();
+	  F::codec::output(b, m_slot.value);
+	  b.setAutoSizeMarker(m);
+	}
+	Record<Rest>::output(b);
+      }
+
+      void clear() {
+	m_slot = Slot<F>();
+	Record<Rest>::clear();
+      }
+    };
+
+    template <class F, class R>
+    inline bool has(const R& r) { return r.slot(Tag<F>()).present; }
+
+    template <class F, class R>
+    inline const typename F::value_type& get(const R& r) { return r.slot(Tag<F>()).value; }
+
+    template <class F, class R>
+    inline void set(R& r, const typename F::value_type& v) {
+      Slot<F>& s = r.slot(Tag<F>());
+      s.value = v;
+      s.present = true;
+    }
+
+    // one TLV into the record, skipped if it isn't in the layout
+    template <class L>
+    inline void parse_tlv(Buffer& b, Record<L>& r) {
+      unsigned short type, len;
+      b >> type >> len;
+
+      unsigned int end = b.pos() + len;
+      if (end > b.size()) end = b.size();
+
+      r.parse_value(type, b, len);
+      b.setPos(end);
+    }
+
+    // a number of TLVs
+    template <class L>
+    inline void parse(Buffer& b, Record<L>& r, unsigned short no_tlvs) {
+      while (b.beforeEnd() && no_tlvs-- > 0) parse_tlv(b, r);
+    }
+
+    // TLVs filling a number of bytes
+    template <class L>
+    inline void parse_by_length(Buffer& b, Record<L>& r, unsigned int len) {
+      unsigned int end = b.pos() + len;
+      while (b.pos() < end && b.beforeEnd()) parse_tlv(b, r);
+    }
+
+    // a single TLV, outside of any record
+    template <class F>
+    inline void output(Buffer& b, const typename F::value_type& v) {
+      b << (unsigned short)F::type;
+      Buffer::marker m = b.getAutoSizeShortMarker();
+      F::codec::output(b, v);
+      b.setAutoSizeMarker(m);
+    }
+
+    // the SNAC header, for a family and subtype fixed at compile time
+    template <unsigned short Family, unsigned short Subtype>
+    struct SNACHeader {
+      enum { family = Family, subtype = Subtype };
+
+      static void output(Buffer& b, unsigned short flags, unsigned int reqid) {
+	b << (unsigned short)Family << (unsigned short)Subtype << flags << reqid;
+      }
+
+      static bool matches(unsigned short f, unsigned short s) {
+	return f == Family && s == Subtype;
+      }
+    };
+
+    // ------------------ the protocol ------------------
+
+    typedef Field<TLV_UserClass, U16>                  UserClass;
+    typedef Field<TLV_SignupDate, U32>                 SignupDate;
+    typedef Field<TLV_SignonDate, U32>                 SignonDate;
+    typedef Field<TLV_Port, U16>                       Port;
+    typedef Field<TLV_Status, StatusCodec>             Status;
+    typedef Field<TLV_Unknown, U16>                    Unknown;
+    typedef Field<TLV_IPAddress, U32>                  IPAddress;
+    typedef Field<TLV_LANDetails, LANDetailsCodec>     LANDetails;
+    typedef Field<TLV_Capabilities, CapabilitiesCodec> Caps;
+    typedef Field<TLV_TimeOnline, U32>                 TimeOnline;
+    typedef Field<TLV_WebAddress, Str>                 WebAddress;
+
+    // user info block, as in buddy online and the reply to a user info request
+    typedef List<UserClass,
+	    List<SignupDate,
+	    List<SignonDate,
+	    List<Status,
+	    List<WebAddress,
+	    List<TimeOnline,
+	    List<LANDetails,
+	    List<IPAddress,
+	    List<Port,
+	    List<Caps,
+	    List<Unknown> > > > > > > > > > > Channel02;
+
+    // body of a set status (family 0x01, subtype 0x1e)
+    typedef List<Status,
+	    List<Unknown,
+	    List<LANDetails> > > SetStatus;
+
+  }
+
+}
+
+#endif
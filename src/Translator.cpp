@@ -19,6 +19,18 @@
 
 #include "Translator.h"
 
+#include <string.h>
+#include <errno.h>
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#if defined(HAVE_ICONV_H) && defined(HAVE_ICONV)
+# include <iconv.h>
+# define USE_ICONV
+#endif
+
 namespace ICQ2000
 {
   // ======================================================================
@@ -47,6 +59,17 @@ namespace ICQ2000
     str = tstr;
   }
 
+  void Translator::server_to_client_batch(std::vector<std::string>& strs,
+					  Encoding en,
+					  const ICQ2000::ContactRef& c)
+  {
+    std::vector<std::string>::iterator curr = strs.begin();
+    while (curr != strs.end()) {
+      server_to_client_inplace(*curr, en, c);
+      ++curr;
+    }
+  }
+
   // ======================================================================
   //  NULLTranslator
   // ======================================================================
@@ -72,6 +95,23 @@ namespace ICQ2000
   //  CRLFTranslator
   // ======================================================================
 
+  /*
+   * The newline scans are done with memchr, which the C library
+   * vectorises, and the copying a run at a time between newlines.
+   */
+
+  static std::string::size_type count_lf(const std::string& str)
+  {
+    std::string::size_type n = 0;
+    const char *p = str.data(), *end = p + str.size();
+    while ( (p = (const char*)memchr(p, '\n', end - p)) != NULL )
+    {
+      ++n;
+      ++p;
+    }
+    return n;
+  }
+
   CRLFTranslator::CRLFTranslator()
   { }
 
@@ -79,22 +119,20 @@ namespace ICQ2000
 					       Encoding en,
 					       const ICQ2000::ContactRef& c)
   {
-    std::string::const_iterator curr = str.begin();
+    std::string::size_type lfs = count_lf(str);
+    if (lfs == 0) return str;
+
     std::string ret;
+    ret.reserve(str.size() + lfs);
 
-    while ( curr != str.end() )
+    const char *p = str.data(), *end = p + str.size(), *q;
+    while ( (q = (const char*)memchr(p, '\n', end - p)) != NULL )
     {
-      if (*curr == '\n')
-      {
-	ret += "\r\n";
-      }
-      else
-      {
-	ret += *curr;
-      }
-      
-      ++curr;
+      ret.append(p, q - p);
+      ret.append("\r\n", 2);
+      p = q + 1;
     }
+    ret.append(p, end - p);
     
     return ret;
   }
@@ -103,29 +141,321 @@ namespace ICQ2000
 					       Encoding en,
 					       const ICQ2000::ContactRef& c)
   {
-    std::string::const_iterator curr = str.begin();
-    std::string::const_iterator ncurr = curr;
-    std::string ret;
+    // only ever shrinks, so a copy is the one allocation needed
+    std::string ret(str);
+    CRLFTranslator::server_to_client_inplace(ret, en, c);
+    return ret;
+  }
+
+  void CRLFTranslator::client_to_server_inplace(std::string& str,
+						Encoding en,
+						const ICQ2000::ContactRef& c)
+  {
+    std::string::size_type lfs = count_lf(str);
+    if (lfs == 0) return;
 
-    while ( curr != str.end() )
+    // grow once, then fill in from the back
+    std::string::size_type n = str.size();
+    str.resize(n + lfs);
+
+    char *d = &str[0];
+    const char *r = d + n;
+    char *w = d + n + lfs;
+    while (w != r)
+    {
+      --r;
+      *--w = *r;
+      if (*r == '\n') *--w = '\r';
+    }
+  }
+  
+  void CRLFTranslator::server_to_client_inplace(std::string& str,
+						Encoding en,
+						const ICQ2000::ContactRef& c)
+  {
+    if (str.empty()) return;
+
+    char *d = &str[0], *w = NULL;
+    const char *r = d, *end = d + str.size(), *q;
+    while ( (q = (const char*)memchr(r, '\r', end - r)) != NULL && q + 1 != end )
     {
-      ++ncurr;
-      
-      if (*curr == '\r' && ncurr != str.end()
-	  && *ncurr == '\n')
+      if (q[1] != '\n')
       {
-	ret += '\n';
+	// a CR on its own is kept
+	if (w != NULL)
+	{
+	  memmove(w, r, q + 1 - r);
+	  w += q + 1 - r;
+	}
+	r = q + 1;
+	continue;
+      }
+
+      // drop the CR, the LF goes with the next run
+      if (w == NULL)
+      {
+	w = d + (q - d);
+      }
+      else
+      {
+	memmove(w, r, q - r);
+	w += q - r;
+      }
+      r = q + 1;
+    }
+
+    if (w == NULL) return;
+    
+    memmove(w, r, end - r);
+    w += end - r;
+    str.resize(w - d);
+  }
+
+  // ======================================================================
+  //  IconvTranslator
+  // ======================================================================
+
+  struct IconvTranslator::Converter
+  {
+#ifdef USE_ICONV
+    iconv_t cd;
+#endif
+  };
+
+#ifdef USE_ICONV
+  /*
+   * iconv takes its input as a char** on some systems and a const
+   * char** on others - let the compiler pick.
+   */
+  template <class In>
+  static size_t call_iconv(size_t (*f)(iconv_t, In, size_t*, char**, size_t*),
+			   iconv_t cd, char **in, size_t *inleft, char **out, size_t *outleft)
+  {
+    return f(cd, (In)in, inleft, out, outleft);
+  }
+#endif
+
+  IconvTranslator::IconvTranslator(const std::string& client_charset,
+				   const std::string& locale_charset)
+    : m_client_charset(client_charset), m_locale_charset(locale_charset)
+  { }
+
+  IconvTranslator::~IconvTranslator()
+  {
+    clear_converters();
+  }
+
+  void IconvTranslator::clear_converters()
+  {
+    ConverterMap *maps[] = { &m_to_server, &m_to_client };
+    for (unsigned int n = 0; n < 2; ++n)
+    {
+      ConverterMap::iterator curr = maps[n]->begin();
+      while (curr != maps[n]->end())
+      {
+#ifdef USE_ICONV
+	if (curr->second != NULL) iconv_close(curr->second->cd);
+#endif
+	delete curr->second;
 	++curr;
-	++ncurr;
+      }
+      maps[n]->clear();
+    }
+  }
+
+  /**
+   *  set the character set the client works in
+   */
+  void IconvTranslator::setClientCharset(const std::string& charset)
+  {
+    if (charset == m_client_charset) return;
+    m_client_charset = charset;
+    clear_converters();
+  }
+
+  std::string IconvTranslator::getClientCharset() const
+  {
+    return m_client_charset;
+  }
+
+  /**
+   *  set the character set taken for contacts that haven't been given
+   *  one with setContactCharset
+   */
+  void IconvTranslator::setLocaleCharset(const std::string& charset)
+  {
+    m_locale_charset = charset;
+  }
+
+  std::string IconvTranslator::getLocaleCharset() const
+  {
+    return m_locale_charset;
+  }
+
+  /**
+   *  set the character set of a contact's locale
+   *
+   * @param uin the contact's uin
+   * @param charset the character set, as iconv names it
+   */
+  void IconvTranslator::setContactCharset(unsigned int uin, const std::string& charset)
+  {
+    m_contact_charsets[uin] = charset;
+  }
+
+  /**
+   *  go back to the default locale character set for a contact
+   */
+  void IconvTranslator::removeContactCharset(unsigned int uin)
+  {
+    m_contact_charsets.erase(uin);
+  }
+
+  const std::string& IconvTranslator::server_charset(Encoding en, const ICQ2000::ContactRef& c) const
+  {
+    static const std::string utf8("UTF-8"), latin1("ISO-8859-1");
+
+    switch(en)
+    {
+    case ENCODING_UTF8:
+      return utf8;
+    case ENCODING_ISO_8859_1:
+      return latin1;
+    case ENCODING_CONTACT_LOCALE:
+    default:
+      if (c.get() != NULL && !m_contact_charsets.empty())
+      {
+	std::map<unsigned int, std::string>::const_iterator i = m_contact_charsets.find(c->getUIN());
+	if (i != m_contact_charsets.end()) return i->second;
+      }
+      return m_locale_charset;
+    }
+  }
+
+  /*
+   * The descriptor for a conversion, opened the first time it's
+   * asked for. NULL when there's nothing to convert, or iconv can't.
+   */
+  IconvTranslator::Converter* IconvTranslator::converter(ConverterMap& m,
+							 const std::string& to,
+							 const std::string& from)
+  {
+    const std::string& key = (&m == &m_to_server ? to : from);
+    ConverterMap::iterator i = m.find(key);
+    if (i != m.end()) return i->second;
+
+    Converter *cv = NULL;
+#ifdef USE_ICONV
+    if (strcasecmp(to.c_str(), from.c_str()) != 0)
+    {
+      iconv_t cd = iconv_open(to.c_str(), from.c_str());
+      if (cd != (iconv_t)-1)
+      {
+	cv = new Converter;
+	cv->cd = cd;
+      }
+    }
+#endif
+
+    m.insert( ConverterMap::value_type(key, cv) );
+    return cv;
+  }
+
+  /*
+   * Convert through the shared buffer, and copy back into the string
+   * (which keeps its own storage if it's big enough). Bytes that
+   * aren't valid in the source character set come out as '?'.
+   */
+  void IconvTranslator::convert(std::string& str, Converter *cv)
+  {
+#ifdef USE_ICONV
+    if (cv == NULL || str.empty()) return;
+
+    if (m_buffer.size() < str.size() * 2) m_buffer.resize(str.size() * 2);
+
+    iconv(cv->cd, NULL, NULL, NULL, NULL);
+
+    char *in = &str[0];
+    size_t inleft = str.size();
+    char *out = &m_buffer[0];
+    size_t outleft = m_buffer.size();
+
+    while (inleft > 0)
+    {
+      if (call_iconv(iconv, cv->cd, &in, &inleft, &out, &outleft) != (size_t)-1) break;
+
+      if (errno == E2BIG || (errno == EILSEQ && outleft == 0))
+      {
+	size_t used = out - &m_buffer[0];
+	m_buffer.resize(m_buffer.size() * 2);
+	out = &m_buffer[0] + used;
+	outleft = m_buffer.size() - used;
+      }
+      else if (errno == EILSEQ)
+      {
+	*out++ = '?';
+	--outleft;
+	++in;
+	--inleft;
       }
       else
       {
-	ret += *curr;
+	// truncated multibyte sequence at the end
+	break;
       }
-      
-      ++curr;
     }
 
+    str.assign(&m_buffer[0], out - &m_buffer[0]);
+#endif
+  }
+
+  std::string IconvTranslator::client_to_server(const std::string& str,
+						Encoding en,
+						const ICQ2000::ContactRef& c)
+  {
+    std::string ret = CRLFTranslator::client_to_server(str, en, c);
+    convert(ret, converter(m_to_server, server_charset(en, c), m_client_charset));
     return ret;
   }
+  
+  std::string IconvTranslator::server_to_client(const std::string& str,
+						Encoding en,
+						const ICQ2000::ContactRef& c)
+  {
+    std::string ret(str);
+    server_to_client_inplace(ret, en, c);
+    return ret;
+  }
+
+  void IconvTranslator::client_to_server_inplace(std::string& str,
+						 Encoding en,
+						 const ICQ2000::ContactRef& c)
+  {
+    CRLFTranslator::client_to_server_inplace(str, en, c);
+    convert(str, converter(m_to_server, server_charset(en, c), m_client_charset));
+  }
+  
+  void IconvTranslator::server_to_client_inplace(std::string& str,
+						 Encoding en,
+						 const ICQ2000::ContactRef& c)
+  {
+    convert(str, converter(m_to_client, m_client_charset, server_charset(en, c)));
+    CRLFTranslator::server_to_client_inplace(str, en, c);
+  }
+
+  void IconvTranslator::server_to_client_batch(std::vector<std::string>& strs,
+					       Encoding en,
+					       const ICQ2000::ContactRef& c)
+  {
+    // the contact's character set is looked up the once
+    Converter *cv = converter(m_to_client, m_client_charset, server_charset(en, c));
+
+    std::vector<std::string>::iterator curr = strs.begin();
+    while (curr != strs.end())
+    {
+      convert(*curr, cv);
+      CRLFTranslator::server_to_client_inplace(*curr, en, c);
+      ++curr;
+    }
+  }
 }
@@ -22,7 +22,7 @@
 #include "UserInfoBlock.h"
 
 #include "Contact.h"
-#include "TLV.h"
+#include "TLVSchema.h"
 
 using std::string;
 
@@ -61,73 +61,41 @@ namespace ICQ2000 {
     unsigned short no_tlvs;
     b >> no_tlvs;
     
-    TLVList tlvlist;
-    tlvlist.Parse(b, TLV_ParseMode_Channel02, no_tlvs);
+    Schema::Record<Schema::Channel02> tlvs;
+    Schema::parse(b, tlvs, no_tlvs);
 
-    m_userClass = 0;
-    if (tlvlist.exists(TLV_UserClass)) {
-      UserClassTLV *t = (UserClassTLV*)tlvlist[TLV_UserClass];
-      m_userClass = t->Value();
-    }
-
-    m_status = 0;
-    m_allowDirect = 0;
-    m_webAware = 0;
-    if (tlvlist.exists(TLV_Status)) {
-      StatusTLV *t = (StatusTLV*)tlvlist[TLV_Status];
-      m_allowDirect = t->getAllowDirect();
-      m_webAware = t->getWebAware();
-      m_status = t->getStatus();
-      m_birthday = t->getBirthday();
-    }
-
-    m_timeOnline = 0;
-    if (tlvlist.exists(TLV_TimeOnline)) {
-      TimeOnlineTLV *t = (TimeOnlineTLV*)tlvlist[TLV_TimeOnline];
-      m_timeOnline = t->Value();
-    }
+    m_userClass = Schema::get<Schema::UserClass>(tlvs);
 
-    m_signupDate = 0;
-    if (tlvlist.exists(TLV_SignupDate)) {
-      SignupDateTLV *t = (SignupDateTLV*)tlvlist[TLV_SignupDate];
-      m_signupDate = t->Value();
-    }
+    const Schema::StatusValue& st = Schema::get<Schema::Status>(tlvs);
+    m_allowDirect = st.allow_direct;
+    m_webAware = st.web_aware;
+    m_status = st.status;
+    m_birthday = st.birthday();
 
-    m_signonDate = 0;
-    if (tlvlist.exists(TLV_SignonDate)) {
-      SignonDateTLV *t = (SignonDateTLV*)tlvlist[TLV_SignonDate];
-      m_signonDate = t->Value();
-    }
+    m_timeOnline = Schema::get<Schema::TimeOnline>(tlvs);
+    m_signupDate = Schema::get<Schema::SignupDate>(tlvs);
+    m_signonDate = Schema::get<Schema::SignonDate>(tlvs);
 
     m_lan_ip = 0;
     m_lan_port = 0;
     m_firewall = 0;
     m_tcp_version = 0;
-    if (tlvlist.exists(TLV_LANDetails)) {
-      LANDetailsTLV *t = (LANDetailsTLV*)tlvlist[TLV_LANDetails];
-      m_lan_ip = t->getLanIP();
-      m_lan_port = t->getLanPort();
-      m_firewall = t->getFirewall();
-      m_tcp_version = t->getTCPVersion();
-      m_dc_cookie = t->getDCCookie();
+    m_dc_cookie = 0;
+    if (Schema::has<Schema::LANDetails>(tlvs)) {
+      const Schema::LANDetailsValue& lan = Schema::get<Schema::LANDetails>(tlvs);
+      m_lan_ip = lan.lan_ip;
+      m_lan_port = lan.lan_port;
+      m_firewall = lan.firewall;
+      m_tcp_version = lan.tcp_version;
+      m_dc_cookie = lan.dc_cookie;
     }
 
-    m_ext_ip = 0;
-    if (tlvlist.exists(TLV_IPAddress)) {
-      IPAddressTLV *t = (IPAddressTLV*)tlvlist[TLV_IPAddress];
-      m_ext_ip = t->Value();
-    }
-
-    m_ext_port = 0;
-    if (tlvlist.exists(TLV_Port)) {
-      PortTLV *t = (PortTLV*)tlvlist[TLV_Port];
-      m_ext_port = t->Value();
-    }
+    m_ext_ip = Schema::get<Schema::IPAddress>(tlvs);
+    m_ext_port = Schema::get<Schema::Port>(tlvs);
 
-    if (tlvlist.exists(TLV_Capabilities)) {
-      CapabilitiesTLV *t = (CapabilitiesTLV*)tlvlist[TLV_Capabilities];
+    if (Schema::has<Schema::Caps>(tlvs)) {
       m_contains_capabilities = true;
-      m_capabilities = t->get_capabilities();
+      m_capabilities = Schema::get<Schema::Caps>(tlvs);
     }
 
   }
@@ -0,0 +1,199 @@
+/*
+ * UserInfoFetcher
+ *
+ * Copyright (C) 2001 Barnaby Gray <barnaby@beedesign.co.uk>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#include "UserInfoFetcher.h"
+
+namespace ICQ2000 {
+
+  UserInfoFetcher::Stats::Stats()
+    : requested(0), collapsed(0), cached(0), sent(0), completed(0), failed(0)
+  { }
+
+  UserInfoFetcher::UserInfoFetcher()
+    : m_ttl(DefaultTTL), m_rate(DefaultRate), m_max_in_flight(DefaultMaxInFlight),
+      m_window(0), m_sent_in_window(0)
+  { }
+
+  /*
+   * Ask for a contact's details. Returns the handle of the request
+   * that will fetch them: a new one, the one already queued or in
+   * flight for the contact, or, if the cached details are still fresh
+   * (and not force), one that has already completed.
+   */
+  RequestHandleRef UserInfoFetcher::request(ContactRef c, bool force)
+  {
+    unsigned int uin = c->getUIN();
+    ++m_stats.requested;
+
+    std::map<unsigned int, RequestHandleRef>::iterator i = m_queued.find(uin);
+    if (i != m_queued.end()) {
+      ++m_stats.collapsed;
+      return (*i).second;
+    }
+    i = m_in_flight.find(uin);
+    if (i != m_in_flight.end()) {
+      ++m_stats.collapsed;
+      return (*i).second;
+    }
+
+    RequestHandleRef h( new RequestHandle(RequestHandle::UserInfo, c) );
+
+    if (!force && fresh(uin, time(NULL))) {
+      ++m_stats.cached;
+      h->finish(RequestHandle::Completed);
+      return h;
+    }
+
+    m_queue.push_back(uin);
+    m_queued[uin] = h;
+    return h;
+  }
+
+  /*
+   * The next request to send, if pacing allows one to go now,
+   * otherwise a NULL ref. The request is moved in flight.
+   */
+  RequestHandleRef UserInfoFetcher::next(time_t now)
+  {
+    if (m_queued.empty() || m_in_flight.size() >= m_max_in_flight) return RequestHandleRef();
+
+    if (now != m_window) {
+      m_window = now;
+      m_sent_in_window = 0;
+    }
+    if (m_rate != 0 && m_sent_in_window >= m_rate) return RequestHandleRef();
+
+    // cancelled requests are left in the queue, skip them
+    std::map<unsigned int, RequestHandleRef>::iterator i = m_queued.end();
+    while (i == m_queued.end()) {
+      i = m_queued.find( m_queue.front() );
+      m_queue.pop_front();
+    }
+
+    RequestHandleRef h = (*i).second;
+    m_in_flight[ (*i).first ] = h;
+    m_queued.erase(i);
+    if (m_queued.empty()) m_queue.clear();
+
+    ++m_sent_in_window;
+    ++m_stats.sent;
+    return h;
+  }
+
+  /*
+   * The reply to a request has finished arriving (ok) or has been
+   * given up on.
+   */
+  void UserInfoFetcher::completed(unsigned int uin, bool ok)
+  {
+    std::map<unsigned int, RequestHandleRef>::iterator i = m_in_flight.find(uin);
+    if (i == m_in_flight.end()) return;
+    m_in_flight.erase(i);
+
+    if (ok) {
+      m_fetched[uin] = time(NULL);
+      ++m_stats.completed;
+    } else {
+      ++m_stats.failed;
+    }
+  }
+
+  /*
+   * Cancel a request that hasn't been sent yet. Returns false if
+   * there's none queued for the contact.
+   */
+  bool UserInfoFetcher::cancel(unsigned int uin)
+  {
+    std::map<unsigned int, RequestHandleRef>::iterator i = m_queued.find(uin);
+    if (i == m_queued.end()) return false;
+
+    RequestHandleRef h = (*i).second;
+    m_queued.erase(i);
+    if (m_queued.empty()) m_queue.clear();
+    h->finish(RequestHandle::Cancelled);
+    return true;
+  }
+
+  bool UserInfoFetcher::pending(unsigned int uin) const
+  {
+    return m_queued.count(uin) > 0 || m_in_flight.count(uin) > 0;
+  }
+
+  bool UserInfoFetcher::fresh(unsigned int uin, time_t now) const
+  {
+    std::map<unsigned int, time_t>::const_iterator i = m_fetched.find(uin);
+    return i != m_fetched.end() && now < (*i).second + (time_t)m_ttl;
+  }
+
+  void UserInfoFetcher::invalidate(unsigned int uin)
+  {
+    m_fetched.erase(uin);
+  }
+
+  unsigned int UserInfoFetcher::queued() const { return m_queued.size(); }
+
+  unsigned int UserInfoFetcher::in_flight() const { return m_in_flight.size(); }
+
+  UserInfoFetcher::Stats UserInfoFetcher::getStats() const { return m_stats; }
+
+  void UserInfoFetcher::setTTL(unsigned int ttl) { m_ttl = ttl; }
+
+  unsigned int UserInfoFetcher::getTTL() const { return m_ttl; }
+
+  void UserInfoFetcher::setRate(unsigned int per_second, unsigned int max_in_flight)
+  {
+    m_rate = per_second;
+    m_max_in_flight = (max_in_flight == 0 ? 1 : max_in_flight);
+  }
+
+  /*
+   * Forget everything queued or outstanding, for when the connection
+   * to the server goes. Fetched times are kept.
+   */
+  void UserInfoFetcher::clear()
+  {
+    std::map<unsigned int, RequestHandleRef> queued;
+    queued.swap(m_queued);
+    m_queue.clear();
+    m_in_flight.clear();
+
+    std::map<unsigned int, RequestHandleRef>::iterator i = queued.begin();
+    while (i != queued.end()) {
+      (*i).second->finish(RequestHandle::Cancelled);
+      ++i;
+    }
+  }
+
+  /*
+   * Drop fetched times that are past the TTL.
+   */
+  void UserInfoFetcher::clearoutPoll()
+  {
+    time_t now = time(NULL);
+
+    std::map<unsigned int, time_t>::iterator f = m_fetched.begin();
+    while (f != m_fetched.end()) {
+      std::map<unsigned int, time_t>::iterator t = f++;
+      if (now >= (*t).second + (time_t)m_ttl) m_fetched.erase(t);
+    }
+  }
+
+}
@@ -0,0 +1,100 @@
+/*
+ * UserInfoFetcher
+ *
+ * Copyright (C) 2001 Barnaby Gray <barnaby@beedesign.co.uk>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#ifndef USERINFOFETCHER_H
+#define USERINFOFETCHER_H
+
+#include <deque>
+#include <map>
+#include <time.h>
+
+#include "Contact.h"
+#include "RequestHandle.h"
+
+namespace ICQ2000 {
+
+  /*
+   * Scheduling for detailed user info requests. Requests for a
+   * contact that is already queued or in flight are collapsed into
+   * the one, a contact whose details were fetched less than the TTL
+   * ago isn't asked for again, and requests are let out at no more
+   * than a given rate with a bounded number outstanding, so a bulk
+   * fetch doesn't trip the server's rate limits.
+   *
+   * The fetcher only does the bookkeeping, Client does the sending
+   * and tells it when a reply has completed or its request id expired.
+   */
+  class UserInfoFetcher {
+   public:
+    struct Stats {
+      unsigned int requested;      // calls to request()
+      unsigned int collapsed;      // ...already queued or in flight
+      unsigned int cached;         // ...fresh enough to skip
+      unsigned int sent;
+      unsigned int completed, failed;
+
+      Stats();
+    };
+
+   private:
+    std::deque<unsigned int> m_queue;
+    std::map<unsigned int, RequestHandleRef> m_queued;
+    std::map<unsigned int, RequestHandleRef> m_in_flight;
+    std::map<unsigned int, time_t> m_fetched;
+
+    unsigned int m_ttl;
+    unsigned int m_rate, m_max_in_flight;
+    time_t m_window;
+    unsigned int m_sent_in_window;
+
+    Stats m_stats;
+
+   public:
+    static const unsigned int DefaultTTL = 3600;
+    static const unsigned int DefaultRate = 2;       // per second
+    static const unsigned int DefaultMaxInFlight = 4;
+
+    UserInfoFetcher();
+
+    RequestHandleRef request(ContactRef c, bool force);
+    RequestHandleRef next(time_t now);
+    void completed(unsigned int uin, bool ok);
+    bool cancel(unsigned int uin);
+
+    bool pending(unsigned int uin) const;
+    bool fresh(unsigned int uin, time_t now) const;
+    void invalidate(unsigned int uin);
+
+    unsigned int queued() const;
+    unsigned int in_flight() const;
+    Stats getStats() const;
+
+    void setTTL(unsigned int ttl);
+    unsigned int getTTL() const;
+    void setRate(unsigned int per_second, unsigned int max_in_flight);
+
+    void clear();
+    void clearoutPoll();
+  };
+
+}
+
+#endif
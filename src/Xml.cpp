@@ -22,6 +22,8 @@
 
 #include "Xml.h"
 
+#include <string.h>
+
 using std::string;
 using std::list;
 using std::pair;
@@ -61,21 +63,46 @@ string XmlNode::quote(const string& a) {
 }
 
 string XmlNode::unquote(const string& a) {
-  return 
-    replace_all(
-    replace_all(
-    replace_all(
-    replace_all(
-    replace_all(
-    replace_all(
-    replace_all(a,
-    "&lt;", "<"),
-    "&gt;", ">"),
-    "&quot;", "\""),
-    "&apos;", "`"),
-    "&nbsp;", " "),
-    "&trade;", "(tm)"),
-    "&amp;", "&");
+  string r;
+  r.reserve(a.size());
+  unquote_append(a.data(), a.data() + a.size(), r);
+  return r;
+}
+
+static const struct {
+  const char *name;
+  unsigned int len;
+  const char *repl;
+} xml_entities[] = {
+  { "lt;", 3, "<" },
+  { "gt;", 3, ">" },
+  { "amp;", 4, "&" },
+  { "quot;", 5, "\"" },
+  { "apos;", 5, "`" },
+  { "nbsp;", 5, " " },
+  { "trade;", 6, "(tm)" }
+};
+
+void XmlNode::unquote_append(const char *curr, const char *end, string& out) {
+  while (curr != end) {
+    const char *amp = curr;
+    while (amp != end && *amp != '&') ++amp;
+    out.append(curr, amp);
+    if (amp == end) break;
+
+    curr = amp + 1;
+    unsigned int i;
+    for (i = 0; i < sizeof(xml_entities)/sizeof(xml_entities[0]); ++i) {
+      if ((unsigned int)(end - curr) >= xml_entities[i].len
+	  && memcmp(curr, xml_entities[i].name, xml_entities[i].len) == 0) {
+	out += xml_entities[i].repl;
+	curr += xml_entities[i].len;
+	break;
+      }
+    }
+    // unknown entities are left as they are
+    if (i == sizeof(xml_entities)/sizeof(xml_entities[0])) out += '&';
+  }
 }
 
 XmlNode *XmlNode::parse(string::iterator& curr, string::iterator end) {
@@ -359,3 +386,155 @@ string XmlLeaf::toString(int n) {
   return r + ">" + quote(value) + "</" + quote(tag) + ">\n";
 }
 
+
+// ----------- XmlReader ------------------------
+
+XmlReader::XmlReader(const char *begin, const char *end)
+  : m_curr(begin), m_end(end), m_begin_tok(begin), m_end_tok(begin),
+    m_cdata(false), m_pending_end(false), m_depth(0) { }
+
+XmlReader::Token XmlReader::error() {
+  m_curr = m_end;
+  return Error;
+}
+
+XmlReader::Token XmlReader::next() {
+  m_cdata = false;
+
+  if (m_pending_end) {
+    // second half of an empty <tag/>
+    m_pending_end = false;
+    --m_depth;
+    return EndTag;
+  }
+
+  while (m_curr != m_end) {
+
+    if (*m_curr != '<') {
+      // character data up to the next tag
+      const char *p = m_curr;
+      while (p != m_end && *p != '<') ++p;
+      m_begin_tok = m_curr;
+      m_end_tok = p;
+      m_curr = p;
+
+      if (m_depth == 0) continue; // whitespace outside the root
+      return Text;
+    }
+
+    const char *p = m_curr + 1;
+    if (p == m_end) return error();
+
+    if (*p == '!') {
+      if (m_end - p >= 8 && memcmp(p, "![CDATA[", 8) == 0) {
+	const char *q = p + 8;
+	while (q + 2 < m_end && !(q[0] == ']' && q[1] == ']' && q[2] == '>')) ++q;
+	if (q + 2 >= m_end) return error();
+	m_begin_tok = p + 8;
+	m_end_tok = q;
+	m_curr = q + 3;
+	m_cdata = true;
+	return Text;
+      }
+      if (m_end - p >= 3 && memcmp(p, "!--", 3) == 0) {
+	const char *q = p + 3;
+	while (q + 2 < m_end && !(q[0] == '-' && q[1] == '-' && q[2] == '>')) ++q;
+	if (q + 2 >= m_end) return error();
+	m_curr = q + 3;
+	continue;
+      }
+    }
+
+    const char *q = p;
+    while (q != m_end && *q != '>') ++q;
+    if (q == m_end) return error();
+    m_curr = q + 1;
+
+    if (*p == '?' || *p == '!') continue; // declarations
+
+    bool closing = (*p == '/');
+    bool empty = (!closing && *(q-1) == '/');
+    if (closing) ++p;
+
+    m_begin_tok = p;
+    m_end_tok = p;
+    while (m_end_tok != q && !isspace(*m_end_tok) && *m_end_tok != '/') ++m_end_tok;
+    if (m_begin_tok == m_end_tok) return error();
+
+    if (closing) {
+      if (m_depth == 0) return error();
+      --m_depth;
+      return EndTag;
+    }
+
+    ++m_depth;
+    m_pending_end = empty;
+    return StartTag;
+  }
+
+  return (m_depth == 0 ? End : Error);
+}
+
+bool XmlReader::nameIs(const char *n) const {
+  unsigned int len = strlen(n);
+  return (unsigned int)(m_end_tok - m_begin_tok) == len && memcmp(m_begin_tok, n, len) == 0;
+}
+
+string XmlReader::name() const {
+  return string(m_begin_tok, m_end_tok);
+}
+
+void XmlReader::appendValue(string& out) const {
+  if (m_cdata) out.append(m_begin_tok, m_end_tok);
+  else XmlNode::unquote_append(m_begin_tok, m_end_tok, out);
+}
+
+string XmlReader::value() const {
+  string r;
+  appendValue(r);
+  return r;
+}
+
+/*
+ * Fill in the fields from the direct children of the root element,
+ * taking the first of each. Returns false if the XML is malformed or
+ * the root element isn't the one expected.
+ */
+bool XmlReader::extract(const string& xml, const char *root, Field *fields, unsigned int n) {
+  XmlReader r(xml.data(), xml.data() + xml.size());
+  Field *in = NULL;
+
+  for (unsigned int i = 0; i < n; ++i) fields[i].found = false;
+
+  Token t = r.next();
+  if (t != StartTag || !r.nameIs(root)) return false;
+
+  while ((t = r.next()) != End) {
+    switch(t) {
+    case StartTag:
+      in = NULL;
+      if (r.depth() == 2) {
+	for (unsigned int i = 0; i < n; ++i) {
+	  if (!fields[i].found && r.nameIs(fields[i].tag)) {
+	    in = &fields[i];
+	    in->found = true;
+	    in->value->erase();
+	    break;
+	  }
+	}
+      }
+      break;
+    case Text:
+      if (in != NULL && r.depth() == 2) r.appendValue(*(in->value));
+      break;
+    case EndTag:
+      in = NULL;
+      if (r.depth() == 0) return true;
+      break;
+    default:
+      return false;
+    }
+  }
+
+  return false;
+}
@@ -58,6 +58,7 @@ class XmlNode {
 
   static std::string quote(const std::string& s);
   static std::string unquote(const std::string& s);
+  static void unquote_append(const char *begin, const char *end, std::string& out);
   static std::string replace_all(const std::string& s, const std::string& r1, const std::string& r2);
 
   virtual std::string toString(int n) = 0;
@@ -100,5 +101,57 @@ class XmlBranch : public XmlNode {
 
 };
 
+/*
+ * Pull parser over a buffer of XML, for when the handful of fields
+ * wanted are known up front and building an XmlNode tree is a waste.
+ * Tag names and text are handed out as pointers into the source
+ * buffer, which must outlive the reader; nothing is copied until a
+ * value is asked for, and then entities are decoded in one pass.
+ * Attributes are skipped over.
+ */
+class XmlReader {
+ public:
+  enum Token {
+    StartTag,
+    EndTag,
+    Text,
+    End,
+    Error
+  };
+
+  // a field to pull out of the children of the root element
+  struct Field {
+    const char *tag;
+    std::string *value;
+    bool found;
+  };
+
+ private:
+  const char *m_curr, *m_end;
+  const char *m_begin_tok, *m_end_tok;
+  bool m_cdata, m_pending_end;
+  unsigned int m_depth;
+
+  Token error();
+
+ public:
+  XmlReader(const char *begin, const char *end);
+
+  Token next();
+
+  // depth of the current token, the root element is at 1
+  unsigned int depth() const { return m_depth; }
+
+  // for StartTag and EndTag
+  bool nameIs(const char *name) const;
+  std::string name() const;
+
+  // for Text
+  void appendValue(std::string& out) const;
+  std::string value() const;
+
+  static bool extract(const std::string& xml, const char *root, Field *fields, unsigned int n);
+};
+
 #endif
 
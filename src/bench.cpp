@@ -0,0 +1,643 @@
+/*
+ * bench.cpp - microbenchmarks for the core data paths
+ *
+ * Copyright (C) 2001 Barnaby Gray <barnaby@beedesign.co.uk>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+/*
+ * Built and run by "make bench", not installed. Each benchmark is
+ * run for a doubling number of iterations until it takes long
+ * enough to time, and reported as one line:
+ *
+ *   bench <name> <n> <iterations> <ns per iteration>
+ *
+ * where n is the size parameter of the benchmark (contacts in the
+ * tree, items in the cache, bytes in the message), or 0 where it
+ * doesn't apply. Memory benchmarks are reported as
+ *
+ *   mem <name> <n> <bytes per item> <allocations per item>
+ *
+ * counting what is asked of operator new. Lines starting with # are
+ * comments.
+ */
+
+#include <sys/time.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+#include <new>
+
+#include "buffer.h"
+#include "TLV.h"
+#include "SNAC.h"
+#include "FLAPFramer.h"
+#include "UserInfoBlock.h"
+#include "DirectClient.h"
+#include "Capabilities.h"
+#include "Cache.h"
+#include "Xml.h"
+#include "Translator.h"
+#include "ContactTree.h"
+#include "version.h"
+
+using namespace ICQ2000;
+using std::string;
+using std::vector;
+
+// stops the compiler throwing away work whose result isn't used
+static volatile unsigned int sink;
+
+static inline void keep(unsigned int v)
+{
+  sink = sink + v;
+}
+
+// the exception specifications operator new was declared with before C++11
+#if __cplusplus >= 201103L
+#define THROW_BAD_ALLOC
+#define THROW_NOTHING noexcept
+#else
+#define THROW_BAD_ALLOC throw(std::bad_alloc)
+#define THROW_NOTHING throw()
+#endif
+
+// kept out of line so gcc doesn't see malloc/free through the
+// replaced operators and warn about mismatched new/delete
+#ifdef __GNUC__
+#define NOINLINE __attribute__((noinline))
+#else
+#define NOINLINE
+#endif
+
+// heap use, counted by the operator new below
+static unsigned long heap_bytes, heap_allocs;
+
+static NOINLINE void* heap_alloc(size_t size)
+{
+  heap_bytes += size;
+  ++heap_allocs;
+  void *p = malloc(size == 0 ? 1 : size);
+  if (p == NULL) throw std::bad_alloc();
+  return p;
+}
+
+static NOINLINE void heap_free(void *p)
+{
+  free(p);
+}
+
+void* operator new(size_t size) THROW_BAD_ALLOC
+{
+  return heap_alloc(size);
+}
+
+void* operator new[](size_t size) THROW_BAD_ALLOC
+{
+  return heap_alloc(size);
+}
+
+void operator delete(void *p) THROW_NOTHING
+{
+  heap_free(p);
+}
+
+void operator delete[](void *p) THROW_NOTHING
+{
+  heap_free(p);
+}
+
+#if __cpp_sized_deallocation
+void operator delete(void *p, size_t) THROW_NOTHING
+{
+  heap_free(p);
+}
+
+void operator delete[](void *p, size_t) THROW_NOTHING
+{
+  heap_free(p);
+}
+#endif
+
+static double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+typedef void (*BenchFunc)(unsigned int iterations, unsigned int n);
+
+static double min_time = 0.2;
+
+static void run(const char *name, BenchFunc f, unsigned int n = 0)
+{
+  unsigned int iterations = 1;
+  double elapsed;
+
+  while (true) {
+    double start = now();
+    f(iterations, n);
+    elapsed = now() - start;
+    if (elapsed >= min_time || iterations >= (1U << 30)) break;
+    iterations *= 2;
+  }
+
+  printf("bench %s %u %u %.1f\n", name, n, iterations, elapsed * 1e9 / iterations);
+  fflush(stdout);
+}
+
+static void mem_report(const char *name, unsigned int n, unsigned long bytes, unsigned long allocs)
+{
+  printf("mem %s %u %.1f %.2f\n", name, n, (double)bytes / n, (double)allocs / n);
+  fflush(stdout);
+}
+
+// ------------------------------------------------------------------
+//  Test data
+// ------------------------------------------------------------------
+
+/*
+ * a user info block as sent in Buddy Online: status, user class,
+ * capabilities and signon time
+ */
+static void user_info_tlvs(Buffer& b)
+{
+  b << (unsigned short)0x0001 << (unsigned short)0x0002 << (unsigned short)0x0050;
+  b << (unsigned short)0x0006 << (unsigned short)0x0004
+    << (unsigned char)0x00 << (unsigned char)0x00 << (unsigned short)0x0001;
+  b << (unsigned short)0x0003 << (unsigned short)0x0004 << (unsigned int)1000000000;
+
+  Capabilities caps;
+  caps.set_capability_flag(Capabilities::ICQ);
+  caps.set_capability_flag(Capabilities::ICQServerRelay);
+  caps.set_capability_flag(Capabilities::ICQRTF);
+  b << (unsigned short)0x000d << caps.get_length();
+  caps.Output(b);
+}
+
+static void user_info(Buffer& b, unsigned int uin)
+{
+  b.PackByteString( Contact::UINtoString(uin) );
+  b << (unsigned short)0x0000
+    << (unsigned short)0x0004;
+  user_info_tlvs(b);
+}
+
+static Buffer userinfo_data, tlv_data, snac_data;
+static Buffer dc_plain, dc_encrypted, flap_stream;
+static string crlf_unix, crlf_dos, xml_data;
+
+static void setup()
+{
+  user_info(userinfo_data, 12345678);
+
+  user_info_tlvs(tlv_data);
+
+  snac_data << (unsigned short)0x0003 << (unsigned short)0x000b
+	    << (unsigned short)0x0000 << (unsigned int)0x00000000;
+  user_info(snac_data, 12345678);
+
+  // 100 FLAPs, as the server would send them back to back
+  for (unsigned short i = 0; i < 100; ++i) {
+    flap_stream << (unsigned char)0x2a << (unsigned char)0x02 << i
+		<< (unsigned short)snac_data.size();
+    flap_stream.Pack(&snac_data[0], snac_data.size());
+  }
+
+  // a direct connection message packet, v7
+  dc_plain.setLittleEndian();
+  dc_plain << (unsigned int)0x00000000
+	   << (unsigned short)0x07ee << (unsigned short)0x000e;
+  for (unsigned int i = 0; i < 120; ++i) dc_plain << (unsigned char)(i * 7);
+  DirectClient::EncryptPacket(dc_plain, dc_encrypted, 7);
+
+  while (crlf_unix.size() < 1024) crlf_unix += "the quick brown fox jumps over the lazy dog\n";
+  for (string::const_iterator curr = crlf_unix.begin(); curr != crlf_unix.end(); ++curr) {
+    if (*curr == '\n') crlf_dos += '\r';
+    crlf_dos += *curr;
+  }
+
+  xml_data = "<sms_response><source>airbornww.com</source><deliverable>Yes</deliverable>"
+    "<network>Vodafone UK</network><message_id>1234567890</message_id>"
+    "<messages_left>0</messages_left></sms_response>";
+}
+
+// ------------------------------------------------------------------
+//  Buffer
+// ------------------------------------------------------------------
+
+static void bench_buffer_pack(unsigned int iterations, unsigned int)
+{
+  string s("a short string");
+  while (iterations--) {
+    Buffer b;
+    for (unsigned int i = 0; i < 16; ++i) {
+      b << (unsigned char)i << (unsigned short)i << (unsigned int)i;
+      b.PackByteString(s);
+    }
+    keep(b.size());
+  }
+}
+
+static void bench_buffer_unpack(unsigned int iterations, unsigned int)
+{
+  Buffer b;
+  string s("a short string");
+  for (unsigned int i = 0; i < 16; ++i) {
+    b << (unsigned char)i << (unsigned short)i << (unsigned int)i;
+    b.PackByteString(s);
+  }
+
+  while (iterations--) {
+    b.setPos(0);
+    unsigned char c;
+    unsigned short w;
+    unsigned int l;
+    string t;
+    for (unsigned int i = 0; i < 16; ++i) {
+      b >> c >> w >> l;
+      b.UnpackByteString(t);
+    }
+    keep(l + t.size());
+  }
+}
+
+// ------------------------------------------------------------------
+//  Parsing
+// ------------------------------------------------------------------
+
+static void bench_tlvlist_parse(unsigned int iterations, unsigned int)
+{
+  while (iterations--) {
+    tlv_data.setPos(0);
+    TLVList tlvlist;
+    tlvlist.Parse(tlv_data, TLV_ParseMode_Channel02, 4);
+    keep(tlvlist.exists(TLV_Status));
+  }
+}
+
+static void bench_userinfoblock_parse(unsigned int iterations, unsigned int)
+{
+  while (iterations--) {
+    userinfo_data.setPos(0);
+    UserInfoBlock ub;
+    ub.Parse(userinfo_data);
+    keep(ub.getStatus());
+  }
+}
+
+static void bench_parse_snac(unsigned int iterations, unsigned int)
+{
+  while (iterations--) {
+    snac_data.setPos(0);
+    InSNAC *snac = ParseSNAC(snac_data);
+    keep(snac->Subtype());
+    delete snac;
+  }
+}
+
+/* the stream handed to the framer a network read's worth at a time,
+ * so FLAPs straddle the reads */
+static void bench_flap_framing(unsigned int iterations, unsigned int)
+{
+  FLAPFramer framer;
+  Buffer in;
+  while (iterations--) {
+    framer.reset();
+    for (unsigned int p = 0; p < flap_stream.size(); p += 1400) {
+      unsigned int len = flap_stream.size() - p;
+      if (len > 1400) len = 1400;
+      in.Pack(&flap_stream[p], len);
+      while (framer.next(in) == FLAPFramer::Complete) keep(framer.getLength());
+      in.clear();
+    }
+  }
+}
+
+// ------------------------------------------------------------------
+//  Direct connection cipher
+// ------------------------------------------------------------------
+
+static void bench_dc_encrypt(unsigned int iterations, unsigned int)
+{
+  while (iterations--) {
+    dc_plain.setPos(0);
+    Buffer out;
+    DirectClient::EncryptPacket(dc_plain, out, 7);
+    keep(out.size());
+  }
+}
+
+static void bench_dc_decrypt(unsigned int iterations, unsigned int)
+{
+  while (iterations--) {
+    dc_encrypted.setPos(0);
+    Buffer out;
+    keep(DirectClient::DecryptPacket(dc_encrypted, out, 7));
+  }
+}
+
+// ------------------------------------------------------------------
+//  Translation and XML
+// ------------------------------------------------------------------
+
+static void bench_crlf_server_to_client(unsigned int iterations, unsigned int)
+{
+  CRLFTranslator tr;
+  ContactRef c;
+  while (iterations--)
+    keep(tr.server_to_client(crlf_dos, ENCODING_CONTACT_LOCALE, c).size());
+}
+
+static void bench_crlf_client_to_server(unsigned int iterations, unsigned int)
+{
+  CRLFTranslator tr;
+  ContactRef c;
+  while (iterations--)
+    keep(tr.client_to_server(crlf_unix, ENCODING_CONTACT_LOCALE, c).size());
+}
+
+static void bench_crlf_server_to_client_inplace(unsigned int iterations, unsigned int)
+{
+  CRLFTranslator tr;
+  ContactRef c;
+  string s;
+  while (iterations--) {
+    s = crlf_dos;
+    tr.server_to_client_inplace(s, ENCODING_CONTACT_LOCALE, c);
+    keep(s.size());
+  }
+}
+
+static void bench_iconv_server_to_client(unsigned int iterations, unsigned int)
+{
+  IconvTranslator tr("UTF-8", "ISO-8859-1");
+  ContactRef c;
+  string s;
+  while (iterations--) {
+    s = crlf_dos;
+    tr.server_to_client_inplace(s, ENCODING_CONTACT_LOCALE, c);
+    keep(s.size());
+  }
+}
+
+static void bench_xml_parse(unsigned int iterations, unsigned int)
+{
+  while (iterations--) {
+    string::iterator curr = xml_data.begin();
+    XmlNode *top = XmlNode::parse(curr, xml_data.end());
+    keep((top != NULL));
+    delete top;
+  }
+}
+
+static void bench_xml_extract(unsigned int iterations, unsigned int)
+{
+  while (iterations--) {
+    string deliverable, message_id;
+    XmlReader::Field fields[] = {
+      { "deliverable", &deliverable, false },
+      { "message_id", &message_id, false }
+    };
+    keep(XmlReader::extract(xml_data, "sms_response", fields, 2));
+  }
+}
+
+// ------------------------------------------------------------------
+//  Cache
+// ------------------------------------------------------------------
+
+static void bench_cache_insert(unsigned int iterations, unsigned int n)
+{
+  while (iterations--) {
+    Cache<unsigned int, unsigned int> cache;
+    for (unsigned int i = 0; i < n; ++i) cache.insert(i, i);
+    keep(cache.empty());
+  }
+}
+
+static Cache<unsigned int, unsigned int> *cache = NULL;
+
+static void bench_cache_lookup(unsigned int iterations, unsigned int n)
+{
+  unsigned int k = 0;
+  while (iterations--) {
+    keep((*cache)[k]);
+    k = (k + 7919) % n;
+  }
+}
+
+static void bench_cache_expire(unsigned int iterations, unsigned int n)
+{
+  while (iterations--) {
+    Cache<unsigned int, unsigned int> cache;
+    for (unsigned int i = 0; i < n; ++i) cache.insert(i, i);
+    cache.expireAll();
+    keep(cache.empty());
+  }
+}
+
+// ------------------------------------------------------------------
+//  ContactTree
+// ------------------------------------------------------------------
+
+static ContactTree *tree = NULL;
+
+static void bench_contacttree_lookup(unsigned int iterations, unsigned int n)
+{
+  unsigned int k = 0;
+  while (iterations--) {
+    keep((*tree)[10000 + k]->getUIN());
+    k = (k + 7919) % n;
+  }
+}
+
+static void bench_contacttree_miss(unsigned int iterations, unsigned int n)
+{
+  unsigned int k = 0;
+  while (iterations--) {
+    keep(tree->exists(20000000 + k));
+    k = (k + 7919) % n;
+  }
+}
+
+// online contacts counted the old way, walking the groups
+static void bench_roster_online_walk(unsigned int iterations, unsigned int)
+{
+  while (iterations--) {
+    unsigned int online = 0;
+    ContactTree::iterator curr = tree->begin();
+    while (curr != tree->end()) {
+      ContactTree::Group::iterator gcurr = (*curr).begin();
+      while (gcurr != (*curr).end()) {
+	if ((*gcurr)->getStatus() != STATUS_OFFLINE) ++online;
+	++gcurr;
+      }
+      ++curr;
+    }
+    keep(online);
+  }
+}
+
+static void bench_presence_online_count(unsigned int iterations, unsigned int)
+{
+  while (iterations--) keep(tree->presence().online_count());
+}
+
+static void bench_presence_group_counts(unsigned int iterations, unsigned int)
+{
+  while (iterations--) {
+    const PresenceTable::GroupCounts& counts = tree->presence().group_status_counts();
+    PresenceTable::GroupCounts::const_iterator curr = counts.begin();
+    while (curr != counts.end()) {
+      keep((*curr).second.online());
+      ++curr;
+    }
+  }
+}
+
+/*
+ * Heap taken by a roster of n contacts as it comes from the server
+ * based list, an alias and server side ids each, and then by the
+ * tenth of them that have their details fetched.
+ */
+static void mem_contacts(unsigned int n)
+{
+  static const char *cities[] = { "London", "New York", "Berlin", "San Francisco", "Moscow" };
+
+  unsigned long bytes = heap_bytes, allocs = heap_allocs;
+
+  ContactTree *t = new ContactTree();
+  for (unsigned int g = 0; g < 8; ++g) t->add_group("Group");
+  ContactTree::iterator gcurr = t->begin();
+  vector<ContactRef> contacts;
+  contacts.reserve(n);
+  for (unsigned int u = 0; u < n; ++u) {
+    ContactRef c(new Contact(10000 + u));
+    c->setAlias("Contact " + Contact::UINtoString(u));
+    c->setServerSideInfo((*gcurr).get_id(), u + 1);
+    (*gcurr).add(c);
+    contacts.push_back(c);
+    if (++gcurr == t->end()) gcurr = t->begin();
+  }
+  bytes = heap_bytes - bytes - n * sizeof(ContactRef);
+  allocs = heap_allocs - allocs - 1;
+  mem_report("contact", n, bytes, allocs);
+
+  bytes = heap_bytes;
+  allocs = heap_allocs;
+  unsigned int fetched = 0;
+  for (unsigned int u = 0; u < n; u += 10, ++fetched) {
+    ContactRef c = contacts[u];
+
+    Contact::MainHomeInfo mhi = c->getMainHomeInfo();
+    mhi.firstname = "Firstname";
+    mhi.lastname = "Lastname";
+    mhi.city = string(cities[u % 5]);
+    mhi.country = COUNTRY_UNITED_KINGDOM;
+    c->setMainHomeInfo(mhi);
+
+    Contact::HomepageInfo hpi;
+    hpi.age = 30;
+    hpi.lang1 = LANGUAGE_ENGLISH;
+    c->setHomepageInfo(hpi);
+
+    Contact::WorkInfo wi;
+    wi.city = string(cities[(u / 10) % 5]);
+    wi.company_name = "Company";
+    c->setWorkInfo(wi);
+
+    c->setAboutInfo("About me");
+  }
+  mem_report("contact_details", fetched, heap_bytes - bytes, heap_allocs - allocs);
+
+  delete t;
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc > 1) min_time = atof(argv[1]);
+
+  setup();
+
+  printf("# libicq2000 %s microbenchmarks\n", libicq2000_version);
+  printf("# bench <name> <n> <iterations> <ns per iteration>\n");
+
+  run("buffer_pack", bench_buffer_pack);
+  run("buffer_unpack", bench_buffer_unpack);
+  run("tlvlist_parse", bench_tlvlist_parse);
+  run("userinfoblock_parse", bench_userinfoblock_parse);
+  run("parse_snac", bench_parse_snac);
+  run("flap_framing", bench_flap_framing, flap_stream.size());
+  run("dc_encrypt", bench_dc_encrypt, dc_plain.size());
+  run("dc_decrypt", bench_dc_decrypt, dc_plain.size());
+  run("crlf_server_to_client", bench_crlf_server_to_client, crlf_dos.size());
+  run("crlf_client_to_server", bench_crlf_client_to_server, crlf_unix.size());
+  run("crlf_server_to_client_inplace", bench_crlf_server_to_client_inplace, crlf_dos.size());
+  run("iconv_server_to_client", bench_iconv_server_to_client, crlf_dos.size());
+  run("xml_parse", bench_xml_parse, xml_data.size());
+  run("xml_extract", bench_xml_extract, xml_data.size());
+
+  unsigned int sizes[] = { 10, 100, 1000, 10000, 100000 };
+  for (unsigned int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+    unsigned int n = sizes[i];
+    if (n <= 10000) {
+      run("cache_insert", bench_cache_insert, n);
+      run("cache_expire", bench_cache_expire, n);
+    }
+
+    cache = new Cache<unsigned int, unsigned int>();
+    for (unsigned int k = 0; k < n; ++k) cache->insert(k, k);
+    run("cache_lookup", bench_cache_lookup, n);
+    delete cache;
+    cache = NULL;
+  }
+
+  for (unsigned int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+    unsigned int n = sizes[i];
+
+    // spread over a handful of groups, as a real list would be
+    tree = new ContactTree();
+    for (unsigned int g = 0; g < 8; ++g) tree->add_group("Group");
+    ContactTree::iterator gcurr = tree->begin();
+    for (unsigned int u = 0; u < n; ++u) {
+      (*gcurr).add( ContactRef(new Contact(10000 + u)) );
+      if (++gcurr == tree->end()) gcurr = tree->begin();
+    }
+
+    run("contacttree_lookup", bench_contacttree_lookup, n);
+    run("contacttree_miss", bench_contacttree_miss, n);
+
+    // a third of them online
+    for (unsigned int u = 0; u < n; u += 3) (*tree)[10000 + u]->setStatus(STATUS_ONLINE, false, false);
+    run("roster_online_walk", bench_roster_online_walk, n);
+    run("presence_online_count", bench_presence_online_count, n);
+    run("presence_group_counts", bench_presence_group_counts, n);
+
+    delete tree;
+    tree = NULL;
+  }
+
+  printf("# mem <name> <n> <bytes per item> <allocations per item>\n");
+  mem_contacts(50000);
+
+  return 0;
+}
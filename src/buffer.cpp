@@ -69,7 +69,7 @@ namespace ICQ2000
 
   void Buffer::Pack(const unsigned char *d, unsigned int size)
   {
-    copy(d, d+size, back_inserter(m_data));
+    m_data.insert(m_data.end(), d, d+size);
   }
 
   void Buffer::PackUint16StringNull(const string& s)
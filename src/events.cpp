@@ -22,11 +22,23 @@
 #include "events.h"
 
 #include "Contact.h"
+#include "ObjectPool.h"
 
 using std::string;
 
 namespace ICQ2000 {
 
+  /*
+   * Shared pool for the per-message event classes. Allocated once and
+   * never destroyed, so events outliving static destruction are still
+   * safe to delete.
+   */
+  static ObjectPool& event_pool()
+  {
+    static ObjectPool *pool = new ObjectPool(256);
+    return *pool;
+  }
+
   // ============================================================================
   //  Event base class
   // ============================================================================
@@ -359,10 +371,63 @@ namespace ICQ2000 {
   //  ServerBasedContactEvent
   // ============================================================================
 
-  /*
-  ServerBasedContactEvent::ServerBasedContactEvent(const ContactList& l) : m_clist(l) { }
+  /**
+   *  Constructor for a ServerBasedContactEvent
+   *
+   * @param t the type of server-based list operation
+   * @param l the contacts involved
+   */
+  ServerBasedContactEvent::ServerBasedContactEvent(SBLType t, const ContactList& l)
+    : m_clist(l), m_type(t), m_unchanged(false)
+  { }
+
+  /**
+   *  get the contacts involved. For a Fetch this is every contact
+   *  on the server-based list.
+   */
   ContactList& ServerBasedContactEvent::getContactList() { return m_clist; }
-  */
+
+  ServerBasedContactEvent::SBLType ServerBasedContactEvent::getType() const { return m_type; }
+
+  /**
+   *  For a Fetch, whether the server reported its list unchanged
+   *  since the timestamp and count given with the conditional
+   *  fetch. The contact list is then taken from the local list rather
+   *  than downloaded.
+   */
+  bool ServerBasedContactEvent::isUnchanged() const { return m_unchanged; }
+
+  void ServerBasedContactEvent::setUnchanged(bool b) { m_unchanged = b; }
+
+  void ServerBasedContactEvent::setUploadResult(unsigned int uin, UploadResult r)
+  {
+    m_results[uin] = r;
+  }
+
+  /**
+   *  For an Upload or Remove, the server's answer for each contact
+   *  involved, keyed by UIN.
+   */
+  const std::map<unsigned int, ServerBasedContactEvent::UploadResult>&
+  ServerBasedContactEvent::getUploadResults() const
+  {
+    return m_results;
+  }
+
+  void ServerBasedContactEvent::setGroupResult(unsigned short group_id, UploadResult r)
+  {
+    m_group_results[group_id] = r;
+  }
+
+  /**
+   *  For an Upload or Remove, the server's answer for each group
+   *  added or removed, keyed by server-side group id.
+   */
+  const std::map<unsigned short, ServerBasedContactEvent::UploadResult>&
+  ServerBasedContactEvent::getGroupResults() const
+  {
+    return m_group_results;
+  }
 
   // ============================================================================
   //  Contact Event
@@ -425,6 +490,53 @@ namespace ICQ2000 {
    */
   Status StatusChangeEvent::getOldStatus() const { return m_old_status; }
 
+  // ============================================================================
+  //  Presence Batch Event
+  // ============================================================================
+
+  PresenceBatchEvent::PresenceBatchEvent() { }
+
+  /**
+   *  add a status change to the batch
+   */
+  void PresenceBatchEvent::add(unsigned int uin, Status old_status, Status status)
+  {
+    Entry e;
+    e.uin = uin;
+    e.old_status = old_status;
+    e.status = status;
+    m_entries.push_back(e);
+  }
+
+  /**
+   *  update the new status of an entry, when a contact changes again
+   *  within the same batch
+   */
+  void PresenceBatchEvent::setStatus(unsigned int n, Status status)
+  {
+    m_entries[n].status = status;
+  }
+
+  void PresenceBatchEvent::clear() { m_entries.clear(); }
+
+  /**
+   *  get the number of status changes in the batch
+   */
+  unsigned int PresenceBatchEvent::size() const { return m_entries.size(); }
+
+  bool PresenceBatchEvent::empty() const { return m_entries.empty(); }
+
+  /**
+   *  get a status change from the batch
+   */
+  const PresenceBatchEvent::Entry& PresenceBatchEvent::operator[](unsigned int n) const { return m_entries[n]; }
+
+  /**
+   *  get all the status changes in the batch, in the order they
+   *  arrived
+   */
+  const std::vector<PresenceBatchEvent::Entry>& PresenceBatchEvent::getEntries() const { return m_entries; }
+
   // ============================================================================
   //  User Info Change Event
   // ============================================================================
@@ -434,10 +546,108 @@ namespace ICQ2000 {
    *
    * @param contact the contact whose information has changed
    */
-  UserInfoChangeEvent::UserInfoChangeEvent(ContactRef contact, bool is_transient_detail) : ContactEvent(contact), m_is_transient_detail(is_transient_detail) { }
+  UserInfoChangeEvent::UserInfoChangeEvent(ContactRef contact, bool is_transient_detail)
+    : ContactEvent(contact), m_is_transient_detail(is_transient_detail),
+      m_fields(is_transient_detail ? Contact::Field_Transient : Contact::Field_All) { }
+
+  /**
+   *  Constructor for UserInfoChangeEvent
+   *
+   * @param contact the contact whose information has changed
+   * @param is_transient_detail whether only transient details changed
+   * @param fields bitmask of Contact::Field values that changed
+   */
+  UserInfoChangeEvent::UserInfoChangeEvent(ContactRef contact, bool is_transient_detail, unsigned int fields)
+    : ContactEvent(contact), m_is_transient_detail(is_transient_detail), m_fields(fields) { }
+
   ContactEvent::EventType UserInfoChangeEvent::getType() const { return UserInfoChange; }
   bool UserInfoChangeEvent::isTransientDetail() const { return m_is_transient_detail; }
 
+  /**
+   *  get the fields that changed
+   *
+   * @return bitmask of Contact::Field values
+   */
+  unsigned int UserInfoChangeEvent::getFields() const { return m_fields; }
+
+  /**
+   *  determine whether any of the given fields changed
+   *
+   * @param fields bitmask of Contact::Field values
+   */
+  bool UserInfoChangeEvent::changed(unsigned int fields) const { return (m_fields & fields) != 0; }
+
+  // ============================================================================
+  //  User Info Change Filter
+  // ============================================================================
+
+  /**
+   *  Constructor for UserInfoChangeFilter
+   *
+   * @param source the signal to listen on, typically a Contact's or the Client's userinfo signal
+   * @param mask bitmask of Contact::Field values of interest
+   */
+  UserInfoChangeFilter::UserInfoChangeFilter(sigslot::signal1<UserInfoChangeEvent*>& source, unsigned int mask)
+    : m_mask(mask)
+  {
+    source.connect(this, &UserInfoChangeFilter::userinfo_change_cb);
+  }
+
+  unsigned int UserInfoChangeFilter::getMask() const { return m_mask; }
+
+  void UserInfoChangeFilter::setMask(unsigned int mask) { m_mask = mask; }
+
+  void UserInfoChangeFilter::userinfo_change_cb(UserInfoChangeEvent *ev)
+  {
+    if (ev->changed(m_mask)) filtered.emit(ev);
+  }
+
+  // ============================================================================
+  //  Offline Message Batch Event
+  // ============================================================================
+
+  OfflineMessageBatchEvent::OfflineMessageBatchEvent() { }
+
+  OfflineMessageBatchEvent::~OfflineMessageBatchEvent()
+  {
+    std::vector<MessageEvent*>::iterator curr = m_messages.begin();
+    while (curr != m_messages.end()) {
+      delete (*curr);
+      ++curr;
+    }
+  }
+
+  /**
+   *  add a message to the batch, which takes ownership of it
+   */
+  void OfflineMessageBatchEvent::add(MessageEvent *ev) { m_messages.push_back(ev); }
+
+  /**
+   *  get the number of messages in the batch
+   */
+  unsigned int OfflineMessageBatchEvent::size() const { return m_messages.size(); }
+
+  bool OfflineMessageBatchEvent::empty() const { return m_messages.empty(); }
+
+  /**
+   *  get the nth message, in time order
+   */
+  MessageEvent* OfflineMessageBatchEvent::operator[](unsigned int n) const { return m_messages[n]; }
+
+  const std::vector<MessageEvent*>& OfflineMessageBatchEvent::getMessages() const { return m_messages; }
+
+  // ============================================================================
+  //  Metrics Event
+  // ============================================================================
+
+  MetricsEvent::MetricsEvent(const Metrics& m)
+    : m_metrics(m) { }
+
+  /**
+   *  get the snapshot of the metrics
+   */
+  const Metrics& MetricsEvent::getMetrics() const { return m_metrics; }
+
   // ============================================================================
   //  Search Result Event
   // ============================================================================
@@ -447,9 +657,14 @@ namespace ICQ2000 {
    */
   SearchResultEvent::SearchResultEvent(SearchResultEvent::SearchType t)
     : m_finished(false), m_expired(false), m_searchtype(t),
-      m_last_contact(NULL), m_more_results(0)
+      m_last_contact(NULL), m_more_results(0),
+      m_streaming(false), m_page_size(1), m_limit(0), m_count(0)
   { }
 
+  void* SearchResultEvent::operator new(size_t n) { return event_pool().allocate(n); }
+
+  void SearchResultEvent::operator delete(void *p, size_t n) { event_pool().deallocate(p, n); }
+
   ContactRef SearchResultEvent::getLastContactAdded() const { return m_last_contact; }
   
   ContactList& SearchResultEvent::getContactList() { return m_clist; }
@@ -470,6 +685,64 @@ namespace ICQ2000 {
   
   void SearchResultEvent::setNumberMoreResults(unsigned int m) { m_more_results = m; }
 
+  /**
+   *  get the handle for the search request, which completes once the
+   *  last result has been signalled or the search expires
+   */
+  RequestHandleRef SearchResultEvent::getRequestHandle() const { return m_handle; }
+
+  void SearchResultEvent::setRequestHandle(const RequestHandleRef& h) { m_handle = h; }
+
+  /**
+   *  determine whether the search is streaming. A streaming search
+   *  doesn't keep its results: the contact list only holds the ones
+   *  that are new since the last time the event was signalled.
+   */
+  bool SearchResultEvent::isStreaming() const { return m_streaming; }
+
+  /**
+   *  set whether the search is streaming, best done straight after
+   *  starting the search
+   */
+  void SearchResultEvent::setStreaming(bool b) { m_streaming = b; }
+
+  unsigned int SearchResultEvent::getPageSize() const { return m_page_size; }
+
+  /**
+   *  set how many results a streaming search gathers before it is
+   *  signalled. The last page may be shorter.
+   *
+   * @param n results per signal
+   */
+  void SearchResultEvent::setPageSize(unsigned int n) { m_page_size = (n == 0 ? 1 : n); }
+
+  unsigned int SearchResultEvent::getResultLimit() const { return m_limit; }
+
+  /**
+   *  set the most results wanted. When the limit is reached the
+   *  search finishes and anything more the server sends for it is
+   *  dropped.
+   *
+   * @param n most results, 0 for no limit
+   */
+  void SearchResultEvent::setResultLimit(unsigned int n) { m_limit = n; }
+
+  /**
+   *  get the number of results received so far
+   */
+  unsigned int SearchResultEvent::getResultCount() const { return m_count; }
+
+  bool SearchResultEvent::isLimitReached() const { return m_limit != 0 && m_count >= m_limit; }
+
+  /**
+   *  Add a result to the search. Used by the library.
+   */
+  void SearchResultEvent::addResult(ContactRef c)
+  {
+    m_last_contact = m_clist.add(c);
+    ++m_count;
+  }
+
   // ============================================================================
   //  Message Event
   // ============================================================================
@@ -479,8 +752,20 @@ namespace ICQ2000 {
    *
    * @param c the contact related to this event
    */
+  static unsigned int next_serial = 0;
+
   MessageEvent::MessageEvent(ContactRef c)
-    : m_contact(c)
+    : m_contact(c), m_serial(++next_serial)
+  { }
+
+  /**
+   *  Copy constructor for MessageEvent, the copy gets a serial of its
+   *  own
+   */
+  MessageEvent::MessageEvent(const MessageEvent& ev)
+    : Event(ev), m_contact(ev.m_contact), m_finished(ev.m_finished),
+      m_delivered(ev.m_delivered), m_direct(ev.m_direct),
+      m_failure_reason(ev.m_failure_reason), m_serial(++next_serial)
   { }
 
   /**
@@ -488,6 +773,10 @@ namespace ICQ2000 {
    */
   MessageEvent::~MessageEvent() { }
 
+  void* MessageEvent::operator new(size_t n) { return event_pool().allocate(n); }
+
+  void MessageEvent::operator delete(void *p, size_t n) { event_pool().deallocate(p, n); }
+
   /**
    *  get the contact related to the event
    *
@@ -495,6 +784,15 @@ namespace ICQ2000 {
    */
   ContactRef MessageEvent::getContact() { return m_contact; }
 
+  /**
+   *  get a number unique to this event. Events are pooled, so a later
+   *  event can have the same address as one deleted, but never the
+   *  same serial.
+   *
+   * @return the serial
+   */
+  unsigned int MessageEvent::getSerial() const { return m_serial; }
+
   /**
    *  get if a message event is finished.  This is used in the message
    *  ack'ing system.